@@ -28,6 +28,8 @@ struct _chain {
     Paf *paf;
     int64_t score;
     Chain *pChain;
+    int64_t last_visitor; // Index of the last alignment whose predecessor scan passed through a successor of this chain,
+    // used by the max_skip heuristic
 };
 
 /*
@@ -123,46 +125,57 @@ static void chain_to_pafs(Chain *chain, int64_t (*gap_cost)(int64_t, int64_t, vo
         chain->paf->chain_id = chain_id;
         chain->paf->chain_score = total_score;
         stList_append(output_pafs, chain->paf);
-        // Shift back to the previous link and cleanup
-        Chain *c = chain;
-        chain = chain->pChain;
-        free(c);
+        chain = chain->pChain; // Shift back to the previous link
     }
 }
 
 /*
- * Chains together the input pafs. Ignores strand.
+ * Compare two pafs by query sequence name, then target sequence name, then query start coordinate, so that
+ * each pair of sequences being chained forms a contiguous run of alignments.
  */
-static stList *paf_chain_ignore_strand(stList *pafs, int64_t (*gap_cost)(int64_t, int64_t, void *),
-                                void *gap_cost_params, int64_t max_gap_length, int64_t *chain_id) {
-    stList_sort(pafs, paf_cmp_by_query_location); // Sort alignments by query start coordinate
+static int paf_cmp_by_sequences_and_query_location(const void *a, const void *b) {
+    Paf *p1 = (Paf *)a, *p2 = (Paf *)b;
+    int i = strcmp(p1->query_name, p2->query_name);
+    if(i == 0) {
+        i = strcmp(p1->target_name, p2->target_name);
+        if(i == 0) {
+            i = paf_cmp_by_query_location(a, b);
+        }
+    }
+    return i;
+}
 
+/*
+ * Runs the chaining dynamic program over an array of chains sorted by query start coordinate, setting the
+ * score and best predecessor of each. Only the predecessor searches of the chains from counted_start onwards
+ * are added to stats.
+ */
+static void chain_alignments(Chain *chain_array, int64_t chain_number, int64_t (*gap_cost)(int64_t, int64_t, void *),
+                             void *gap_cost_params, int64_t max_gap_length, int64_t max_iter, int64_t max_skip,
+                             int64_t counted_start, ChainStats *stats) {
+    ChainStats uncounted_stats; // Scratch counters for the searches that are not counted
+    memset(&uncounted_stats, 0, sizeof(ChainStats));
     stSortedSet *active_chained_alignments = stSortedSet_construct3(chain_cmp_by_location, NULL); // The set of
     // alignments being chained,
     // sorted by chromosome, target end coordinate, then query end coordinate. Each record is of type Chain
 
-    stSortedSet *chains = stSortedSet_construct3(chain_cmp_by_score, free); // The set of all chains, sorted by score
-
     stList *to_remove = stList_construct(); // List of chained alignments to remove from the active_chained_alignments
     // array at the end of each loop
 
     // For each alignment
-    for(int64_t i=0; i<stList_length(pafs); i++) {
-        Paf *paf = stList_get(pafs, i);
-        Chain *chain = st_calloc(1, sizeof(Chain));
-        chain->paf = paf;
+    for(int64_t i=0; i<chain_number; i++) {
+        Chain *chain = &chain_array[i];
+        Paf *paf = chain->paf;
+        ChainStats *search_stats = i < counted_start ? &uncounted_stats : stats;
         chain->score = paf->score;
+        chain->pChain = NULL;
+        chain->last_visitor = -1;
 
         // Find highest scoring chains that alignment could be chained with:
         stSortedSetIterator *it = get_predecessor_chains(active_chained_alignments, chain); // This is an iterator over chains that the alignment could be joined to
 
-        //stSortedSetIterator *it = stSortedSet_size(active_chained_alignments) > 0 ?
-        //        stSortedSet_getIteratorFrom(active_chained_alignments, stSortedSet_getLast(active_chained_alignments)) :
-        //                          stSortedSet_getIterator(active_chained_alignments);
-        //stSortedSet_getNext(it);
-        //stSortedSet_getNext(it);
-
         Chain *pChain;
+        int64_t iterations = 0, skips = 0;
         while((pChain = stSortedSet_getPrevious(it)) != NULL) {
 
             if(strcmp(paf->query_name, pChain->paf->query_name) != 0 ||
@@ -171,6 +184,12 @@ static stList *paf_chain_ignore_strand(stList *pafs, int64_t (*gap_cost)(int64_t
                 break; // Can not chain, and no further predecessors can exist
             }
 
+            if(max_iter >= 0 && iterations++ >= max_iter) { // Examined as many candidates as allowed (minimap2's max_iter)
+                search_stats->max_iter_terminations++;
+                break;
+            }
+            search_stats->candidates_visited++;
+
             if(paf->query_start < pChain->paf->query_end) { // Chain ends of the query after the current paf starts,
                 // so can not chain, but further predecessors may exist
                 continue;
@@ -179,6 +198,7 @@ static stList *paf_chain_ignore_strand(stList *pafs, int64_t (*gap_cost)(int64_t
             // If the query gap is larger than max_gap_length then we can remove it from the set that can be chained
             if(paf->query_start - pChain->paf->query_end > max_gap_length) {
                 stList_append(to_remove, pChain);
+                search_stats->candidates_pruned++;
                 continue; // further predecessors may exist
             }
 
@@ -196,6 +216,20 @@ static stList *paf_chain_ignore_strand(stList *pafs, int64_t (*gap_cost)(int64_t
                     // alignment and the chain is the best score seen so far
                     chain->score = chain_score;
                     chain->pChain = pChain;
+                    search_stats->candidates_accepted++;
+                    if(skips > 0) {
+                        skips--;
+                    }
+                }
+                else if(pChain->last_visitor == i) { // We already scored a successor of this chain without improvement,
+                    // so this candidate is very likely dominated (minimap2's max_skip heuristic)
+                    if(max_skip >= 0 && ++skips > max_skip) {
+                        search_stats->max_skip_terminations++;
+                        break;
+                    }
+                }
+                if(pChain->pChain != NULL) { // Mark the predecessor of this candidate as reached via a successor
+                    pChain->pChain->last_visitor = i;
                 }
             }
         }
@@ -204,15 +238,158 @@ static stList *paf_chain_ignore_strand(stList *pafs, int64_t (*gap_cost)(int64_t
         // Add the paf to the chained alignments
         stSortedSet_insert(active_chained_alignments, chain);
 
-        // Add the chain to the final set of chains
-        stSortedSet_insert(chains, chain);
-
         // Remove any chainable alignments
         while(stList_length(to_remove) > 0) {
             stSortedSet_remove(active_chained_alignments, stList_pop(to_remove));
         }
     }
 
+    // Cleanup
+    assert(stList_length(to_remove) == 0);
+    stList_destruct(to_remove);
+    stSortedSet_destruct(active_chained_alignments);
+}
+
+/*
+ * A window of a pair of sequences being chained. The window decides the predecessors of the owned chains,
+ * using the chains from context_start onwards as candidates.
+ */
+typedef struct _chainWindow {
+    int64_t context_start; // Index of the first chain that may be a predecessor of an owned chain
+    int64_t owned_start; // Index of the first chain owned by the window
+    int64_t owned_end; // Index one past the last chain owned by the window
+} ChainWindow;
+
+/*
+ * Splits the sorted chains into windows of window_size query bases. Each window's context extends back by
+ * max_gap_length plus the longest alignment of its sequence pair, so every alignment that could be the direct
+ * predecessor of an owned alignment is in the window. If window_size is not positive, each pair of
+ * sequences is one window.
+ */
+static stList *get_chain_windows(Chain *chain_array, int64_t chain_number, int64_t max_gap_length,
+                                 int64_t window_size) {
+    stList *windows = stList_construct3(0, free);
+    int64_t i = 0;
+    while(i < chain_number) { // For each pair of sequences
+        Paf *first = chain_array[i].paf;
+        int64_t j = i, max_length = 0;
+        while(j < chain_number && strcmp(chain_array[j].paf->query_name, first->query_name) == 0 &&
+              strcmp(chain_array[j].paf->target_name, first->target_name) == 0) {
+            int64_t length = chain_array[j].paf->query_end - chain_array[j].paf->query_start;
+            max_length = length > max_length ? length : max_length;
+            j++;
+        }
+        int64_t k = i, context_start = i;
+        while(k < j) { // For each window of the pair
+            ChainWindow *window = st_malloc(sizeof(ChainWindow));
+            window->owned_start = k;
+            if(window_size > 0) {
+                int64_t window_start = chain_array[k].paf->query_start;
+                while(chain_array[context_start].paf->query_start < window_start - max_gap_length - max_length) {
+                    context_start++;
+                }
+                while(k < j && chain_array[k].paf->query_start < window_start + window_size) {
+                    k++;
+                }
+            }
+            else {
+                k = j;
+            }
+            window->context_start = context_start;
+            window->owned_end = k;
+            stList_append(windows, window);
+        }
+        i = j;
+    }
+    return windows;
+}
+
+/*
+ * Chains a window on private copies of its alignments, so that windows can be chained concurrently, then
+ * copies the predecessors of the owned chains back. Only the searches of the owned chains are counted in stats,
+ * so the context shared with the previous window is not counted twice.
+ */
+static void chain_window(Chain *chain_array, ChainWindow *window, int64_t (*gap_cost)(int64_t, int64_t, void *),
+                         void *gap_cost_params, int64_t max_gap_length, int64_t max_iter, int64_t max_skip,
+                         ChainStats *stats) {
+    int64_t length = window->owned_end - window->context_start;
+    Paf *local_pafs = st_malloc(length * sizeof(Paf));
+    Chain *local_chains = st_calloc(length, sizeof(Chain));
+    for(int64_t i=0; i<length; i++) {
+        local_pafs[i] = *chain_array[window->context_start + i].paf; // Shallow copy, the strings are only read
+        local_chains[i].paf = &local_pafs[i];
+    }
+    chain_alignments(local_chains, length, gap_cost, gap_cost_params, max_gap_length, max_iter, max_skip,
+                     window->owned_start - window->context_start, stats);
+    for(int64_t i=window->owned_start; i<window->owned_end; i++) {
+        Chain *local_chain = &local_chains[i - window->context_start];
+        chain_array[i].pChain = local_chain->pChain == NULL ? NULL :
+                &chain_array[window->context_start + (local_chain->pChain - local_chains)];
+    }
+    free(local_chains);
+    free(local_pafs);
+}
+
+/*
+ * Chains together the input pafs. Ignores strand.
+ */
+static stList *paf_chain_ignore_strand(stList *pafs, int64_t (*gap_cost)(int64_t, int64_t, void *),
+                                void *gap_cost_params, int64_t max_gap_length, int64_t max_iter, int64_t max_skip,
+                                int64_t window_size, ChainStats *stats, int64_t *chain_id) {
+    stList_sort(pafs, paf_cmp_by_sequences_and_query_location); // Sort alignments by sequence pair, then query start coordinate
+
+    int64_t chain_number = stList_length(pafs);
+    Chain *chain_array = st_calloc(chain_number, sizeof(Chain)); // A chain for each alignment, in the same order
+    for(int64_t i=0; i<chain_number; i++) {
+        chain_array[i].paf = stList_get(pafs, i);
+    }
+
+    stList *windows = get_chain_windows(chain_array, chain_number, max_gap_length, window_size);
+    if(window_size > 0) {
+        st_logDebug("Chaining %" PRIi64 " alignments in %" PRIi64 " windows\n", chain_number, stList_length(windows));
+        // Chain the windows in parallel
+        #pragma omp parallel for schedule(dynamic)
+        for(int64_t i=0; i<stList_length(windows); i++) {
+            ChainStats window_stats;
+            memset(&window_stats, 0, sizeof(ChainStats));
+            chain_window(chain_array, stList_get(windows, i), gap_cost, gap_cost_params, max_gap_length,
+                         max_iter, max_skip, &window_stats);
+            #pragma omp critical
+            {
+                stats->candidates_visited += window_stats.candidates_visited;
+                stats->candidates_pruned += window_stats.candidates_pruned;
+                stats->candidates_accepted += window_stats.candidates_accepted;
+                stats->max_iter_terminations += window_stats.max_iter_terminations;
+                stats->max_skip_terminations += window_stats.max_skip_terminations;
+            }
+        }
+
+        // Reconcile the windows at their seams: a window scores the chains entering it only from its context
+        // onwards, so recompute the scores over the chosen links, in query order so predecessors come first
+        for(int64_t i=0; i<chain_number; i++) {
+            Chain *chain = &chain_array[i];
+            chain->score = chain->paf->score;
+            if(chain->pChain != NULL) {
+                Paf *p = chain->pChain->paf, *q = chain->paf;
+                chain->score += chain->pChain->score - gap_cost(q->query_start - p->query_end,
+                                                                q->target_start - p->target_end, gap_cost_params);
+            }
+        }
+    }
+    else { // Chain each pair of sequences in place
+        for(int64_t i=0; i<stList_length(windows); i++) {
+            ChainWindow *window = stList_get(windows, i);
+            chain_alignments(&chain_array[window->owned_start], window->owned_end - window->owned_start,
+                             gap_cost, gap_cost_params, max_gap_length, max_iter, max_skip, 0, stats);
+        }
+    }
+    stList_destruct(windows);
+
+    stSortedSet *chains = stSortedSet_construct3(chain_cmp_by_score, NULL); // The set of all chains, sorted by score
+    for(int64_t i=0; i<chain_number; i++) {
+        stSortedSet_insert(chains, &chain_array[i]);
+    }
+
     // Get chains, from highest scoring to lowest
     stList *outputChains = stList_construct();
     while(stSortedSet_size(chains) > 0) { // For each alignment, in order of score (high to low)
@@ -240,11 +417,9 @@ static stList *paf_chain_ignore_strand(stList *pafs, int64_t (*gap_cost)(int64_t
 
     // Cleanup
     stList_destruct(outputChains);
-    assert(stList_length(to_remove) == 0);
-    stList_destruct(to_remove);
-    stSortedSet_destruct(active_chained_alignments);
     assert(stSortedSet_size(chains) == 0);
     stSortedSet_destruct(chains);
+    free(chain_array);
 
     return output_pafs;
 }
@@ -265,6 +440,18 @@ static int paf_cmp_by_score(const void *a, const void *b) {
 
 stList *paf_chain(stList *pafs, int64_t (*gap_cost)(int64_t, int64_t, void *), void *gap_cost_params,
                   int64_t max_gap_length, float percentage_to_trim) {
+    return paf_chain2(pafs, gap_cost, gap_cost_params, max_gap_length, percentage_to_trim, -1, -1, 0, NULL);
+}
+
+stList *paf_chain2(stList *pafs, int64_t (*gap_cost)(int64_t, int64_t, void *), void *gap_cost_params,
+                   int64_t max_gap_length, float percentage_to_trim, int64_t max_iter, int64_t max_skip,
+                   int64_t window_size, ChainStats *stats) {
+    ChainStats local_stats;
+    if(stats == NULL) { // Caller does not want the counters, so use a scratch set
+        stats = &local_stats;
+    }
+    memset(stats, 0, sizeof(ChainStats));
+
     // Split into forward and reverse strand alignments
     stList *positive_strand_pafs = stList_construct();
     stList *negative_strand_pafs = stList_construct();
@@ -301,8 +488,10 @@ stList *paf_chain(stList *pafs, int64_t (*gap_cost)(int64_t, int64_t, void *), v
     }
 
     int64_t chain_id = 0;
-    stList *positive_chained_pafs = paf_chain_ignore_strand(positive_strand_pafs, gap_cost, gap_cost_params, max_gap_length, &chain_id);
-    stList *negative_chained_pafs = paf_chain_ignore_strand(negative_strand_pafs, gap_cost, gap_cost_params, max_gap_length, &chain_id);
+    stList *positive_chained_pafs = paf_chain_ignore_strand(positive_strand_pafs, gap_cost, gap_cost_params, max_gap_length,
+                                                           max_iter, max_skip, window_size, stats, &chain_id);
+    stList *negative_chained_pafs = paf_chain_ignore_strand(negative_strand_pafs, gap_cost, gap_cost_params, max_gap_length,
+                                                           max_iter, max_skip, window_size, stats, &chain_id);
 
     // Correct negative strand coordinates
     for(int64_t i=0; i<stList_length(negative_chained_pafs); i++) {
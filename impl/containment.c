@@ -0,0 +1,174 @@
+#include "paf.h"
+
+/*
+ * Functions for removing alignments that are contained in better scoring alignments on the same diagonal, such as the
+ * repeated alignments of the overlaps between chunks.
+ */
+
+typedef struct _containmentRecord {
+    Paf *paf;
+    int64_t index; // The index of the paf in the input list
+    int64_t diagonal_min, diagonal_max; // The range of diagonals the alignment passes through
+} ContainmentRecord;
+
+/*
+ * The diagonal of a pair of aligned coordinates. For the opposite strand the query coordinate decreases as the target
+ * coordinate increases, so the anti-diagonal is used.
+ */
+static int64_t get_diagonal(Paf *paf, int64_t query_coordinate, int64_t target_coordinate) {
+    return paf->same_strand ? target_coordinate - query_coordinate : target_coordinate + query_coordinate;
+}
+
+/*
+ * Sets the range of diagonals of an alignment. The diagonal only changes within gaps, so the extremes are at the ends
+ * of the cigar operations.
+ */
+static void set_diagonal_range(ContainmentRecord *record) {
+    Paf *paf = record->paf;
+    int64_t query_coordinate = paf->same_strand ? paf->query_start : paf->query_end;
+    int64_t target_coordinate = paf->target_start;
+    record->diagonal_min = record->diagonal_max = get_diagonal(paf, query_coordinate, target_coordinate);
+    for (int64_t ci = 0; ci < cigar_count(paf->cigar); ci++) {
+        CigarRecord *c = cigar_get(paf->cigar, ci);
+        if(c->op != query_delete) {
+            query_coordinate += paf->same_strand ? c->length : -c->length;
+        }
+        if(c->op != query_insert) {
+            target_coordinate += c->length;
+        }
+        int64_t diagonal = get_diagonal(paf, query_coordinate, target_coordinate);
+        record->diagonal_min = diagonal < record->diagonal_min ? diagonal : record->diagonal_min;
+        record->diagonal_max = diagonal > record->diagonal_max ? diagonal : record->diagonal_max;
+    }
+    // Without a cigar use the diagonals of the two ends
+    int64_t diagonal = get_diagonal(paf, paf->same_strand ? paf->query_end : paf->query_start, paf->target_end);
+    record->diagonal_min = diagonal < record->diagonal_min ? diagonal : record->diagonal_min;
+    record->diagonal_max = diagonal > record->diagonal_max ? diagonal : record->diagonal_max;
+}
+
+/*
+ * Orders records by query, target and strand, then by query start and, for equal starts, longest first.
+ */
+static int containment_record_cmp(const void *a, const void *b) {
+    Paf *p = ((ContainmentRecord *)a)->paf, *p2 = ((ContainmentRecord *)b)->paf;
+    int i = strcmp(p->query_name, p2->query_name);
+    if(i == 0 && (i = strcmp(p->target_name, p2->target_name)) == 0) {
+        i = p->same_strand != p2->same_strand ? (p->same_strand ? 1 : -1) :
+            (p->query_start != p2->query_start ? (p->query_start < p2->query_start ? -1 : 1) :
+             (p->query_end != p2->query_end ? (p->query_end > p2->query_end ? -1 : 1) :
+              (((ContainmentRecord *)a)->index < ((ContainmentRecord *)b)->index ? -1 :
+               ((ContainmentRecord *)a)->index > ((ContainmentRecord *)b)->index)));
+    }
+    return i;
+}
+
+static bool same_group(ContainmentRecord *r, ContainmentRecord *r2) {
+    return r->paf->same_strand == r2->paf->same_strand && strcmp(r->paf->query_name, r2->paf->query_name) == 0 &&
+           strcmp(r->paf->target_name, r2->paf->target_name) == 0;
+}
+
+/*
+ * Returns non-zero if a is better than b, by score, then number of matches, then query length, then list order.
+ */
+static bool is_better(ContainmentRecord *a, ContainmentRecord *b) {
+    Paf *p = a->paf, *p2 = b->paf;
+    if(p->score != p2->score) {
+        return p->score > p2->score;
+    }
+    if(p->num_matches != p2->num_matches) {
+        return p->num_matches > p2->num_matches;
+    }
+    if(p->query_end - p->query_start != p2->query_end - p2->query_start) {
+        return p->query_end - p->query_start > p2->query_end - p2->query_start;
+    }
+    return a->index < b->index;
+}
+
+static bool is_contained(ContainmentRecord *a, ContainmentRecord *b, int64_t diagonal_slack) {
+    return a != b && a->paf->query_start <= b->paf->query_start && a->paf->query_end >= b->paf->query_end &&
+           a->paf->target_start <= b->paf->target_start && a->paf->target_end >= b->paf->target_end &&
+           a->diagonal_min - diagonal_slack <= b->diagonal_min && a->diagonal_max + diagonal_slack >= b->diagonal_max &&
+           is_better(a, b);
+}
+
+/*
+ * Searches the records of a group in [start, end), whose max query ends are given by a segment tree rooted at node,
+ * for a better record containing b. Only records whose query end reaches that of b are visited.
+ */
+static bool find_container(ContainmentRecord *group, int64_t *max_query_ends, int64_t node, int64_t start, int64_t end,
+                           int64_t prefix_length, ContainmentRecord *b, int64_t diagonal_slack) {
+    if(start >= prefix_length || max_query_ends[node] < b->paf->query_end) {
+        return 0;
+    }
+    if(end - start == 1) {
+        return is_contained(&group[start], b, diagonal_slack);
+    }
+    int64_t middle = (start + end) / 2;
+    return find_container(group, max_query_ends, 2 * node, start, middle, prefix_length, b, diagonal_slack) ||
+           find_container(group, max_query_ends, 2 * node + 1, middle, end, prefix_length, b, diagonal_slack);
+}
+
+static int64_t build_max_query_ends(ContainmentRecord *group, int64_t *max_query_ends, int64_t node, int64_t start,
+                                    int64_t end) {
+    if(end - start == 1) {
+        return max_query_ends[node] = group[start].paf->query_end;
+    }
+    int64_t middle = (start + end) / 2;
+    int64_t i = build_max_query_ends(group, max_query_ends, 2 * node, start, middle);
+    int64_t j = build_max_query_ends(group, max_query_ends, 2 * node + 1, middle, end);
+    return max_query_ends[node] = i > j ? i : j;
+}
+
+int64_t remove_contained_pafs(stList *pafs, int64_t diagonal_slack) {
+    int64_t paf_number = stList_length(pafs);
+    ContainmentRecord *records = st_malloc((paf_number + 1) * sizeof(ContainmentRecord));
+    for(int64_t i=0; i<paf_number; i++) {
+        records[i].paf = stList_get(pafs, i);
+        records[i].index = i;
+        set_diagonal_range(&records[i]);
+    }
+    qsort(records, paf_number, sizeof(ContainmentRecord), containment_record_cmp);
+
+    // For each group of records with the same query, target and strand, index the query ends of the group, sorted by
+    // query start, in a max segment tree. The records that may contain a record are those with a query start at most
+    // its own, a prefix of the group, with a query end at least its own
+    bool *contained = st_calloc(paf_number, sizeof(bool)); // Indexed by input index
+    int64_t *max_query_ends = st_malloc(4 * (paf_number + 1) * sizeof(int64_t));
+    for(int64_t i=0; i<paf_number;) {
+        int64_t j = i + 1;
+        while(j < paf_number && same_group(&records[i], &records[j])) {
+            j++;
+        }
+        ContainmentRecord *group = &records[i];
+        int64_t group_length = j - i;
+        build_max_query_ends(group, max_query_ends, 1, 0, group_length);
+        for(int64_t k=0, prefix_length=0; k<group_length; k++) {
+            while(prefix_length < group_length &&
+                  group[prefix_length].paf->query_start <= group[k].paf->query_start) {
+                prefix_length++;
+            }
+            contained[group[k].index] = find_container(group, max_query_ends, 1, 0, group_length, prefix_length,
+                                                       &group[k], diagonal_slack);
+        }
+        i = j;
+    }
+
+    // Remove the contained pafs, keeping the order of the rest
+    int64_t j = 0;
+    for(int64_t i=0; i<paf_number; i++) {
+        Paf *paf = stList_get(pafs, i);
+        if(contained[i]) {
+            paf_destruct(paf);
+        }
+        else {
+            stList_set(pafs, j++, paf);
+        }
+    }
+    while(stList_length(pafs) > j) {
+        stList_pop(pafs);
+    }
+    free(records);
+    free(contained);
+    free(max_query_ends);
+    return paf_number - j;
+}
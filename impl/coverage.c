@@ -0,0 +1,166 @@
+#include "paf.h"
+
+/*
+ * Functions for tracking alignment coverage as runs of bases with equal coverage
+ */
+
+static int coverage_run_cmp(const void *a, const void *b) {
+    int64_t i = ((CoverageRun *)a)->start, j = ((CoverageRun *)b)->start;
+    return i > j ? 1 : (i < j ? -1 : 0);
+}
+
+static CoverageRun *coverage_run_construct(int64_t start, int64_t end, uint16_t count) {
+    CoverageRun *run = st_malloc(sizeof(CoverageRun));
+    run->start = start;
+    run->end = end;
+    run->count = count;
+    return run;
+}
+
+SequenceCoverage *sequenceCoverage_construct(char *name, int64_t length) {
+    SequenceCoverage *coverage = st_malloc(sizeof(SequenceCoverage));
+    coverage->name = stString_copy(name);
+    coverage->length = length;
+    coverage->runs = stSortedSet_construct3(coverage_run_cmp, free);
+    if(length > 0) {
+        stSortedSet_insert(coverage->runs, coverage_run_construct(0, length, 0));
+    }
+    return coverage;
+}
+
+void sequenceCoverage_destruct(SequenceCoverage *coverage) {
+    free(coverage->name);
+    stSortedSet_destruct(coverage->runs);
+    free(coverage);
+}
+
+/*
+ * Gets the run containing the given position.
+ */
+static CoverageRun *get_run(SequenceCoverage *coverage, int64_t position) {
+    CoverageRun probe;
+    probe.start = position;
+    CoverageRun *run = stSortedSet_searchLessThanOrEqual(coverage->runs, &probe);
+    assert(run != NULL && run->start <= position && position < run->end);
+    return run;
+}
+
+/*
+ * Makes a run start at the given position, splitting the run containing it if needed.
+ */
+static void split_run(SequenceCoverage *coverage, int64_t position) {
+    if(position <= 0 || position >= coverage->length) {
+        return;
+    }
+    CoverageRun *run = get_run(coverage, position);
+    if(run->start < position) {
+        stSortedSet_insert(coverage->runs, coverage_run_construct(position, run->end, run->count));
+        run->end = position;
+    }
+}
+
+/*
+ * Merges the run starting at the given position into the previous run, if they have the same count.
+ */
+static void merge_run(SequenceCoverage *coverage, int64_t position) {
+    if(position <= 0 || position >= coverage->length) {
+        return;
+    }
+    CoverageRun *run = get_run(coverage, position);
+    assert(run->start == position);
+    CoverageRun *previous_run = stSortedSet_searchLessThan(coverage->runs, run);
+    assert(previous_run != NULL && previous_run->end == position);
+    if(previous_run->count == run->count) {
+        previous_run->end = run->end;
+        stSortedSet_remove(coverage->runs, run);
+        free(run);
+    }
+}
+
+void sequenceCoverage_increment(SequenceCoverage *coverage, int64_t start, int64_t end) {
+    assert(start >= 0 && end <= coverage->length);
+    if(start >= end) {
+        return;
+    }
+    split_run(coverage, start);
+    split_run(coverage, end);
+    stSortedSetIterator *it = stSortedSet_getIteratorFrom(coverage->runs, get_run(coverage, start));
+    CoverageRun *run;
+    while((run = stSortedSet_getNext(it)) != NULL && run->start < end) {
+        if(run->count < INT16_MAX - 1) { // prevent overflow, as for SequenceCountArray
+            run->count++;
+        }
+    }
+    stSortedSet_destructIterator(it);
+    // Only the runs at either end of the range can now have the same count as their neighbours
+    merge_run(coverage, start);
+    merge_run(coverage, end);
+}
+
+int64_t sequenceCoverage_get_max(SequenceCoverage *coverage, int64_t start, int64_t end) {
+    int64_t max_count = 0;
+    if(start >= end) {
+        return max_count;
+    }
+    stSortedSetIterator *it = stSortedSet_getIteratorFrom(coverage->runs, get_run(coverage, start));
+    CoverageRun *run;
+    while((run = stSortedSet_getNext(it)) != NULL && run->start < end) {
+        if(run->count > max_count) {
+            max_count = run->count;
+        }
+    }
+    stSortedSet_destructIterator(it);
+    return max_count;
+}
+
+void sequenceCoverage_histogram(SequenceCoverage *coverage, int64_t start, int64_t end, int64_t *level_counts) {
+    if(start >= end) {
+        return;
+    }
+    stSortedSetIterator *it = stSortedSet_getIteratorFrom(coverage->runs, get_run(coverage, start));
+    CoverageRun *run;
+    while((run = stSortedSet_getNext(it)) != NULL && run->start < end) {
+        level_counts[run->count] += (run->end < end ? run->end : end) - (run->start > start ? run->start : start);
+    }
+    stSortedSet_destructIterator(it);
+}
+
+stSortedSetIterator *sequenceCoverage_get_run_iterator(SequenceCoverage *coverage) {
+    return stSortedSet_getIterator(coverage->runs);
+}
+
+int64_t sequenceCoverage_run_number(SequenceCoverage *coverage) {
+    return stSortedSet_size(coverage->runs);
+}
+
+SequenceCoverage *get_alignment_coverage(stHash *seq_names_to_coverages, Paf *paf) {
+    SequenceCoverage *coverage = stHash_search(seq_names_to_coverages, paf->query_name);
+    if(coverage == NULL) { // If the coverage has not been initialized yet
+        coverage = sequenceCoverage_construct(paf->query_name, paf->query_length);
+        stHash_insert(seq_names_to_coverages, coverage->name, coverage); // adds to the hash
+    }
+    else {
+        assert(coverage->length == paf->query_length); // Check the name is unique
+    }
+    return coverage;
+}
+
+void increase_alignment_coverage(SequenceCoverage *coverage, Paf *paf) {
+    int64_t i = paf->query_start, range_start = i; // [range_start, i) is the pending range of matched query bases,
+    // as matches separated only by deletes in the query are contiguous in the query they are incremented together
+    for (int64_t ci = 0; ci < cigar_count(paf->cigar); ci++) {
+        CigarRecord *c = cigar_get(paf->cigar, ci);
+        if(c->op != query_delete) {
+            if(c->op == query_insert) { // Ends the pending range
+                sequenceCoverage_increment(coverage, range_start, i);
+                range_start = i + c->length;
+            }
+            else { // Is some kind of match
+                assert(c->op == match || c->op == sequence_match || c->op == sequence_mismatch);
+            }
+            i += c->length;
+        }
+    }
+    assert(i == paf->query_end);
+    sequenceCoverage_increment(coverage, range_start, i);
+}
@@ -0,0 +1,131 @@
+#include "paf.h"
+
+/*
+ * Functions for calculating alignment coverage by sweeping the boundaries of the matched intervals of the alignments
+ */
+
+CoverageEvents *coverageEvents_construct(char *name, int64_t length) {
+    CoverageEvents *coverage_events = st_calloc(1, sizeof(CoverageEvents));
+    coverage_events->name = stString_copy(name);
+    coverage_events->length = length;
+    coverage_events->capacity = 16;
+    coverage_events->events = st_malloc(coverage_events->capacity * sizeof(int64_t));
+    return coverage_events;
+}
+
+void coverageEvents_destruct(CoverageEvents *coverage_events) {
+    free(coverage_events->name);
+    free(coverage_events->events);
+    free(coverage_events);
+}
+
+void coverageEvents_add(CoverageEvents *coverage_events, int64_t start, int64_t end) {
+    assert(start >= 0 && end <= coverage_events->length);
+    if(start >= end) {
+        return;
+    }
+    if(coverage_events->event_number + 2 > coverage_events->capacity) {
+        coverage_events->capacity *= 2;
+        coverage_events->events = realloc(coverage_events->events, coverage_events->capacity * sizeof(int64_t));
+    }
+    coverage_events->events[coverage_events->event_number++] = start * 2 + 1;
+    coverage_events->events[coverage_events->event_number++] = end * 2;
+}
+
+static int event_cmp(const void *a, const void *b) {
+    int64_t i = *(int64_t *)a, j = *(int64_t *)b;
+    return i > j ? 1 : (i < j ? -1 : 0);
+}
+
+void coverageEvents_sweep(CoverageEvents *coverage_events,
+                          void (*fn)(void *extra_arg, int64_t start, int64_t end, int64_t count), void *extra_arg) {
+    qsort(coverage_events->events, coverage_events->event_number, sizeof(int64_t), event_cmp);
+    int64_t run_start = 0, count = 0; // The current run and its coverage
+    for(int64_t i=0; i<coverage_events->event_number;) {
+        int64_t position = coverage_events->events[i] / 2, new_count = count;
+        for(; i<coverage_events->event_number && coverage_events->events[i] / 2 == position; i++) { // All the events
+            // at the position
+            new_count += coverage_events->events[i] % 2 == 1 ? 1 : -1;
+        }
+        if(new_count != count) { // Otherwise intervals meet at the position without changing the coverage
+            if(position > run_start) {
+                fn(extra_arg, run_start, position, count);
+            }
+            run_start = position;
+            count = new_count;
+        }
+    }
+    assert(count == 0);
+    if(coverage_events->length > run_start) {
+        fn(extra_arg, run_start, coverage_events->length, 0);
+    }
+}
+
+CoverageEvents *get_alignment_coverage_events(stHash *seq_names_to_coverage_events, Paf *paf, bool inverted) {
+    char *name = inverted ? paf->target_name : paf->query_name;
+    int64_t length = inverted ? paf->target_length : paf->query_length;
+    CoverageEvents *coverage_events = stHash_search(seq_names_to_coverage_events, name);
+    if(coverage_events == NULL) { // If the events have not been initialized yet
+        coverage_events = coverageEvents_construct(name, length);
+        stHash_insert(seq_names_to_coverage_events, coverage_events->name, coverage_events); // adds to the hash
+    }
+    else {
+        assert(coverage_events->length == length); // Check the name is unique
+    }
+    return coverage_events;
+}
+
+/*
+ * Adds the interval [start, end) of offsets along the sequence from the start of the alignment.
+ */
+static void add_alignment_interval(CoverageEvents *coverage_events, Paf *paf, bool inverted, int64_t start,
+                                   int64_t end) {
+    if(!inverted) {
+        coverageEvents_add(coverage_events, paf->query_start + start, paf->query_start + end);
+    }
+    else if(paf->same_strand) {
+        coverageEvents_add(coverage_events, paf->target_start + start, paf->target_start + end);
+    }
+    else { // The target is traversed from its end
+        coverageEvents_add(coverage_events, paf->target_end - end, paf->target_end - start);
+    }
+}
+
+void add_alignment_coverage_events(CoverageEvents *coverage_events, Paf *paf, bool inverted) {
+    char skipped_op = inverted ? 'D' : 'I'; // The operation that moves along the sequence without matching it
+    int64_t i = 0, range_start = 0; // [range_start, i) is the pending range of matched bases, as offsets from the
+    // start of the alignment, as matches separated only by gaps in the other sequence are contiguous
+    if(paf->cigar != NULL) { // Already parsed
+        for(int64_t ci = 0; ci < cigar_count(paf->cigar); ci++) {
+            CigarRecord *c = cigar_get(paf->cigar, ci);
+            if(c->op == (inverted ? query_delete : query_insert)) {
+                add_alignment_interval(coverage_events, paf, inverted, range_start, i);
+                i += c->length;
+                range_start = i;
+            }
+            else if(c->op != (inverted ? query_insert : query_delete)) { // Is some kind of match
+                i += c->length;
+            }
+        }
+    }
+    for(char *s = paf->cigar == NULL ? paf->cigar_string : NULL; s != NULL && *s != '\0'; s++) {
+        int64_t length = 0;
+        while(*s >= '0' && *s <= '9') {
+            length = length * 10 + (*s++ - '0');
+        }
+        if(*s == 'M' || *s == '=' || *s == 'X') {
+            i += length;
+        }
+        else if(*s == skipped_op) {
+            add_alignment_interval(coverage_events, paf, inverted, range_start, i);
+            i += length;
+            range_start = i;
+        }
+        else if(*s != 'I' && *s != 'D') {
+            st_errAbort("Got an unexpected character paf cigar string: %c\n", *s);
+        }
+    }
+    add_alignment_interval(coverage_events, paf, inverted, range_start, i);
+    assert((paf->cigar == NULL && paf->cigar_string == NULL) ||
+           i == (inverted ? paf->target_end - paf->target_start : paf->query_end - paf->query_start));
+}
@@ -0,0 +1,118 @@
+#include "paf.h"
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <fcntl.h>
+#include <unistd.h>
+
+/*
+ * Functions for saving alignment count arrays to a file and memory mapping them back, so tiling can be resumed.
+ *
+ * The file is a sequence of 64 bit words: the magic number, the format version, the saturation count and the number
+ * of sequences, followed for each sequence by the length of its name, its length, its NUL terminated name padded to
+ * a multiple of eight bytes and its counts, also padded to a multiple of eight bytes. Keeping everything aligned lets
+ * the counts be used in place.
+ */
+
+static const char count_arrays_magic[8] = { 'P', 'A', 'F', 'F', 'Y', 'C', 'N', 'T' };
+#define COUNT_ARRAYS_VERSION 1
+
+static int64_t padded_length(int64_t bytes) {
+    return (bytes + 7) / 8 * 8;
+}
+
+static void write_word(FILE *fh, int64_t i) {
+    if(fwrite(&i, sizeof(int64_t), 1, fh) != 1) {
+        st_errAbort("Failed to write count arrays\n");
+    }
+}
+
+static void write_padded(FILE *fh, void *data, int64_t bytes) {
+    static const char padding[8] = { 0 };
+    if(fwrite(data, 1, bytes, fh) != bytes || fwrite(padding, 1, padded_length(bytes) - bytes, fh) != padded_length(bytes) - bytes) {
+        st_errAbort("Failed to write count arrays\n");
+    }
+}
+
+static int sequence_name_cmp(const void *a, const void *b) {
+    return strcmp(((SequenceCountArray *)a)->name, ((SequenceCountArray *)b)->name);
+}
+
+void write_alignment_count_arrays(FILE *fh, stHash *seq_names_to_alignment_count_arrays, int64_t saturation_count) {
+    stList *seq_count_arrays = stHash_getValues(seq_names_to_alignment_count_arrays);
+    stList_sort(seq_count_arrays, sequence_name_cmp); // So the file does not depend on the hash order
+    write_padded(fh, (void *)count_arrays_magic, sizeof(count_arrays_magic));
+    write_word(fh, COUNT_ARRAYS_VERSION);
+    write_word(fh, saturation_count);
+    write_word(fh, stList_length(seq_count_arrays));
+    for(int64_t i=0; i<stList_length(seq_count_arrays); i++) {
+        SequenceCountArray *seq_count_array = stList_get(seq_count_arrays, i);
+        int64_t name_length = strlen(seq_count_array->name) + 1;
+        write_word(fh, name_length);
+        write_word(fh, seq_count_array->length);
+        write_padded(fh, seq_count_array->name, name_length);
+        write_padded(fh, seq_count_array->counts, seq_count_array->length * sizeof(uint16_t));
+    }
+    stList_destruct(seq_count_arrays);
+}
+
+/*
+ * Gets the next 64 bit word of the file, checking it is within the file.
+ */
+static int64_t read_word(CountArraysFile *count_arrays_file, int64_t *offset, char *file) {
+    if(*offset + (int64_t)sizeof(int64_t) > count_arrays_file->length) {
+        st_errAbort("Count arrays file is truncated: %s\n", file);
+    }
+    int64_t i = *(int64_t *)((char *)count_arrays_file->data + *offset);
+    *offset += sizeof(int64_t);
+    return i;
+}
+
+CountArraysFile *read_alignment_count_arrays(char *file, stHash *seq_names_to_alignment_count_arrays) {
+    int fd = open(file, O_RDONLY);
+    struct stat file_stat;
+    if(fd == -1 || fstat(fd, &file_stat) != 0) {
+        st_errAbort("Could not open count arrays file: %s\n", file);
+    }
+    CountArraysFile *count_arrays_file = st_calloc(1, sizeof(CountArraysFile));
+    count_arrays_file->length = file_stat.st_size;
+    if(count_arrays_file->length < (int64_t)sizeof(count_arrays_magic) ||
+       (count_arrays_file->data = mmap(NULL, count_arrays_file->length, PROT_READ | PROT_WRITE, MAP_PRIVATE, fd, 0)) == MAP_FAILED ||
+       memcmp(count_arrays_file->data, count_arrays_magic, sizeof(count_arrays_magic)) != 0) {
+        st_errAbort("Not a count arrays file: %s\n", file);
+    }
+    close(fd); // The mapping remains valid
+
+    int64_t offset = sizeof(count_arrays_magic);
+    if(read_word(count_arrays_file, &offset, file) != COUNT_ARRAYS_VERSION) {
+        st_errAbort("Unsupported count arrays file version: %s\n", file);
+    }
+    count_arrays_file->saturation_count = read_word(count_arrays_file, &offset, file);
+    int64_t sequence_number = read_word(count_arrays_file, &offset, file);
+    for(int64_t i=0; i<sequence_number; i++) {
+        int64_t name_length = read_word(count_arrays_file, &offset, file);
+        int64_t length = read_word(count_arrays_file, &offset, file);
+        char *name = (char *)count_arrays_file->data + offset;
+        if(name_length <= 0 || length < 0 ||
+           offset + padded_length(name_length) + padded_length(length * sizeof(uint16_t)) > count_arrays_file->length ||
+           name[name_length - 1] != '\0') {
+            st_errAbort("Count arrays file is corrupt: %s\n", file);
+        }
+        offset += padded_length(name_length);
+        if(stHash_search(seq_names_to_alignment_count_arrays, name) != NULL) {
+            st_errAbort("Count arrays file has a duplicate sequence: %s\n", name);
+        }
+        SequenceCountArray *seq_count_array = st_calloc(1, sizeof(SequenceCountArray));
+        seq_count_array->name = stString_copy(name);
+        seq_count_array->length = length;
+        seq_count_array->counts = (uint16_t *)((char *)count_arrays_file->data + offset);
+        seq_count_array->mapped = 1;
+        offset += padded_length(length * sizeof(uint16_t));
+        stHash_insert(seq_names_to_alignment_count_arrays, seq_count_array->name, seq_count_array);
+    }
+    return count_arrays_file;
+}
+
+void countArraysFile_destruct(CountArraysFile *count_arrays_file) {
+    munmap(count_arrays_file->data, count_arrays_file->length);
+    free(count_arrays_file);
+}
@@ -0,0 +1,253 @@
+#include "paf.h"
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <fcntl.h>
+#include <unistd.h>
+
+/*
+ * Functions for writing and reading binary coverage tracks.
+ *
+ * The file is a header of 64 bit words: the magic number, the format version, the number of sequences and the offset
+ * of the index. It is followed for each sequence by its runs, then the bins of each zoom level, padded to a multiple
+ * of eight bytes. The index at the end of the file gives for each sequence the length of its name, its length, its
+ * number of runs, the offset of its runs and of each of its zoom levels, then its NUL terminated name, padded to a
+ * multiple of eight bytes.
+ */
+
+const int64_t coverage_track_bin_sizes[COVERAGE_TRACK_ZOOM_LEVELS] = { 1000, 10000, 100000 };
+
+static const char coverage_track_magic[8] = { 'P', 'A', 'F', 'F', 'Y', 'T', 'R', 'K' };
+#define COVERAGE_TRACK_VERSION 1
+#define COVERAGE_TRACK_HEADER_WORDS 4
+#define COVERAGE_TRACK_INDEX_WORDS (4 + COVERAGE_TRACK_ZOOM_LEVELS)
+
+static int64_t padded_length(int64_t bytes) {
+    return (bytes + 7) / 8 * 8;
+}
+
+static void write_data(FILE *fh, void *data, int64_t bytes) {
+    static const char padding[8] = { 0 };
+    if(fwrite(data, 1, bytes, fh) != bytes ||
+       fwrite(padding, 1, padded_length(bytes) - bytes, fh) != padded_length(bytes) - bytes) {
+        st_errAbort("Failed to write coverage track\n");
+    }
+}
+
+/*
+ * The index entry of a sequence, while writing.
+ */
+typedef struct _trackIndexEntry {
+    char *name;
+    int64_t words[COVERAGE_TRACK_INDEX_WORDS]; // As in the file
+} TrackIndexEntry;
+
+struct _coverageTrackWriter {
+    FILE *fh;
+    stList *index; // The TrackIndexEntry of each sequence
+    TrackIndexEntry *entry; // That of the current sequence, or NULL
+    int64_t length, run_number; // The length of the current sequence and number of runs written
+    CoverageTrackRun run; // The pending run, merged with following runs of equal coverage
+    double *bin_sums[COVERAGE_TRACK_ZOOM_LEVELS]; // The summed coverage of the bases of each bin
+    uint32_t *bin_maxes[COVERAGE_TRACK_ZOOM_LEVELS];
+};
+
+static void track_index_entry_destruct(TrackIndexEntry *entry) {
+    free(entry->name);
+    free(entry);
+}
+
+CoverageTrackWriter *coverageTrackWriter_construct(FILE *fh) {
+    CoverageTrackWriter *writer = st_calloc(1, sizeof(CoverageTrackWriter));
+    writer->fh = fh;
+    writer->index = stList_construct3(0, (void (*)(void *))track_index_entry_destruct);
+    int64_t header[COVERAGE_TRACK_HEADER_WORDS] = { 0 }; // Rewritten once the index is written
+    memcpy(header, coverage_track_magic, sizeof(coverage_track_magic));
+    write_data(fh, header, sizeof(header));
+    return writer;
+}
+
+/*
+ * Writes the pending run, if there is one.
+ */
+static void write_pending_run(CoverageTrackWriter *writer) {
+    if(writer->run.count >= 0) {
+        write_data(writer->fh, &writer->run, sizeof(CoverageTrackRun));
+        writer->run_number++;
+    }
+}
+
+/*
+ * Writes the last run and the zoom levels of the current sequence.
+ */
+static void end_sequence(CoverageTrackWriter *writer) {
+    if(writer->entry == NULL) {
+        return;
+    }
+    if(writer->run.end != writer->length) {
+        st_errAbort("The coverage runs of %s do not cover the sequence\n", writer->entry->name);
+    }
+    write_pending_run(writer);
+    writer->entry->words[2] = writer->run_number;
+    for(int64_t i=0; i<COVERAGE_TRACK_ZOOM_LEVELS; i++) {
+        writer->entry->words[4 + i] = ftello(writer->fh);
+        int64_t bin_size = coverage_track_bin_sizes[i], bin_number = (writer->length + bin_size - 1) / bin_size;
+        CoverageTrackBin *bins = st_malloc((bin_number + 1) * sizeof(CoverageTrackBin));
+        for(int64_t j=0; j<bin_number; j++) {
+            int64_t bin_length = (j + 1) * bin_size < writer->length ? bin_size : writer->length - j * bin_size;
+            bins[j].mean = writer->bin_sums[i][j] / bin_length;
+            bins[j].max = writer->bin_maxes[i][j];
+        }
+        write_data(writer->fh, bins, bin_number * sizeof(CoverageTrackBin));
+        free(bins);
+        free(writer->bin_sums[i]);
+        free(writer->bin_maxes[i]);
+    }
+    writer->entry = NULL;
+}
+
+void coverageTrackWriter_start_sequence(CoverageTrackWriter *writer, char *name, int64_t length) {
+    end_sequence(writer);
+    writer->entry = st_calloc(1, sizeof(TrackIndexEntry));
+    writer->entry->name = stString_copy(name);
+    writer->entry->words[0] = strlen(name) + 1;
+    writer->entry->words[1] = length;
+    writer->entry->words[3] = ftello(writer->fh);
+    stList_append(writer->index, writer->entry);
+    writer->length = length;
+    writer->run_number = 0;
+    writer->run.end = 0;
+    writer->run.count = -1; // No pending run
+    for(int64_t i=0; i<COVERAGE_TRACK_ZOOM_LEVELS; i++) {
+        int64_t bin_number = (length + coverage_track_bin_sizes[i] - 1) / coverage_track_bin_sizes[i];
+        writer->bin_sums[i] = st_calloc(bin_number + 1, sizeof(double));
+        writer->bin_maxes[i] = st_calloc(bin_number + 1, sizeof(uint32_t));
+    }
+}
+
+void coverageTrackWriter_add_run(void *extra_arg, int64_t start, int64_t end, int64_t count) {
+    CoverageTrackWriter *writer = extra_arg;
+    assert(writer->entry != NULL);
+    if(start != writer->run.end || end > writer->length || count < 0) {
+        st_errAbort("Got an out of order coverage run for %s: %" PRIi64 "-%" PRIi64 "\n", writer->entry->name,
+                    start, end);
+    }
+    if(start >= end) {
+        return;
+    }
+    if(count == writer->run.count) { // Extends the pending run
+        writer->run.end = end;
+    }
+    else {
+        write_pending_run(writer);
+        writer->run.end = end;
+        writer->run.count = count;
+    }
+    for(int64_t i=0; i<COVERAGE_TRACK_ZOOM_LEVELS; i++) { // Add the run to the bins it overlaps
+        int64_t bin_size = coverage_track_bin_sizes[i];
+        for(int64_t j=start/bin_size; j*bin_size < end; j++) {
+            int64_t overlap = ((j + 1) * bin_size < end ? (j + 1) * bin_size : end) -
+                              (j * bin_size > start ? j * bin_size : start);
+            writer->bin_sums[i][j] += (double)count * overlap;
+            if(count > writer->bin_maxes[i][j]) {
+                writer->bin_maxes[i][j] = count > UINT32_MAX ? UINT32_MAX : count;
+            }
+        }
+    }
+}
+
+void coverageTrackWriter_destruct(CoverageTrackWriter *writer) {
+    end_sequence(writer);
+    int64_t index_offset = ftello(writer->fh);
+    for(int64_t i=0; i<stList_length(writer->index); i++) {
+        TrackIndexEntry *entry = stList_get(writer->index, i);
+        write_data(writer->fh, entry->words, sizeof(entry->words));
+        write_data(writer->fh, entry->name, entry->words[0]);
+    }
+    int64_t header[COVERAGE_TRACK_HEADER_WORDS] = { 0, COVERAGE_TRACK_VERSION, stList_length(writer->index),
+                                                    index_offset };
+    memcpy(header, coverage_track_magic, sizeof(coverage_track_magic));
+    if(fseeko(writer->fh, 0, SEEK_SET) != 0) {
+        st_errAbort("Coverage tracks must be written to a seekable file\n");
+    }
+    write_data(writer->fh, header, sizeof(header));
+    fseeko(writer->fh, 0, SEEK_END);
+    stList_destruct(writer->index);
+    free(writer);
+}
+
+CoverageTrack *coverageTrack_open(char *file) {
+    int fd = open(file, O_RDONLY);
+    struct stat file_stat;
+    if(fd == -1 || fstat(fd, &file_stat) != 0) {
+        st_errAbort("Could not open coverage track: %s\n", file);
+    }
+    CoverageTrack *track = st_calloc(1, sizeof(CoverageTrack));
+    track->length = file_stat.st_size;
+    if(track->length < COVERAGE_TRACK_HEADER_WORDS * (int64_t)sizeof(int64_t) ||
+       (track->data = mmap(NULL, track->length, PROT_READ, MAP_PRIVATE, fd, 0)) == MAP_FAILED ||
+       memcmp(track->data, coverage_track_magic, sizeof(coverage_track_magic)) != 0) {
+        st_errAbort("Not a coverage track: %s\n", file);
+    }
+    close(fd); // The mapping remains valid
+
+    int64_t *header = track->data;
+    if(header[1] != COVERAGE_TRACK_VERSION) {
+        st_errAbort("Unsupported coverage track version: %s\n", file);
+    }
+    track->sequences = stList_construct3(0, free);
+    track->seq_names_to_sequences = stHash_construct3(stHash_stringKey, stHash_stringEqualKey, NULL, NULL);
+    int64_t offset = header[3];
+    for(int64_t i=0; i<header[2]; i++) {
+        if(offset < 0 || offset + COVERAGE_TRACK_INDEX_WORDS * (int64_t)sizeof(int64_t) > track->length) {
+            st_errAbort("Coverage track is corrupt: %s\n", file);
+        }
+        int64_t *words = (int64_t *)((char *)track->data + offset);
+        offset += COVERAGE_TRACK_INDEX_WORDS * sizeof(int64_t);
+        CoverageTrackSequence *sequence = st_calloc(1, sizeof(CoverageTrackSequence));
+        sequence->name = (char *)track->data + offset;
+        sequence->length = words[1];
+        sequence->run_number = words[2];
+        sequence->runs = (CoverageTrackRun *)((char *)track->data + words[3]);
+        if(words[0] <= 0 || offset + words[0] > track->length || sequence->name[words[0] - 1] != '\0' ||
+           words[3] < 0 || words[3] + sequence->run_number * (int64_t)sizeof(CoverageTrackRun) > track->length) {
+            st_errAbort("Coverage track is corrupt: %s\n", file);
+        }
+        offset += padded_length(words[0]);
+        for(int64_t j=0; j<COVERAGE_TRACK_ZOOM_LEVELS; j++) {
+            int64_t bin_number = (sequence->length + coverage_track_bin_sizes[j] - 1) / coverage_track_bin_sizes[j];
+            if(words[4 + j] < 0 || words[4 + j] + bin_number * (int64_t)sizeof(CoverageTrackBin) > track->length) {
+                st_errAbort("Coverage track is corrupt: %s\n", file);
+            }
+            sequence->zoom_levels[j] = (CoverageTrackBin *)((char *)track->data + words[4 + j]);
+        }
+        stList_append(track->sequences, sequence);
+        stHash_insert(track->seq_names_to_sequences, sequence->name, sequence);
+    }
+    return track;
+}
+
+void coverageTrack_destruct(CoverageTrack *track) {
+    stHash_destruct(track->seq_names_to_sequences);
+    stList_destruct(track->sequences);
+    munmap(track->data, track->length);
+    free(track);
+}
+
+CoverageTrackSequence *coverageTrack_get_sequence(CoverageTrack *track, char *name) {
+    return stHash_search(track->seq_names_to_sequences, name);
+}
+
+int64_t coverageTrackSequence_get_run_index(CoverageTrackSequence *sequence, int64_t position) {
+    assert(position >= 0 && position < sequence->length);
+    int64_t i = 0, j = sequence->run_number - 1; // The run is in [i, j]
+    while(i < j) {
+        int64_t k = (i + j) / 2;
+        if(sequence->runs[k].end > position) {
+            j = k;
+        }
+        else {
+            i = k + 1;
+        }
+    }
+    return i;
+}
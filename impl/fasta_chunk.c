@@ -12,14 +12,16 @@
 #include <getopt.h>
 #include <time.h>
 #include <ctype.h>
+#include <sys/stat.h>
 #include "bioioC.h"
 #include "commonC.h"
 #include "sonLib.h"
+#include "paf.h"
 
 static FILE *chunkFileHandle = NULL;
 static const char *chunksDir = "./temp_fastas";
-static int64_t chunkSize = 10000000;
-static int64_t chunkOverlapSize = 100000;
+static int64_t chunkSize = DEFAULT_CHUNK_SIZE;
+static int64_t chunkOverlapSize = DEFAULT_CHUNK_OVERLAP;
 static int64_t chunkNo = 0;
 static int64_t chunkRemaining; // must be initialized
 static char *tempChunkFile = NULL;
@@ -69,38 +71,228 @@ static void updateChunkRemaining(int64_t seqLength) {
     }
 }
 
+static const bool valid_base[256] = { ['a'] = 1, ['c'] = 1, ['g'] = 1, ['t'] = 1, ['n'] = 1,
+                                      ['A'] = 1, ['C'] = 1, ['G'] = 1, ['T'] = 1, ['N'] = 1 };
+
+/*
+ * Returns non-zero if every character is one of a, c, g, t or n, in either case.
+ */
+static bool validBases(const char *bases, int64_t length) {
+    int64_t i = 0;
+#ifdef PAF_USE_AVX2
+    // The low nibbles of a, c, g, t and n are distinct, so a character is valid if, lower cased, it is the entry of a
+    // table of them indexed by its low nibble, which is looked up thirty two characters at a time with a shuffle
+    const __m256i table = _mm256_setr_epi8(0, 'a', 0, 'c', 't', 0, 0, 'g', 0, 0, 0, 0, 0, 0, 'n', 0,
+                                           0, 'a', 0, 'c', 't', 0, 0, 'g', 0, 0, 0, 0, 0, 0, 'n', 0);
+    const __m256i low_nibble = _mm256_set1_epi8(0x0f), lower_case = _mm256_set1_epi8(0x20);
+    for(; i + 32 <= length; i += 32) {
+        __m256i v = _mm256_loadu_si256((__m256i *)(bases + i));
+        __m256i expected = _mm256_shuffle_epi8(table, _mm256_and_si256(v, low_nibble));
+        if(_mm256_movemask_epi8(_mm256_cmpeq_epi8(_mm256_or_si256(v, lower_case), expected)) != -1) {
+            return 0;
+        }
+    }
+#endif
+    bool valid = 1;
+    for(; i < length; i++) {
+        valid &= valid_base[(unsigned char)bases[i]];
+    }
+    return valid;
+}
+
+/*
+ * Writes a chunk, which must be NUL terminated, of the given sequence, starting at the given coordinate.
+ */
+static void writeChunk(const char *fastaHeader, int64_t sequenceLength, int64_t start, char *chunk, int64_t chunkLength) {
+    // be ready to print more sequence
+    startChunkingSequences();
+
+    // print the header to a buffer
+    char *header = stString_print("%s|%" PRIi64 "|%" PRIi64, fastaHeader, sequenceLength, start);
+
+    // print the sequence to the file
+    fastaWrite(chunk, header, chunkFileHandle);
+    free(header);
+
+    // update the remaining chunk
+    updateChunkRemaining(chunkLength);
+}
+
+/*
+ * Chunks a sequence held in memory, used for files that can not be scanned for their sequence lengths in advance.
+ */
 static void processSequenceToChunk(void* dest, const char *fastaHeader, const char *sequence, int64_t sequenceLength) {
+    if(!validBases(sequence, sequenceLength)) {
+        st_errAbort("Sequence %s has characters other than a, c, g, t or n\n", fastaHeader);
+    }
     // For each chunk of these sequence
-    assert(chunkSize > chunkOverlapSize);
     for (int64_t i = 0; i < sequenceLength; i += chunkSize) {
-        // be ready to print more sequence
-        startChunkingSequences();
-
-        // print the header to a buffer
-        char *header = st_calloc(strlen(fastaHeader) + 2048, sizeof(char));
-        sprintf(header, "%s|%" PRIi64 "|%" PRIi64, fastaHeader, sequenceLength, i);
-
         // Get end of chunk, including the extra overlap
         int64_t j = (i + chunkSize + chunkOverlapSize) <= sequenceLength ? (i + chunkSize + chunkOverlapSize) : sequenceLength;
-
-        // Get chunk sequence
         char *seq_chunk = stString_getSubString(sequence, i, j-i);
-        assert(strlen(seq_chunk) == j - i);
+        writeChunk(fastaHeader, sequenceLength, i, seq_chunk, j - i);
+        free(seq_chunk); // cleanup the fragment
+    }
+}
 
-        // sanity check
-        for (int64_t k = 0; k < j-i; ++k) {
-            char c = tolower(seq_chunk[k]);
-            assert(c == 'a' || c == 'c' || c == 'g' || c == 't' || c == 'n');
+/*
+ * The sequence being streamed into chunks. The buffer holds the bases of the current chunk, at most
+ * chunkSize + chunkOverlapSize of them. Once full the chunk is written and the overlap moved to the start of the
+ * buffer to begin the next chunk, so the memory used does not depend on the length of the sequence.
+ */
+typedef struct _sequenceChunker {
+    char *header;
+    int64_t length; // The length of the sequence, found before it is streamed, as it is part of the chunk headers
+    int64_t start; // The coordinate of the first base in the buffer
+    char *buffer;
+    int64_t bufferLength;
+} SequenceChunker;
+
+static void addBases(SequenceChunker *chunker, const char *bases, int64_t length) {
+    int64_t capacity = chunkSize + chunkOverlapSize;
+    while(length > 0) {
+        int64_t i = capacity - chunker->bufferLength < length ? capacity - chunker->bufferLength : length;
+        memcpy(chunker->buffer + chunker->bufferLength, bases, i);
+        chunker->bufferLength += i;
+        bases += i;
+        length -= i;
+        if(chunker->bufferLength == capacity) { // Write the chunk and start the next with the overlap
+            if(chunker->start + capacity > chunker->length) {
+                st_errAbort("Sequence %s is longer than expected\n", chunker->header);
+            }
+            chunker->buffer[capacity] = '\0';
+            writeChunk(chunker->header, chunker->length, chunker->start, chunker->buffer, capacity);
+            memmove(chunker->buffer, chunker->buffer + chunkSize, chunkOverlapSize);
+            chunker->bufferLength = chunkOverlapSize;
+            chunker->start += chunkSize;
         }
+    }
+}
 
-        // print the sequence to the file
-        fastaWrite(seq_chunk, header, chunkFileHandle);
-        free(seq_chunk); // cleanup the fragment
-        free(header);
+/*
+ * Writes the remaining chunks of the sequence. As each chunk starts chunkSize after the last until the end of the
+ * sequence, the buffer may hold the start of one more chunk, which may be entirely overlap.
+ */
+static void finishSequence(SequenceChunker *chunker) {
+    if(chunker->header == NULL) {
+        return;
+    }
+    if(chunker->start + chunker->bufferLength != chunker->length) {
+        st_errAbort("Sequence %s does not have the expected length: %" PRIi64 "\n", chunker->header, chunker->length);
+    }
+    while(chunker->bufferLength > 0) {
+        chunker->buffer[chunker->bufferLength] = '\0';
+        writeChunk(chunker->header, chunker->length, chunker->start, chunker->buffer, chunker->bufferLength);
+        if(chunker->bufferLength <= chunkSize) { // The next chunk would start beyond the end of the sequence
+            break;
+        }
+        memmove(chunker->buffer, chunker->buffer + chunkSize, chunker->bufferLength - chunkSize);
+        chunker->bufferLength -= chunkSize;
+        chunker->start += chunkSize;
+    }
+    free(chunker->header);
+    chunker->header = NULL;
+}
+
+static void addSequenceLength(void *sequenceLengths, const char *fastaHeader, int64_t length) {
+    stList_append(sequenceLengths, stIntTuple_construct1(length));
+}
+
+/*
+ * Adds the bases of part of a sequence line, skipping whitespace, as fastaReadToFunction does, and checking the other
+ * characters.
+ */
+static void addLineBases(SequenceChunker *chunker, const char *bases, int64_t length) {
+    if(validBases(bases, length)) { // The usual case of only bases
+        addBases(chunker, bases, length);
+        return;
+    }
+    for(int64_t i=0; i<length; i++) {
+        if(!isspace((unsigned char)bases[i])) {
+            if(!validBases(bases + i, 1)) {
+                st_errAbort("Sequence %s has a character other than a, c, g, t or n: %c\n", chunker->header, bases[i]);
+            }
+            addBases(chunker, bases + i, 1);
+        }
+    }
+}
 
-        // update the remaining chunk
-        updateChunkRemaining(j - i);
+/*
+ * Finishes the previous sequence and starts the next, whose header has been read.
+ */
+static void startSequence(SequenceChunker *chunker, const char *header, stList *sequenceLengths, int64_t *sequenceNo,
+                          const char *seq_file) {
+    finishSequence(chunker);
+    if(*sequenceNo == stList_length(sequenceLengths)) {
+        st_errAbort("Fasta file has more sequences than expected: %s\n", seq_file);
     }
+    chunker->header = stString_copy(header);
+    chunker->length = stIntTuple_get(stList_get(sequenceLengths, (*sequenceNo)++), 0);
+    chunker->start = 0;
+    chunker->bufferLength = 0;
+}
+
+#define CHUNK_READ_BYTES (INT64_C(1) << 20) // The file is read in blocks of this many bytes, so lines of any length,
+// such as those of unwrapped fasta files, do not need to be held in memory
+
+/*
+ * Chunks the sequences of a fasta file without holding any of them in memory. The lengths of the sequences, needed
+ * for the chunk headers, are first scanned with fasta_read_lengths, then the file is read in fixed size blocks,
+ * split into lines, the bases of each sequence line checked and added to the current chunk. The memory used is that
+ * of the chunk buffer, one block and the longest header.
+ */
+static void chunkSequenceFile(char *seq_file) {
+    stList *sequenceLengths = stList_construct3(0, (void (*)(void *))stIntTuple_destruct);
+    fasta_read_lengths(seq_file, 1, sequenceLengths, addSequenceLength); // Only the lengths are used, so any index
+    // can be used
+    FILE *fh = fopen(seq_file, "r");
+    SequenceChunker chunker = { 0 };
+    chunker.buffer = st_malloc(chunkSize + chunkOverlapSize + 1);
+    char *block = st_malloc(CHUNK_READ_BYTES);
+    int64_t headerLength = 0, headerCapacity = 64;
+    char *header = st_malloc(headerCapacity); // The header line being read
+    bool lineStart = 1, inHeader = 0;
+    int64_t sequenceNo = 0, blockLength;
+    while((blockLength = fread(block, 1, CHUNK_READ_BYTES, fh)) > 0) {
+        for(int64_t i=0; i<blockLength;) {
+            if(lineStart && !inHeader && block[i] == '>') { // Start a new header
+                inHeader = 1;
+                headerLength = 0;
+                i++;
+            }
+            const char *newline = memchr(block + i, '\n', blockLength - i);
+            int64_t j = newline == NULL ? blockLength : newline - block; // The end of the line within the block
+            if(inHeader) { // The header is kept whole, as fastaReadToFunction does
+                if(headerLength + (j - i) + 1 > headerCapacity) {
+                    headerCapacity = 2 * (headerLength + (j - i) + 1);
+                    header = realloc(header, headerCapacity);
+                }
+                memcpy(header + headerLength, block + i, j - i);
+                headerLength += j - i;
+                header[headerLength] = '\0';
+                if(newline != NULL) { // The header is complete, so start the sequence
+                    startSequence(&chunker, header, sequenceLengths, &sequenceNo, seq_file);
+                    inHeader = 0;
+                }
+            }
+            else if(chunker.header != NULL) {
+                int64_t k = j > i && block[j-1] == '\r' ? j - 1 : j; // Drop the \r of a \r\n line end, which
+                // would otherwise take the slow path of addLineBases to be skipped
+                addLineBases(&chunker, block + i, k - i);
+            }
+            lineStart = newline != NULL;
+            i = j + 1;
+        }
+    }
+    if(inHeader) { // A header on the last line, without a newline, starts an empty sequence
+        startSequence(&chunker, header, sequenceLengths, &sequenceNo, seq_file);
+    }
+    finishSequence(&chunker);
+    free(header);
+    free(block);
+    free(chunker.buffer);
+    fclose(fh);
+    stList_destruct(sequenceLengths);
 }
 
 int faffy_chunk_main(int argc, char *argv[]) {
@@ -159,6 +351,9 @@ int faffy_chunk_main(int argc, char *argv[]) {
     st_logInfo("Chunks output directory : %s\n", chunksDir);
     st_logInfo("Chunk size : %" PRIi64 "\n", chunkSize);
     st_logInfo("Chunk overlap size : %" PRIi64 "\n", chunkOverlapSize);
+    if(chunkSize <= chunkOverlapSize || chunkOverlapSize < 0) {
+        st_errAbort("The chunk size must be greater than the overlap, which must not be negative\n");
+    }
 
     //////////////////////////////////////////////
     // Make the output directory
@@ -189,9 +384,18 @@ int faffy_chunk_main(int argc, char *argv[]) {
     while(optind < argc) {
         char *seq_file = argv[optind++];
         st_logInfo("Chunking sequence file : %s\n", seq_file);
-        FILE *fileHandle2 = fopen(seq_file, "r");
-        fastaReadToFunction(fileHandle2, NULL, processSequenceToChunk);
-        fclose(fileHandle2);
+        struct stat fileStat;
+        if(stat(seq_file, &fileStat) != 0) {
+            st_errAbort("Could not open sequence file: %s\n", seq_file);
+        }
+        if(S_ISREG(fileStat.st_mode)) { // Can be read twice, first for the sequence lengths
+            chunkSequenceFile(seq_file);
+        }
+        else { // Such as a pipe, so read each sequence into memory
+            FILE *fileHandle2 = fopen(seq_file, "r");
+            fastaReadToFunction(fileHandle2, NULL, processSequenceToChunk);
+            fclose(fileHandle2);
+        }
     }
     finishChunkingSequences();
 
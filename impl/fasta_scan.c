@@ -0,0 +1,145 @@
+#include "paf.h"
+#include "bioioC.h"
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <fcntl.h>
+#include <unistd.h>
+
+/*
+ * Functions for reading the headers and sequence lengths of the records of a fasta file without reading the sequences
+ * into memory.
+ */
+
+typedef struct _lengthFunction {
+    void *extra_arg;
+    void (*fn)(void *extra_arg, const char *header, int64_t length);
+} LengthFunction;
+
+static void call_length_function(void *length_function, const char *header, const char *sequence, int64_t length) {
+    LengthFunction *f = length_function;
+    f->fn(f->extra_arg, header, length);
+}
+
+/*
+ * Reads the lengths from a samtools faidx index, a line for each record of its name, length, offset, bases per line
+ * and bytes per line, tab separated. Returns false if the index is missing or older than the fasta file.
+ */
+static bool read_fai_lengths(char *fasta_file, struct stat *fasta_stat, void *extra_arg,
+                             void (*fn)(void *extra_arg, const char *header, int64_t length)) {
+    char *fai_file = stString_print("%s.fai", fasta_file);
+    struct stat fai_stat;
+    FILE *fh = stat(fai_file, &fai_stat) == 0 && fai_stat.st_mtime >= fasta_stat->st_mtime ? fopen(fai_file, "r") : NULL;
+    if(fh == NULL) {
+        free(fai_file);
+        return 0;
+    }
+    st_logDebug("Reading sequence lengths from index: %s\n", fai_file);
+    char *line;
+    while((line = stFile_getLineFromFile(fh)) != NULL) {
+        char *tab = strchr(line, '\t');
+        int64_t length;
+        if(tab == NULL || sscanf(tab + 1, "%" SCNd64, &length) != 1 || length < 0) {
+            st_errAbort("Got an invalid line in fasta index %s: %s\n", fai_file, line);
+        }
+        *tab = '\0';
+        fn(extra_arg, line, length);
+        free(line);
+    }
+    fclose(fh);
+    free(fai_file);
+    return 1;
+}
+
+/*
+ * Counts the sequence characters of a line, skipping whitespace as fastaReadToFunction does. The loop has no
+ * branches so is vectorized by the compiler.
+ */
+static int64_t count_sequence_characters(const unsigned char *s, int64_t length) {
+    int64_t n = 0;
+    for(int64_t i=0; i<length; i++) {
+        n += s[i] > ' ';
+    }
+    return n;
+}
+
+#define SCAN_RELEASE_BYTES (INT64_C(16) << 20) // The scanned pages of the mapping are released in windows of this
+// many bytes, a multiple of the page size, so the memory used does not grow with the size of the file
+
+/*
+ * Scans the lines of the memory mapped file, finding each with memchr, so only the bytes of the sequence lines are
+ * touched, and only to count them. Sequence lines are scanned in windows of at most SCAN_RELEASE_BYTES, so the pages
+ * of even a single line sequence are released as it is scanned.
+ */
+static void scan_fasta_lengths(char *data, int64_t size, void *extra_arg,
+                               void (*fn)(void *extra_arg, const char *header, int64_t length)) {
+    char *header = NULL;
+    int64_t length = 0, released = 0;
+    bool line_start = 1;
+    for(const char *line = data, *end = data + size; line < end;) {
+        while(line - data - released >= SCAN_RELEASE_BYTES) {
+            madvise(data + released, SCAN_RELEASE_BYTES, MADV_DONTNEED);
+            released += SCAN_RELEASE_BYTES;
+        }
+        const char *newline, *line_end;
+        if(line_start && *line == '>') {
+            if(header != NULL) {
+                fn(extra_arg, header, length);
+                free(header);
+            }
+            newline = memchr(line, '\n', end - line);
+            line_end = newline == NULL ? end : newline;
+            int64_t header_length = line_end - line - 1;
+            if(header_length > 0 && line[header_length] == '\r') {
+                header_length--;
+            }
+            header = st_malloc(header_length + 1);
+            memcpy(header, line + 1, header_length);
+            header[header_length] = '\0';
+            length = 0;
+        }
+        else {
+            const char *limit = end - line > SCAN_RELEASE_BYTES ? line + SCAN_RELEASE_BYTES : end;
+            newline = memchr(line, '\n', limit - line);
+            line_end = newline == NULL ? limit : newline;
+            length += count_sequence_characters((const unsigned char *)line, line_end - line);
+        }
+        line_start = newline != NULL;
+        line = newline == NULL ? line_end : line_end + 1;
+    }
+    if(header != NULL) {
+        fn(extra_arg, header, length);
+        free(header);
+    }
+}
+
+void fasta_read_lengths(char *fasta_file, bool use_index, void *extra_arg,
+                        void (*fn)(void *extra_arg, const char *header, int64_t length)) {
+    int fd = open(fasta_file, O_RDONLY);
+    struct stat fasta_stat;
+    if(fd == -1 || fstat(fd, &fasta_stat) != 0) {
+        st_errAbort("Could not open fasta file: %s\n", fasta_file);
+    }
+    if(S_ISREG(fasta_stat.st_mode)) {
+        if(use_index && read_fai_lengths(fasta_file, &fasta_stat, extra_arg, fn)) {
+            close(fd);
+            return;
+        }
+        if(fasta_stat.st_size == 0) { // Nothing to map
+            close(fd);
+            return;
+        }
+        void *data = mmap(NULL, fasta_stat.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+        if(data != MAP_FAILED) {
+            close(fd); // The mapping remains valid
+            madvise(data, fasta_stat.st_size, MADV_SEQUENTIAL);
+            scan_fasta_lengths(data, fasta_stat.st_size, extra_arg, fn);
+            munmap(data, fasta_stat.st_size);
+            return;
+        }
+    }
+    // Not a regular file, e.g. a pipe, so fall back to reading the sequences
+    FILE *fh = fdopen(fd, "r");
+    LengthFunction f = { extra_arg, fn };
+    fastaReadToFunction(fh, &f, call_length_function);
+    fclose(fh);
+}
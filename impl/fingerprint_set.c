@@ -0,0 +1,127 @@
+#include "paf.h"
+
+/*
+ * Functions for fingerprinting alignments and holding the fingerprints in an open addressing hash table with linear
+ * probing, used to find duplicate alignments.
+ */
+
+FingerprintSet *fingerprintSet_construct(void) {
+    FingerprintSet *fingerprint_set = st_calloc(1, sizeof(FingerprintSet));
+    fingerprint_set->capacity = 1024;
+    fingerprint_set->slots = st_calloc(fingerprint_set->capacity, sizeof(PafFingerprint));
+    fingerprint_set->names_to_ids = stHash_construct3(stHash_stringKey, stHash_stringEqualKey, free, NULL);
+    return fingerprint_set;
+}
+
+void fingerprintSet_destruct(FingerprintSet *fingerprint_set) {
+    free(fingerprint_set->slots);
+    stHash_destruct(fingerprint_set->names_to_ids);
+    free(fingerprint_set);
+}
+
+static uint64_t get_name_id(FingerprintSet *fingerprint_set, char *name) {
+    void *id = stHash_search(fingerprint_set->names_to_ids, name);
+    if(id == NULL) { // Ids are stored plus one, so they are never NULL
+        id = (void *)(uintptr_t)(stHash_size(fingerprint_set->names_to_ids) + 1);
+        stHash_insert(fingerprint_set->names_to_ids, stString_copy(name), id);
+    }
+    return (uintptr_t)id - 1;
+}
+
+/*
+ * The splitmix64 finalizer, see <https://stackoverflow.com/a/12996028>.
+ */
+static uint64_t mix(uint64_t key) {
+    key = (key ^ (key >> 30)) * UINT64_C(0xbf58476d1ce4e5b9);
+    key = (key ^ (key >> 27)) * UINT64_C(0x94d049bb133111eb);
+    return key ^ (key >> 31);
+}
+
+/*
+ * Hashes the words of a paf: its query name, start and end, its target name, start and end and its strand, where the
+ * names are represented by numbers.
+ */
+static PafFingerprint get_fingerprint(uint64_t *words, bool canonical) {
+    // The inverse swaps the query and target, so order the two sequences to get the same words for both
+    if(canonical && (words[3] < words[0] || (words[3] == words[0] && (words[4] < words[1] ||
+                                             (words[4] == words[1] && words[5] < words[2]))))) {
+        for(int64_t i=0; i<3; i++) {
+            uint64_t j = words[i];
+            words[i] = words[i + 3];
+            words[i + 3] = j;
+        }
+    }
+    // Two independently seeded hashes of the words
+    PafFingerprint fingerprint = { UINT64_C(0x9e3779b97f4a7c15), UINT64_C(0x632be59bd9b4e019) };
+    for(int64_t i=0; i<7; i++) {
+        fingerprint.hi = mix(fingerprint.hi ^ words[i]) + UINT64_C(0x9e3779b97f4a7c15);
+        fingerprint.lo = mix(fingerprint.lo + words[i] * UINT64_C(0xff51afd7ed558ccd));
+    }
+    if(fingerprint.hi == 0 && fingerprint.lo == 0) { // Reserved for empty slots
+        fingerprint.lo = 1;
+    }
+    return fingerprint;
+}
+
+PafFingerprint fingerprintSet_get_fingerprint(FingerprintSet *fingerprint_set, Paf *paf, bool canonical) {
+    uint64_t words[7] = { get_name_id(fingerprint_set, paf->query_name), paf->query_start, paf->query_end,
+                          get_name_id(fingerprint_set, paf->target_name), paf->target_start, paf->target_end,
+                          paf->same_strand };
+    return get_fingerprint(words, canonical);
+}
+
+/*
+ * The FNV-1a hash of a string, mixed, see <https://en.wikipedia.org/wiki/Fowler%E2%80%93Noll%E2%80%93Vo_hash_function>.
+ */
+static uint64_t get_name_hash(char *name) {
+    uint64_t hash = UINT64_C(0xcbf29ce484222325);
+    for(unsigned char *c = (unsigned char *)name; *c != '\0'; c++) {
+        hash = (hash ^ *c) * UINT64_C(0x100000001b3);
+    }
+    return mix(hash);
+}
+
+PafFingerprint paf_get_fingerprint(Paf *paf, bool canonical) {
+    uint64_t words[7] = { get_name_hash(paf->query_name), paf->query_start, paf->query_end,
+                          get_name_hash(paf->target_name), paf->target_start, paf->target_end, paf->same_strand };
+    return get_fingerprint(words, canonical);
+}
+
+/*
+ * Gets the slot holding the fingerprint, or the empty slot where it would be inserted.
+ */
+static PafFingerprint *get_slot(FingerprintSet *fingerprint_set, PafFingerprint fingerprint) {
+    uint64_t mask = fingerprint_set->capacity - 1;
+    for(uint64_t i=fingerprint.lo & mask;; i = (i + 1) & mask) {
+        PafFingerprint *slot = &fingerprint_set->slots[i];
+        if((slot->hi == fingerprint.hi && slot->lo == fingerprint.lo) || (slot->hi == 0 && slot->lo == 0)) {
+            return slot;
+        }
+    }
+}
+
+bool fingerprintSet_contains(FingerprintSet *fingerprint_set, PafFingerprint fingerprint) {
+    PafFingerprint *slot = get_slot(fingerprint_set, fingerprint);
+    return slot->hi != 0 || slot->lo != 0;
+}
+
+bool fingerprintSet_add(FingerprintSet *fingerprint_set, PafFingerprint fingerprint) {
+    PafFingerprint *slot = get_slot(fingerprint_set, fingerprint);
+    if(slot->hi != 0 || slot->lo != 0) { // Already present
+        return 0;
+    }
+    *slot = fingerprint;
+    if(++fingerprint_set->size * 4 > fingerprint_set->capacity * 3) { // Keep the load below three quarters
+        PafFingerprint *slots = fingerprint_set->slots;
+        int64_t capacity = fingerprint_set->capacity;
+        fingerprint_set->capacity *= 2;
+        fingerprint_set->slots = st_calloc(fingerprint_set->capacity, sizeof(PafFingerprint));
+        for(int64_t i=0; i<capacity; i++) {
+            if(slots[i].hi != 0 || slots[i].lo != 0) {
+                *get_slot(fingerprint_set, slots[i]) = slots[i];
+            }
+        }
+        free(slots);
+    }
+    return 1;
+}
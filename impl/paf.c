@@ -134,7 +134,7 @@ static void cigar_reverse(Cigar *c) {
     }
 }
 
-Paf *paf_parse(char *paf_string, bool parse_cigar_string) {
+static Paf *paf_parse2(char *paf_string, bool parse_cigar_string, bool skip_cigar) {
     Paf *paf = st_calloc(1, sizeof(Paf));
 
     char *saveptr;
@@ -191,6 +191,9 @@ Paf *paf_parse(char *paf_string, bool parse_cigar_string) {
         } else if(tag0 == 'A' && tag1 == 'S') {
             paf->score = str_to_int64(value);
         } else if(tag0 == 'c' && tag1 == 'g') {
+            if(skip_cigar) {
+                continue;
+            }
             if(parse_cigar_string) {
                 paf->cigar = cigar_parse(value);
             } else {
@@ -208,6 +211,31 @@ Paf *paf_parse(char *paf_string, bool parse_cigar_string) {
     return paf;
 }
 
+Paf *paf_parse(char *paf_string, bool parse_cigar_string) {
+    return paf_parse2(paf_string, parse_cigar_string, 0);
+}
+
+static char *intern_name(stHash *names, char *name) {
+    char *interned_name = stHash_search(names, name);
+    if(interned_name == NULL) {
+        stHash_insert(names, name, name);
+        return name;
+    }
+    free(name);
+    return interned_name;
+}
+
+Paf *paf_read_key_with_buffer(FILE *fh, stHash *names, char **paf_buffer, int64_t *paf_length_buffer) {
+    int64_t i = stFile_getLineFromFileWithBufferUnlocked(paf_buffer, paf_length_buffer, fh);
+    if (i == -1 && strlen(*paf_buffer) == 0) {
+        return NULL;
+    }
+    Paf *paf = paf_parse2(*paf_buffer, 0, 1);
+    paf->query_name = intern_name(names, paf->query_name);
+    paf->target_name = intern_name(names, paf->target_name);
+    return paf;
+}
+
 Paf *paf_read_with_buffer(FILE *fh, bool parse_cigar_string, char **paf_buffer, int64_t *paf_length_buffer) {
     int64_t i = stFile_getLineFromFileWithBufferUnlocked(paf_buffer, paf_length_buffer, fh);
     if (i == -1 && strlen(*paf_buffer) == 0) {
@@ -489,6 +517,64 @@ void paf_invert(Paf *paf) {
     }
 }
 
+InvertedPafs *inverted_pafs_construct(stList *pafs) {
+    InvertedPafs *inverted_pafs = st_malloc(sizeof(InvertedPafs));
+    inverted_pafs->length = stList_length(pafs);
+    inverted_pafs->pafs = st_malloc((inverted_pafs->length + 1) * sizeof(Paf *));
+    inverted_pafs->inverted_pafs = st_calloc(inverted_pafs->length + 1, sizeof(Paf));
+    for(int64_t i=0; i<inverted_pafs->length; i++) {
+        Paf *paf = stList_get(pafs, i), *inverted_paf = &inverted_pafs->inverted_pafs[i];
+        inverted_pafs->pafs[i] = paf;
+        *inverted_paf = *paf; // Shallow copy, so the names are shared
+        inverted_paf->cigar = NULL;
+        inverted_paf->cigar_string = NULL;
+        paf_invert(inverted_paf);
+    }
+    return inverted_pafs;
+}
+
+void inverted_pafs_destruct(InvertedPafs *inverted_pafs) {
+    free(inverted_pafs->pafs);
+    free(inverted_pafs->inverted_pafs);
+    free(inverted_pafs);
+}
+
+Paf *inverted_pafs_get_original(InvertedPafs *inverted_pafs, Paf *paf) {
+    if(paf < inverted_pafs->inverted_pafs || paf >= inverted_pafs->inverted_pafs + inverted_pafs->length) {
+        return NULL;
+    }
+    return inverted_pafs->pafs[paf - inverted_pafs->inverted_pafs];
+}
+
+Cigar *inverted_pafs_get_cigar(InvertedPafs *inverted_pafs, Paf *inverted_paf) {
+    Paf *paf = inverted_pafs_get_original(inverted_pafs, inverted_paf);
+    assert(paf != NULL);
+    Paf p = *paf; // Invert a shallow copy with its own cigar
+    if(paf->cigar != NULL) {
+        p.cigar = st_malloc(sizeof(Cigar));
+        *p.cigar = *paf->cigar;
+        p.cigar->recs = st_malloc(paf->cigar->capacity * sizeof(CigarRecord));
+        memcpy(p.cigar->recs, paf->cigar->recs, paf->cigar->capacity * sizeof(CigarRecord));
+    }
+    else {
+        p.cigar = paf->cigar_string != NULL ? cigar_parse(paf->cigar_string) : NULL;
+    }
+    paf_invert(&p);
+    return p.cigar;
+}
+
+void inverted_pafs_write_with_buffer(InvertedPafs *inverted_pafs, Paf *paf, FILE *fh, char **paf_buffer,
+                                     int64_t *paf_length_buffer) {
+    if(inverted_pafs_get_original(inverted_pafs, paf) == NULL) {
+        paf_write_with_buffer(paf, fh, paf_buffer, paf_length_buffer);
+        return;
+    }
+    Paf p = *paf;
+    p.cigar = inverted_pafs_get_cigar(inverted_pafs, paf);
+    paf_write_with_buffer(&p, fh, paf_buffer, paf_length_buffer);
+    cigar_destruct(p.cigar);
+}
+
 stList *read_pafs(FILE *fh, bool parse_cigar_string) {
     stList *pafs = stList_construct3(0, (void (*)(void *))paf_destruct);
     Paf *paf;
@@ -597,6 +683,77 @@ void paf_trim_end_fraction(Paf *p, float percentage) {
     paf_trim_ends(p, end_bases_to_trim);
 }
 
+static bool is_match_op(CigarRecord *r) {
+    return r->op == match || r->op == sequence_match || r->op == sequence_mismatch;
+}
+
+bool paf_clip(Paf *paf, int64_t query_start, int64_t query_end, int64_t target_start, int64_t target_end) {
+    if(paf->query_start >= query_start && paf->query_end <= query_end &&
+       paf->target_start >= target_start && paf->target_end <= target_end) { // Nothing to clip
+        return 1;
+    }
+    Cigar *c = paf->cigar;
+    if(c == NULL) {
+        return 0;
+    }
+    // The query coordinates at the front and back of the alignment, the query is reversed on the opposite strand
+    int64_t *query_front = paf->same_strand ? &paf->query_start : &paf->query_end;
+    int64_t *query_back = paf->same_strand ? &paf->query_end : &paf->query_start;
+    int q_sign = paf->same_strand ? 1 : -1;
+    // Clip the front, removing leading gaps so the alignment starts with a match
+    while(c->length > 0) {
+        CigarRecord *r = cigar_get(c, 0);
+        int64_t query_excess = paf->same_strand ? query_start - *query_front : *query_front - query_end;
+        int64_t target_excess = target_start - paf->target_start;
+        int64_t i = query_excess > target_excess ? query_excess : target_excess; // Columns to clip
+        if(is_match_op(r)) {
+            if(i <= 0) {
+                break;
+            }
+            if(i < r->length) {
+                r->length -= i;
+                *query_front += q_sign * i;
+                paf->target_start += i;
+                break;
+            }
+        }
+        if(r->op != query_delete) {
+            *query_front += q_sign * r->length;
+        }
+        if(r->op != query_insert) {
+            paf->target_start += r->length;
+        }
+        c->start++;
+        c->length--;
+    }
+    // Clip the back, likewise
+    while(c->length > 0) {
+        CigarRecord *r = cigar_get(c, c->length - 1);
+        int64_t query_excess = paf->same_strand ? *query_back - query_end : query_start - *query_back;
+        int64_t target_excess = paf->target_end - target_end;
+        int64_t i = query_excess > target_excess ? query_excess : target_excess;
+        if(is_match_op(r)) {
+            if(i <= 0) {
+                break;
+            }
+            if(i < r->length) {
+                r->length -= i;
+                *query_back -= q_sign * i;
+                paf->target_end -= i;
+                break;
+            }
+        }
+        if(r->op != query_delete) {
+            *query_back -= q_sign * r->length;
+        }
+        if(r->op != query_insert) {
+            paf->target_end -= r->length;
+        }
+        c->length--;
+    }
+    return c->length > 0;
+}
+
 Paf *paf_shatter2(Paf *paf, int64_t query_start, int64_t target_start, int64_t length) {
     Paf *s_paf = st_calloc(1, sizeof(Paf));
 
@@ -668,7 +825,10 @@ stList *paf_shatter(Paf *paf) {
 
 void sequenceCountArray_destruct(SequenceCountArray *seq_count_array) {
     free(seq_count_array->name);
-    free(seq_count_array->counts);
+    if(!seq_count_array->mapped) {
+        free(seq_count_array->counts);
+    }
+    free(seq_count_array->saturated);
     free(seq_count_array);
 }
 
@@ -687,6 +847,56 @@ SequenceCountArray *get_alignment_count_array(stHash *seq_names_to_alignment_cou
     return seq_count_array;
 }
 
+void increase_alignment_level_counts_in_range(SequenceCountArray *seq_count_array, int64_t start, int64_t end,
+                                              int64_t max_count, int64_t *level_counts, int64_t *max_level) {
+    assert(start >= 0 && end <= seq_count_array->length);
+    assert(max_count > 0 && max_count <= INT16_MAX - 1);
+    uint16_t *counts = seq_count_array->counts;
+    int64_t j = start, max_seen = max_level != NULL ? *max_level : 0;
+#ifdef PAF_USE_AVX2
+    // Sixteen counts at a time. Counts never exceed max_count <= INT16_MAX - 1, so signed comparisons are safe
+    const __m256i one = _mm256_set1_epi16(1), cap = _mm256_set1_epi16((int16_t)max_count);
+    __m256i max_v = _mm256_setzero_si256();
+    for(; j + 16 <= end; j += 16) {
+        __m256i v = _mm256_loadu_si256((__m256i *)(counts + j));
+        v = _mm256_min_epi16(_mm256_adds_epu16(v, one), cap); // prevent overflow
+        _mm256_storeu_si256((__m256i *)(counts + j), v);
+        if(level_counts != NULL) {
+            max_v = _mm256_max_epi16(max_v, v);
+            uint16_t first = counts[j];
+            if(_mm256_movemask_epi8(_mm256_cmpeq_epi16(v, _mm256_set1_epi16(first))) == -1) { // All sixteen equal,
+                // which is the common case as coverage changes rarely
+                level_counts[first] += 16;
+            }
+            else {
+                for(int64_t k=j; k<j+16; k++) {
+                    level_counts[counts[k]]++;
+                }
+            }
+        }
+    }
+    if(level_counts != NULL) {
+        uint16_t lanes[16];
+        _mm256_storeu_si256((__m256i *)lanes, max_v);
+        for(int64_t k=0; k<16; k++) {
+            max_seen = lanes[k] > max_seen ? lanes[k] : max_seen;
+        }
+    }
+#endif
+    for(; j < end; j++) {
+        if(counts[j] < max_count) { // prevent overflow
+            counts[j]++;
+        }
+        if(level_counts != NULL) {
+            level_counts[counts[j]]++;
+            max_seen = counts[j] > max_seen ? counts[j] : max_seen;
+        }
+    }
+    if(max_level != NULL) {
+        *max_level = max_seen;
+    }
+}
+
 void increase_alignment_level_counts(SequenceCountArray *seq_count_array, Paf *paf) {
     int64_t i = paf->query_start;
     for (int64_t ci = 0; ci < cigar_count(paf->cigar); ci++) {
@@ -694,18 +904,108 @@ void increase_alignment_level_counts(SequenceCountArray *seq_count_array, Paf *p
         if(c->op != query_delete) {
             if(c->op != query_insert) { // Is some kind of match
                 assert(c->op == match || c->op == sequence_match || c->op == sequence_mismatch);
-                for(int64_t j=0; j<c->length; j++) {
-                    assert(i + j < paf->query_end && i + j >= 0 && i + j < paf->query_length);
-                    assert(i + j < seq_count_array->length);
-                    if(seq_count_array->counts[i + j] < INT16_MAX - 1) { // prevent overflow
-                        seq_count_array->counts[i + j]++;
+                assert(i + c->length <= paf->query_end && i >= 0 && i + c->length <= paf->query_length);
+                increase_alignment_level_counts_in_range(seq_count_array, i, i + c->length, INT16_MAX - 1, NULL, NULL);
+            }
+            i += c->length;
+        }
+    }
+    assert(i == paf->query_end);
+}
+
+int64_t get_median_alignment_coverage(SequenceCountArray *seq_count_array, Paf *paf) {
+    // Get the max count of the matched bases, so the histogram of counts can be sized
+    int64_t max_count = 0, matches = 0, i = paf->query_start;
+    for (int64_t ci = 0; ci < cigar_count(paf->cigar); ci++) {
+        CigarRecord *c = cigar_get(paf->cigar, ci);
+        if(c->op != query_delete) {
+            if(c->op != query_insert) { // Is some kind of match
+                for(int64_t j=i; j<i+c->length; j++) {
+                    if(seq_count_array->counts[j] > max_count) {
+                        max_count = seq_count_array->counts[j];
                     }
                 }
+                matches += c->length;
             }
             i += c->length;
         }
     }
-    assert(i == paf->query_end);
+    if(matches == 0) {
+        return 0;
+    }
+    // Build the histogram of counts
+    int64_t *level_counts = st_calloc(max_count + 1, sizeof(int64_t));
+    i = paf->query_start;
+    for (int64_t ci = 0; ci < cigar_count(paf->cigar); ci++) {
+        CigarRecord *c = cigar_get(paf->cigar, ci);
+        if(c->op != query_delete) {
+            if(c->op != query_insert) {
+                for(int64_t j=i; j<i+c->length; j++) {
+                    level_counts[seq_count_array->counts[j]]++;
+                }
+            }
+            i += c->length;
+        }
+    }
+    // Find the median, as in paf_tile, the smallest count covering at least half the matched bases
+    int64_t median = 0, cumulative = level_counts[0];
+    while(cumulative < matches / 2.0) {
+        cumulative += level_counts[++median];
+    }
+    free(level_counts);
+    return median;
+}
+
+/*
+ * A hash of the coordinates of a paf, used to down-sample deterministically.
+ */
+static uint64_t paf_coordinate_hash(Paf *paf) {
+    uint64_t h = stHash_stringKey(paf->query_name) * 0x9E3779B97F4A7C15ULL;
+    h ^= stHash_stringKey(paf->target_name) + 0x632BE59BD9B4E019ULL + (h << 6) + (h >> 2);
+    int64_t coordinates[5] = { paf->query_start, paf->query_end, paf->target_start, paf->target_end,
+                               paf->same_strand };
+    for(int64_t i=0; i<5; i++) { // splitmix64 style mixing
+        h += (uint64_t)coordinates[i] + 0x9E3779B97F4A7C15ULL;
+        h = (h ^ (h >> 30)) * 0xBF58476D1CE4E5B9ULL;
+        h = (h ^ (h >> 27)) * 0x94D049BB133111EBULL;
+        h ^= h >> 31;
+    }
+    return h;
+}
+
+bool paf_passes_depth_filter(SequenceCountArray *seq_count_array, Paf *paf, int64_t max_depth, bool down_sample) {
+    int64_t median = get_median_alignment_coverage(seq_count_array, paf);
+    if(median <= max_depth) {
+        return 1;
+    }
+    // If down-sampling, keep about max_depth in every median alignments
+    return down_sample && paf_coordinate_hash(paf) % median < max_depth;
+}
+
+int64_t filter_pafs_by_depth(stList *pafs, int64_t max_depth, bool down_sample) {
+    stHash *seq_names_to_alignment_count_arrays = stHash_construct3(stHash_stringKey, stHash_stringEqualKey, NULL,
+                                                                    (void (*)(void *))sequenceCountArray_destruct);
+    for(int64_t i=0; i<stList_length(pafs); i++) { // Build the query coverage of all the alignments
+        Paf *paf = stList_get(pafs, i);
+        increase_alignment_level_counts(get_alignment_count_array(seq_names_to_alignment_count_arrays, paf), paf);
+    }
+    int64_t j = 0; // Compact the list in place, keeping the order of the passing alignments
+    for(int64_t i=0; i<stList_length(pafs); i++) {
+        Paf *paf = stList_get(pafs, i);
+        if(paf_passes_depth_filter(get_alignment_count_array(seq_names_to_alignment_count_arrays, paf), paf,
+                                   max_depth, down_sample)) {
+            stList_set(pafs, j++, paf);
+        }
+        else {
+            paf_destruct(paf);
+        }
+    }
+    int64_t removed = stList_length(pafs) - j;
+    while(stList_length(pafs) > j) {
+        stList_pop(pafs);
+    }
+    stHash_destruct(seq_names_to_alignment_count_arrays);
+    return removed;
 }
 
 void interval_destruct(Interval *interval) {
@@ -730,6 +1030,69 @@ Interval *decode_fasta_header(char *fasta_header) {
     return i;
 }
 
+Interval *get_decoded_fasta_header(stHash *headers_to_intervals, char *fasta_header) {
+    Interval *i = stHash_search(headers_to_intervals, fasta_header);
+    if(i == NULL) { // If the header has not been decoded yet
+        i = decode_fasta_header(fasta_header);
+        stHash_insert(headers_to_intervals, stString_copy(fasta_header), i);
+    }
+    return i;
+}
+
+static void convert_coordinates(Interval *i, char **contig, int64_t *start, int64_t *end, int64_t *length) {
+    free(*contig);
+    *contig = stString_copy(i->name); *start += i->start; *end += i->start; *length = i->length;
+}
+
+/*
+ * Gets the part of a chunk, in chunk coordinates, that faffy merge keeps: the overlaps with the previous and next
+ * chunks are split at their midpoints.
+ */
+static void get_chunk_bounds(Interval *i, int64_t chunk_length, int64_t chunk_size, int64_t overlap,
+                             int64_t *start, int64_t *end) {
+    int64_t expected_end = i->start + chunk_size + overlap < i->length ? i->start + chunk_size + overlap : i->length;
+    if(i->start % chunk_size != 0 || i->start + chunk_length != expected_end) {
+        st_errAbort("Chunk of %s starting at %" PRIi64 " with length %" PRIi64 " does not match the chunk size "
+                    "and overlap\n", i->name, i->start, chunk_length);
+    }
+    if(i->start == 0) {
+        *start = 0;
+    }
+    else { // The previous chunk starts chunk_size before this one
+        int64_t previous_end = i->start + overlap < i->length ? i->start + overlap : i->length;
+        *start = (previous_end + i->start) / 2 - i->start;
+    }
+    if(i->start + chunk_size >= i->length) { // The last chunk
+        *end = chunk_length;
+    }
+    else {
+        *end = (i->start + chunk_length + i->start + chunk_size) / 2 - i->start;
+    }
+}
+
+bool paf_dechunk(Paf *paf, stHash *headers_to_intervals, bool fix_query, bool fix_target, bool clip,
+                 int64_t chunk_size, int64_t overlap) {
+    // The chunk names are few compared to the records, so their decoding is cached
+    Interval *query_interval = fix_query ? get_decoded_fasta_header(headers_to_intervals, paf->query_name) : NULL;
+    Interval *target_interval = fix_target ? get_decoded_fasta_header(headers_to_intervals, paf->target_name) : NULL;
+    int64_t query_start = 0, query_end = paf->query_length, target_start = 0, target_end = paf->target_length;
+    if(clip && query_interval != NULL) {
+        get_chunk_bounds(query_interval, paf->query_length, chunk_size, overlap, &query_start, &query_end);
+    }
+    if(clip && target_interval != NULL) {
+        get_chunk_bounds(target_interval, paf->target_length, chunk_size, overlap, &target_start, &target_end);
+    }
+    bool kept = !clip || paf_clip(paf, query_start, query_end, target_start, target_end);
+    if(fix_query) {
+        convert_coordinates(query_interval, &paf->query_name, &paf->query_start, &paf->query_end, &paf->query_length);
+    }
+    if(fix_target) {
+        convert_coordinates(target_interval, &paf->target_name, &paf->target_start, &paf->target_end,
+                            &paf->target_length);
+    }
+    return kept;
+}
+
 int cmp_intervals(const void *i, const void *j) {
     Interval *x = (Interval *)i, *y = (Interval *)j;
     int k = strcmp(x->name, y->name);
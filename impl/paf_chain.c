@@ -8,27 +8,56 @@
  * (2) Sort alignments by chromosome and coordinate
  * (3) Chain alignments forward and reverse, assigning each alignment to a chain
  * (4) Output chained alignments file (PAF)
+ *
+ * With --keyOnly step (1) loads only the keys of the records, without their cigars, and step (4) streams the input
+ * file again, adding the chain tags to each record.
 */
 
 #include "paf.h"
 #include <getopt.h>
 #include <time.h>
+#include <omp.h>
 
 static int64_t max_gap_length = 1000000;
 static float percentage_to_trim = 1.0; // By default allow maximal overlap
 static int64_t chain_gap_open = 5000;
 static int64_t chain_gap_extend = 1;
+static int64_t max_iter = -1; // By default examine every candidate predecessor
+static int64_t max_skip = -1;
+static int64_t window_size = 0; // By default chain each partition serially
+static int64_t threads = 0; // By default use the OpenMP default
 
 static void usage(void) {
     fprintf(stderr, "paffy chain [options], version 0.1\n");
     fprintf(stderr, "Chains the records in the PAF file into chains, rescoring them as chains.\nChains are indicated with the cn tag.\n");
     fprintf(stderr, "-i --inputFile : Input paf file to invert. If not specified reads from stdin\n");
     fprintf(stderr, "-o --outputFile : Output paf file. If not specified outputs to stdout\n");
+    fprintf(stderr, "-c --chainedFile : An existing chained paf file (with cn/s1 tags) to add the input alignments to. "
+                    "Only the (query, target, strand) partitions that receive input alignments are rechained, "
+                    "the records of all other partitions are output first, unchanged and keeping their chain ids\n");
     fprintf(stderr, "-g --maxGapLength [INT] : The maximum allowable length of a gap in either sequence to chain (default:%" PRIi64 "bp)\n", max_gap_length);
     fprintf(stderr, "-d --chainGapOpen [INT] : The cost of opening a chain gap (default:%" PRIi64 "bp)\n", chain_gap_open);
     fprintf(stderr, "-e --chainGapExtend [INT] : The cost of extending a chain gap (default:%" PRIi64 "bp)\n", chain_gap_extend);
     fprintf(stderr, "-t --trimFraction : Fraction (from 0 to 1) of aligned bases to discount from the ends of the alignments when chaining"
                     "to trim from each end of the alignment when chaining, allowing slightly overlapping alignments to be chained (default:%f)\n", percentage_to_trim);
+    fprintf(stderr, "-m --maxIter [INT] : The maximum number of candidate predecessors to examine for each alignment, "
+                    "a negative value means no limit (default:%" PRIi64 ", minimap2 uses 5000)\n", max_iter);
+    fprintf(stderr, "-s --maxSkip [INT] : Stop examining candidate predecessors for an alignment after more than this many "
+                    "candidates reached through an already examined chain fail to improve the score, "
+                    "a negative value means no limit (default:%" PRIi64 ", minimap2 uses 25)\n", max_skip);
+    fprintf(stderr, "-w --windowSize [INT] : Split the alignments of each (query, target, strand) partition into query windows "
+                    "of this many bases and chain the windows in parallel. Each window overlaps the previous one by the "
+                    "max gap length plus the longest alignment. Without --maxIter and --maxSkip the output matches a serial run if "
+                    "no chain spans more than that overlap, otherwise a chain crossing an overlap is scored only from its "
+                    "start, so may lose to a competing chain. A non-positive value chains serially (default:%" PRIi64 ")\n", window_size);
+    fprintf(stderr, "-T --threads [INT] : The number of threads to chain windows with, a non-positive value uses the "
+                    "OpenMP default (default:%" PRIi64 ")\n", threads);
+    fprintf(stderr, "-y --symmetric : Treat each input record as both itself and its inversion (see paffy invert), "
+                    "outputting the chained inversions too, without materializing the inverted records in memory\n");
+    fprintf(stderr, "-k --keyOnly : Chain using only the names, coordinates, strand and score of each record, then read "
+                    "the input file a second time to output the records, in input order, with their chain tags. Each record is "
+                    "still held in memory as a full paf record, just without its cigar, so this only saves memory where the "
+                    "cigars are long. Requires --inputFile and can not be used with --chainedFile\n");
     fprintf(stderr, "-l --logLevel : Set the log level\n");
     fprintf(stderr, "-h --help : Print this help message\n");
 }
@@ -44,6 +73,113 @@ static int64_t gap_cost(int64_t query_gap_length, int64_t target_gap_length, voi
     //return min_indel * 30 + 10 * diagonal_gap;
 }
 
+/*
+ * Pafs can only be chained to pafs with the same query, target and strand, so these define independent partitions.
+ */
+static uint64_t paf_partition_key(const void *k) {
+    Paf *p = (Paf *)k;
+    return (stHash_stringKey(p->query_name) * 31 + stHash_stringKey(p->target_name)) * 2 + p->same_strand;
+}
+
+static int paf_partition_equal_key(const void *k, const void *k2) {
+    Paf *p = (Paf *)k, *p2 = (Paf *)k2;
+    return p->same_strand == p2->same_strand && strcmp(p->query_name, p2->query_name) == 0 &&
+           strcmp(p->target_name, p2->target_name) == 0;
+}
+
+/*
+ * Streams the records of an existing chained paf file. Records in partitions that have no new pafs are written
+ * straight to the output, records in partitions with new pafs are added to new_pafs so they get rechained.
+ * Returns one more than the largest chain id in the file, so rechained pafs can be given ids that don't clash.
+ */
+static int64_t pass_through_untouched_partitions(FILE *chained_input, stList *new_pafs, FILE *output,
+                                                 int64_t *kept_records) {
+    stHash *touched_partitions = stHash_construct3(paf_partition_key, paf_partition_equal_key, NULL, NULL);
+    for(int64_t i=0; i<stList_length(new_pafs); i++) {
+        Paf *paf = stList_get(new_pafs, i);
+        stHash_insert(touched_partitions, paf, paf);
+    }
+    int64_t next_chain_id = 0;
+    *kept_records = 0;
+    Paf *paf;
+    int64_t paf_buffer_length = 100;
+    char *paf_buffer = st_malloc(sizeof(char) * paf_buffer_length);
+    while((paf = paf_read_with_buffer(chained_input, 0, &paf_buffer, &paf_buffer_length)) != NULL) {
+        if(paf->chain_id == -1) {
+            st_errAbort("Record in the chained file is missing a chain id (cn tag): %s\n", paf_print(paf));
+        }
+        if(paf->chain_id >= next_chain_id) {
+            next_chain_id = paf->chain_id + 1;
+        }
+        if(stHash_search(touched_partitions, paf) != NULL) { // Partition has new alignments, so rechain it
+            stList_append(new_pafs, paf);
+        }
+        else { // Chains in this partition can not change
+            paf_write_with_buffer(paf, output, &paf_buffer, &paf_buffer_length);
+            paf_destruct(paf);
+            (*kept_records)++;
+        }
+    }
+    free(paf_buffer);
+    stHash_destruct(touched_partitions);
+    return next_chain_id;
+}
+
+/*
+ * Reads the keys of all the records in the input file, without their cigars.
+ */
+static stList *read_paf_keys(FILE *input, stHash *names) {
+    stList *pafs = stList_construct();
+    Paf *paf;
+    int64_t paf_buffer_length = 100;
+    char *paf_buffer = st_malloc(sizeof(char) * paf_buffer_length);
+    while((paf = paf_read_key_with_buffer(input, names, &paf_buffer, &paf_buffer_length)) != NULL) {
+        stList_append(pafs, paf);
+    }
+    free(paf_buffer);
+    return pafs;
+}
+
+/*
+ * Streams the records of the input file a second time, writing each with the chain tags of the corresponding key
+ * in paf_keys, which must be in input order. If inverted_paf_keys is not NULL each record is followed by its
+ * inversion, with the chain tags of the inverted key.
+ */
+static void write_records_with_chain_tags(FILE *input, stList *paf_keys, InvertedPafs *inverted_paf_keys,
+                                          FILE *output) {
+    Paf *paf;
+    int64_t i = 0;
+    int64_t paf_buffer_length = 100;
+    char *paf_buffer = st_malloc(sizeof(char) * paf_buffer_length);
+    while((paf = paf_read_with_buffer(input, 0, &paf_buffer, &paf_buffer_length)) != NULL) {
+        if(i >= stList_length(paf_keys)) {
+            st_errAbort("The input file has more records than when it was first read\n");
+        }
+        Paf *paf_key = stList_get(paf_keys, i);
+        paf->chain_id = paf_key->chain_id;
+        paf->chain_score = paf_key->chain_score;
+        paf_write_with_buffer(paf, output, &paf_buffer, &paf_buffer_length);
+        if(inverted_paf_keys != NULL) {
+            if(paf->cigar_string != NULL) { // Invert the cigar with the record
+                paf->cigar = cigar_parse(paf->cigar_string);
+                free(paf->cigar_string);
+                paf->cigar_string = NULL;
+            }
+            paf_invert(paf);
+            paf_key = &inverted_paf_keys->inverted_pafs[i];
+            paf->chain_id = paf_key->chain_id;
+            paf->chain_score = paf_key->chain_score;
+            paf_write_with_buffer(paf, output, &paf_buffer, &paf_buffer_length);
+        }
+        paf_destruct(paf);
+        i++;
+    }
+    if(i != stList_length(paf_keys)) {
+        st_errAbort("The input file has fewer records than when it was first read\n");
+    }
+    free(paf_buffer);
+}
+
 int paffy_chain_main(int argc, char *argv[]) {
     time_t startTime = time(NULL);
 
@@ -53,6 +189,9 @@ int paffy_chain_main(int argc, char *argv[]) {
     char *logLevelString = NULL;
     char *inputFile = NULL;
     char *outputFile = NULL;
+    char *chainedFile = NULL;
+    bool key_only = 0;
+    bool symmetric = 0;
 
     ///////////////////////////////////////////////////////////////////////////
     // Parse the inputs
@@ -62,15 +201,22 @@ int paffy_chain_main(int argc, char *argv[]) {
         static struct option long_options[] = { { "logLevel", required_argument, 0, 'l' },
                                                 { "inputFile", required_argument, 0, 'i' },
                                                 { "outputFile", required_argument, 0, 'o' },
+                                                { "chainedFile", required_argument, 0, 'c' },
                                                 { "maxGapLength", required_argument, 0, 'g' },
                                                 { "trimFraction", required_argument, 0, 't' },
                                                 { "chainGapOpen", required_argument, 0, 'd' },
                                                 { "chainGapExtend", required_argument, 0, 'e' },
+                                                { "maxIter", required_argument, 0, 'm' },
+                                                { "maxSkip", required_argument, 0, 's' },
+                                                { "windowSize", required_argument, 0, 'w' },
+                                                { "threads", required_argument, 0, 'T' },
+                                                { "keyOnly", no_argument, 0, 'k' },
+                                                { "symmetric", no_argument, 0, 'y' },
                                                 { "help", no_argument, 0, 'h' },
                                                 { 0, 0, 0, 0 } };
 
         int option_index = 0;
-        int64_t key = getopt_long(argc, argv, "l:i:o:hg:t:d:e:", long_options, &option_index);
+        int64_t key = getopt_long(argc, argv, "l:i:o:c:hg:t:d:e:m:s:w:T:ky", long_options, &option_index);
         if (key == -1) {
             break;
         }
@@ -85,6 +231,9 @@ int paffy_chain_main(int argc, char *argv[]) {
             case 'o':
                 outputFile = optarg;
                 break;
+            case 'c':
+                chainedFile = optarg;
+                break;
             case 'g':
                 max_gap_length = atoi(optarg);
                 break;
@@ -97,6 +246,24 @@ int paffy_chain_main(int argc, char *argv[]) {
             case 'e':
                 chain_gap_extend = atoi(optarg);
                 break;
+            case 'm':
+                max_iter = atol(optarg);
+                break;
+            case 's':
+                max_skip = atol(optarg);
+                break;
+            case 'w':
+                window_size = atol(optarg);
+                break;
+            case 'T':
+                threads = atol(optarg);
+                break;
+            case 'k':
+                key_only = 1;
+                break;
+            case 'y':
+                symmetric = 1;
+                break;
             case 'h':
                 usage();
                 return 0;
@@ -113,10 +280,24 @@ int paffy_chain_main(int argc, char *argv[]) {
     st_setLogLevelFromString(logLevelString);
     st_logInfo("Input file string : %s\n", inputFile);
     st_logInfo("Output file string : %s\n", outputFile);
+    st_logInfo("Chained file string : %s\n", chainedFile);
     st_logInfo("Trim chained alignment ends by : %f %\n", percentage_to_trim);
     st_logInfo("Maximum gap length : %" PRIi64 "\n", max_gap_length);
     st_logInfo("Chain gap open : %" PRIi64 "\n", chain_gap_open);
     st_logInfo("Chain gap extend : %" PRIi64 "\n", chain_gap_extend);
+    st_logInfo("Max predecessors to examine (maxIter) : %" PRIi64 "\n", max_iter);
+    st_logInfo("Max non-improving predecessors to skip (maxSkip) : %" PRIi64 "\n", max_skip);
+    st_logInfo("Chaining window size : %" PRIi64 "\n", window_size);
+    st_logInfo("Threads : %" PRIi64 "\n", threads);
+    st_logInfo("Chain keys only : %s\n", key_only ? "true" : "false");
+    st_logInfo("Symmetric : %s\n", symmetric ? "true" : "false");
+
+    if(key_only && inputFile == NULL) {
+        st_errAbort("--keyOnly reads the input twice, so an --inputFile must be given\n");
+    }
+    if(key_only && chainedFile != NULL) {
+        st_errAbort("--keyOnly can not be combined with --chainedFile\n");
+    }
 
     //////////////////////////////////////////////
     // Tile the paf records
@@ -125,11 +306,71 @@ int paffy_chain_main(int argc, char *argv[]) {
     FILE *input = inputFile == NULL ? stdin : fopen(inputFile, "r");
     FILE *output = outputFile == NULL ? stdout : fopen(outputFile, "w");
 
-    stList *pafs = read_pafs(input, 0); // Load local alignments files (PAF), don't actually load the pafs
-    stList *chained_pafs = paf_chain(pafs, gap_cost, NULL, max_gap_length, percentage_to_trim); // Convert to set of chains
+    stHash *names = NULL; // The sequence names shared by the keys, when only loading keys
+    stList *pafs;
+    if(key_only) {
+        names = stHash_construct3(stHash_stringKey, stHash_stringEqualKey, free, NULL);
+        pafs = read_paf_keys(input, names); // Load just the keys of the local alignments
+    }
+    else {
+        pafs = read_pafs(input, 0); // Load local alignments files (PAF), don't actually load the pafs
+    }
+
+    InvertedPafs *inverted_pafs = NULL;
+    int64_t input_records = stList_length(pafs);
+    if(symmetric) { // Chain the inversions of the input alignments too, without copying their cigars
+        inverted_pafs = inverted_pafs_construct(pafs);
+        for(int64_t i=0; i<input_records; i++) {
+            stList_append(pafs, &inverted_pafs->inverted_pafs[i]);
+        }
+    }
+
+    int64_t first_chain_id = 0;
+    if(chainedFile != NULL) { // Incremental mode: rechain only the partitions the new alignments fall in
+        int64_t new_records = stList_length(pafs), kept_records;
+        FILE *chained_input = fopen(chainedFile, "r");
+        if(chained_input == NULL) {
+            st_errAbort("Could not open chained file: %s\n", chainedFile);
+        }
+        first_chain_id = pass_through_untouched_partitions(chained_input, pafs, output, &kept_records);
+        fclose(chained_input);
+        st_logInfo("Kept %" PRIi64 " chained records unchanged, rechaining %" PRIi64 " new and %" PRIi64
+                   " previously chained records with chain ids starting from %" PRIi64 "\n", kept_records, new_records,
+                   stList_length(pafs) - new_records, first_chain_id);
+    }
+
+    if(threads > 0) {
+        omp_set_num_threads(threads);
+    }
+    ChainStats stats;
+    stList *chained_pafs = paf_chain2(pafs, gap_cost, NULL, max_gap_length, percentage_to_trim,
+                                      max_iter, max_skip, window_size, &stats); // Convert to set of chains
+    st_logInfo("Chaining examined %" PRIi64 " candidate predecessors, pruned %" PRIi64 ", accepted %" PRIi64
+               ", stopped %" PRIi64 " scans at maxIter and %" PRIi64 " scans at maxSkip\n",
+               stats.candidates_visited, stats.candidates_pruned, stats.candidates_accepted,
+               stats.max_iter_terminations, stats.max_skip_terminations);
 
     // Output chained alignments file
-    write_pafs(output, chained_pafs);
+    for(int64_t i=0; i<stList_length(chained_pafs); i++) {
+        ((Paf *)stList_get(chained_pafs, i))->chain_id += first_chain_id;
+    }
+    if(key_only) { // The keys in pafs are still in input order and now carry their chain tags
+        rewind(input);
+        stList_setLength(pafs, input_records);
+        write_records_with_chain_tags(input, pafs, inverted_pafs, output);
+    }
+    else if(symmetric) {
+        int64_t paf_buffer_length = 100;
+        char *paf_buffer = st_malloc(sizeof(char) * paf_buffer_length);
+        for(int64_t i=0; i<stList_length(chained_pafs); i++) {
+            inverted_pafs_write_with_buffer(inverted_pafs, stList_get(chained_pafs, i), output,
+                                            &paf_buffer, &paf_buffer_length);
+        }
+        free(paf_buffer);
+    }
+    else {
+        write_pafs(output, chained_pafs);
+    }
 
     //////////////////////////////////////////////
     // Cleanup
@@ -138,7 +379,25 @@ int paffy_chain_main(int argc, char *argv[]) {
     // Cleans up the pafs list - but not the pafs themselves, which are destroyed by chaining
     stList_setDestructor(pafs, NULL);
     stList_destruct(pafs);
+    stList_setDestructor(chained_pafs, NULL);
+    for(int64_t i=0; i<stList_length(chained_pafs); i++) { // The inversions are cleaned up with inverted_pafs
+        Paf *paf = stList_get(chained_pafs, i);
+        if(inverted_pafs == NULL || inverted_pafs_get_original(inverted_pafs, paf) == NULL) {
+            if(key_only) {
+                free(paf);
+            }
+            else {
+                paf_destruct(paf);
+            }
+        }
+    }
     stList_destruct(chained_pafs);
+    if(inverted_pafs != NULL) {
+        inverted_pafs_destruct(inverted_pafs);
+    }
+    if(names != NULL) {
+        stHash_destruct(names);
+    }
 
     if(inputFile != NULL) {
         fclose(input);
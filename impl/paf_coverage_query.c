@@ -0,0 +1,187 @@
+/*
+ * paffy coverage_query: Read the coverage of regions from a binary coverage track written by paffy to_bed
+ *
+ * Released under the MIT license, see LICENSE.txt
+ */
+
+#include "paf.h"
+#include <getopt.h>
+#include <time.h>
+
+static void usage(void) {
+    fprintf(stderr, "paffy coverage_query [options] [REGION...], version 0.1\n");
+    fprintf(stderr, "Outputs the coverage of the given regions, each a sequence name optionally followed by :START-END "
+                    "(0-based, end exclusive), from a coverage track written by paffy to_bed --trackFile. If no regions "
+                    "are given outputs the coverage of every sequence\n");
+    fprintf(stderr, "-i --inputFile : Input coverage track file, which must be given\n");
+    fprintf(stderr, "-o --outputFile : Output file. If not specified outputs to stdout\n");
+    fprintf(stderr, "-z --binSize [INT] : Output the mean and max coverage of the bins of the given size that overlap "
+                    "each region, one of 1000, 10000 or 100000, as name start end mean max lines, rather than the runs "
+                    "of equal coverage, as name start end coverage lines, as output by paffy to_bed\n");
+    fprintf(stderr, "-l --logLevel : Set the log level\n");
+    fprintf(stderr, "-h --help : Print this help message\n");
+}
+
+/*
+ * Writes the runs of equal coverage overlapping [start, end), clipped to it.
+ */
+static void write_runs(FILE *output, CoverageTrackSequence *sequence, int64_t start, int64_t end) {
+    for(int64_t i=coverageTrackSequence_get_run_index(sequence, start); i<sequence->run_number; i++) {
+        int64_t run_start = i > 0 ? sequence->runs[i-1].end : 0;
+        if(run_start >= end) {
+            break;
+        }
+        fprintf(output, "%s %" PRIi64 " %" PRIi64 " %" PRIi64 "\n", sequence->name,
+                run_start > start ? run_start : start, sequence->runs[i].end < end ? sequence->runs[i].end : end,
+                sequence->runs[i].count);
+    }
+}
+
+/*
+ * Writes the bins of the given zoom level overlapping [start, end).
+ */
+static void write_bins(FILE *output, CoverageTrackSequence *sequence, int64_t zoom_level, int64_t start, int64_t end) {
+    int64_t bin_size = coverage_track_bin_sizes[zoom_level];
+    for(int64_t j=start/bin_size; j*bin_size < end; j++) {
+        CoverageTrackBin *bin = &sequence->zoom_levels[zoom_level][j];
+        fprintf(output, "%s %" PRIi64 " %" PRIi64 " %f %" PRIu32 "\n", sequence->name, j * bin_size,
+                (j + 1) * bin_size < sequence->length ? (j + 1) * bin_size : sequence->length, bin->mean, bin->max);
+    }
+}
+
+static void write_region(FILE *output, CoverageTrackSequence *sequence, int64_t zoom_level, int64_t start,
+                         int64_t end) {
+    if(start >= end) {
+        return;
+    }
+    if(zoom_level >= 0) {
+        write_bins(output, sequence, zoom_level, start, end);
+    }
+    else {
+        write_runs(output, sequence, start, end);
+    }
+}
+
+int paffy_coverage_query_main(int argc, char *argv[]) {
+    time_t startTime = time(NULL);
+
+    /*
+     * Arguments/options
+     */
+    char *logLevelString = NULL;
+    char *inputFile = NULL;
+    char *outputFile = NULL;
+    int64_t bin_size = 0;
+
+    ///////////////////////////////////////////////////////////////////////////
+    // Parse the inputs
+    ///////////////////////////////////////////////////////////////////////////
+
+    while (1) {
+        static struct option long_options[] = { { "logLevel", required_argument, 0, 'l' },
+                                                { "inputFile", required_argument, 0, 'i' },
+                                                { "outputFile", required_argument, 0, 'o' },
+                                                { "binSize", required_argument, 0, 'z' },
+                                                { "help", no_argument, 0, 'h' },
+                                                { 0, 0, 0, 0 } };
+
+        int option_index = 0;
+        int64_t key = getopt_long(argc, argv, "l:i:o:z:h", long_options, &option_index);
+        if (key == -1) {
+            break;
+        }
+
+        switch (key) {
+            case 'l':
+                logLevelString = optarg;
+                break;
+            case 'i':
+                inputFile = optarg;
+                break;
+            case 'o':
+                outputFile = optarg;
+                break;
+            case 'z':
+                bin_size = atol(optarg);
+                break;
+            case 'h':
+                usage();
+                return 0;
+            default:
+                usage();
+                return 1;
+        }
+    }
+
+    //////////////////////////////////////////////
+    //Log the inputs
+    //////////////////////////////////////////////
+
+    st_setLogLevelFromString(logLevelString);
+    st_logInfo("Input file string : %s\n", inputFile);
+    st_logInfo("Output file string : %s\n", outputFile);
+    st_logInfo("Bin size : %" PRIi64 "\n", bin_size);
+
+    if(inputFile == NULL) {
+        st_errAbort("An input coverage track must be given\n");
+    }
+    int64_t zoom_level = -1;
+    for(int64_t i=0; i<COVERAGE_TRACK_ZOOM_LEVELS; i++) {
+        if(coverage_track_bin_sizes[i] == bin_size) {
+            zoom_level = i;
+        }
+    }
+    if(bin_size != 0 && zoom_level == -1) {
+        st_errAbort("Unsupported bin size: %" PRIi64 "\n", bin_size);
+    }
+
+    //////////////////////////////////////////////
+    // Query the coverage
+    //////////////////////////////////////////////
+
+    CoverageTrack *track = coverageTrack_open(inputFile);
+    FILE *output = outputFile == NULL ? stdout : fopen(outputFile, "w");
+
+    if(optind == argc) { // Output every sequence
+        for(int64_t i=0; i<stList_length(track->sequences); i++) {
+            CoverageTrackSequence *sequence = stList_get(track->sequences, i);
+            write_region(output, sequence, zoom_level, 0, sequence->length);
+        }
+    }
+    for(int64_t i=optind; i<argc; i++) {
+        // Parse the region, allowing for colons in sequence names
+        char *name = stString_copy(argv[i]), *colon = strrchr(name, ':');
+        int64_t start = 0, end = INT64_MAX;
+        int consumed = 0;
+        if(colon != NULL && sscanf(colon + 1, "%" SCNd64 "-%" SCNd64 "%n", &start, &end, &consumed) == 2 &&
+           colon[1 + consumed] == '\0') {
+            *colon = '\0';
+        }
+        else {
+            start = 0;
+            end = INT64_MAX;
+        }
+        CoverageTrackSequence *sequence = coverageTrack_get_sequence(track, name);
+        if(sequence == NULL) {
+            st_errAbort("Sequence is not in the coverage track: %s\n", name);
+        }
+        if(start < 0 || start > end) {
+            st_errAbort("Invalid region: %s\n", argv[i]);
+        }
+        write_region(output, sequence, zoom_level, start, end < sequence->length ? end : sequence->length);
+        free(name);
+    }
+
+    //////////////////////////////////////////////
+    // Cleanup
+    //////////////////////////////////////////////
+
+    coverageTrack_destruct(track);
+    if(outputFile != NULL) {
+        fclose(output);
+    }
+
+    st_logInfo("Paffy coverage_query is done!, %" PRIi64 " seconds have elapsed\n", time(NULL) - startTime);
+
+    return 0;
+}
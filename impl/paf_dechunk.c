@@ -17,26 +17,18 @@
                      "Modifies paf coordinates to remove the chunk coordinate name encoding created by fasta_chunk.\n");
      fprintf(stderr, "-i --inputFile : Input paf file to dechunk. If not specified reads from stdin\n");
      fprintf(stderr, "-o --outputFile : Output paf file. If not specified outputs to stdout\n");
+     fprintf(stderr, "-m --clip : Clip the alignments to the part of each chunk that faffy merge would keep, splitting "
+                     "the overlap between consecutive chunks at its midpoint, dropping alignments entirely beyond it. "
+                     "Avoids reporting the alignments of chunk overlaps twice. Requires the chunk size and overlap "
+                     "given to faffy chunk\n");
+     fprintf(stderr, "-c --chunkSize : With --clip, the chunk size given to faffy chunk, by default: %" PRIi64 "\n",
+             DEFAULT_CHUNK_SIZE);
+     fprintf(stderr, "-v --overlap : With --clip, the chunk overlap given to faffy chunk, by default: %" PRIi64 "\n",
+             DEFAULT_CHUNK_OVERLAP);
      fprintf(stderr, "-l --logLevel : Set the log level\n");
      fprintf(stderr, "-h --help : Print this help message\n");
  }
 
-static void convertCoordinatesP(char **contig, int64_t *start, int64_t *end, int64_t *length) {
-    Interval *i = decode_fasta_header(*contig);
-    free(*contig);
-    *contig = i->name; *start += i->start; *end += i->start; *length = i->length;
-    free(i);
-}
-
-static void paf_dechunk(Paf *paf, bool fix_query, bool fix_target) {
-     if(fix_query) {
-         convertCoordinatesP(&paf->query_name, &paf->query_start, &paf->query_end, &paf->query_length);
-     }
-     if(fix_target) {
-         convertCoordinatesP(&paf->target_name, &paf->target_start, &paf->target_end, &paf->target_length);
-     }
- }
-
 int paffy_dechunk_main(int argc, char *argv[]) {
      time_t startTime = time(NULL);
 
@@ -48,6 +40,9 @@ int paffy_dechunk_main(int argc, char *argv[]) {
      char *outputFile = NULL;
      bool fix_query = 1;
      bool fix_target = 1;
+     bool clip = 0;
+     int64_t chunk_size = DEFAULT_CHUNK_SIZE;
+     int64_t overlap = DEFAULT_CHUNK_OVERLAP;
 
      ///////////////////////////////////////////////////////////////////////////
      // Parse the inputs
@@ -59,11 +54,14 @@ int paffy_dechunk_main(int argc, char *argv[]) {
                                                  { "outputFile", required_argument, 0, 'o' },
                                                  { "query", no_argument, 0, 'q' },
                                                  { "target", no_argument, 0, 't' },
+                                                 { "clip", no_argument, 0, 'm' },
+                                                 { "chunkSize", required_argument, 0, 'c' },
+                                                 { "overlap", required_argument, 0, 'v' },
                                                  { "help", no_argument, 0, 'h' },
                                                  { 0, 0, 0, 0 } };
 
          int option_index = 0;
-         int64_t key = getopt_long(argc, argv, "l:i:o:hqt", long_options, &option_index);
+         int64_t key = getopt_long(argc, argv, "l:i:o:hqtmc:v:", long_options, &option_index);
          if (key == -1) {
              break;
          }
@@ -84,6 +82,15 @@ int paffy_dechunk_main(int argc, char *argv[]) {
              case 't':
                  fix_query = 0;
                  break;
+             case 'm':
+                 clip = 1;
+                 break;
+             case 'c':
+                 chunk_size = atol(optarg);
+                 break;
+             case 'v':
+                 overlap = atol(optarg);
+                 break;
              case 'h':
                  usage();
                  return 0;
@@ -100,6 +107,11 @@ int paffy_dechunk_main(int argc, char *argv[]) {
      st_setLogLevelFromString(logLevelString);
      st_logInfo("Input file string : %s\n", inputFile);
      st_logInfo("Output file string : %s\n", outputFile);
+     st_logInfo("Clip : %s, chunk size : %" PRIi64 ", overlap : %" PRIi64 "\n", clip ? "True" : "False", chunk_size,
+                overlap);
+     if(clip && (chunk_size <= overlap || overlap < 0)) {
+         st_errAbort("The chunk size must be greater than the overlap, which must not be negative\n");
+     }
 
      //////////////////////////////////////////////
      // De-chunk the paf
@@ -108,16 +120,20 @@ int paffy_dechunk_main(int argc, char *argv[]) {
      FILE *input = inputFile == NULL ? stdin : fopen(inputFile, "r");
      FILE *output = outputFile == NULL ? stdout : fopen(outputFile, "w");
 
+     stHash *headers_to_intervals = stHash_construct3(stHash_stringKey, stHash_stringEqualKey, free,
+                                                      (void (*)(void *))interval_destruct);
      Paf *paf;
      int64_t paf_buffer_length = 100;
      char *paf_buffer = st_malloc(sizeof(char) * paf_buffer_length);
      while((paf = paf_read_with_buffer(input, 1, &paf_buffer, &paf_buffer_length)) != NULL) {
-         paf_dechunk(paf, fix_query, fix_target);
-         paf_check(paf);
-         paf_write_with_buffer(paf, output, &paf_buffer, &paf_buffer_length);
+         if(paf_dechunk(paf, headers_to_intervals, fix_query, fix_target, clip, chunk_size, overlap)) {
+             paf_check(paf);
+             paf_write_with_buffer(paf, output, &paf_buffer, &paf_buffer_length);
+         }
          paf_destruct(paf);
      }
      free(paf_buffer);
+     stHash_destruct(headers_to_intervals);
 
      //////////////////////////////////////////////
      // Cleanup
@@ -0,0 +1,321 @@
+/*
+ * paffy dechunk_dedupe: Dechunks and deduplicates the pafs of many files of alignments between chunks, as made by
+ * faffy chunk, writing a single merged file. Equivalent to concatenating the files and running paffy dechunk then
+ * paffy dedupe, but without the intermediate files.
+ *
+ * Released under the MIT license, see LICENSE.txt
+ *
+ * Overview:
+ * (1) Read and dechunk the files in parallel, each thread keeping the dechunked lines of a file in memory along with
+ * their fingerprints.
+ * (2) In file order, add the fingerprints of each file to a global fingerprint set, writing the lines whose
+ * fingerprints have not been seen before.
+ */
+
+#include "paf.h"
+#include <getopt.h>
+#include <time.h>
+#include <omp.h>
+#include "bioioC.h"
+#include "sonLib.h"
+
+static void usage(void) {
+    fprintf(stderr, "paffy dechunk_dedupe [paf_file]xN [options], version 0.1\n");
+    fprintf(stderr, "Dechunks and removes duplicates from the alignments of many paf files of alignments between the "
+                    "chunks made by faffy chunk, reading the files in parallel and writing a single paf file, as "
+                    "concatenating the files and running paffy dechunk then paffy dedupe would\n");
+    fprintf(stderr, "-f --inputFiles : A file of the paf files to read, one per line, read after any given as arguments. "
+                    "If no paf files are given reads from stdin\n");
+    fprintf(stderr, "-o --outputFile : Output paf file. If not specified outputs to stdout\n");
+    fprintf(stderr, "-q --query : Only dechunk the query coordinates\n");
+    fprintf(stderr, "-t --target : Only dechunk the target coordinates\n");
+    fprintf(stderr, "-a --checkInverse : Also deduplicate alignments that are the same, but with query and target reversed\n");
+    fprintf(stderr, "-m --clip : Clip the alignments to the part of each chunk that faffy merge would keep, as "
+                    "paffy dechunk --clip\n");
+    fprintf(stderr, "-c --chunkSize : With --clip, the chunk size given to faffy chunk, by default: %" PRIi64 "\n",
+            DEFAULT_CHUNK_SIZE);
+    fprintf(stderr, "-v --overlap : With --clip, the chunk overlap given to faffy chunk, by default: %" PRIi64 "\n",
+            DEFAULT_CHUNK_OVERLAP);
+    fprintf(stderr, "-T --threads [INT] : The number of threads to read the files\n");
+    fprintf(stderr, "-l --logLevel : Set the log level\n");
+    fprintf(stderr, "-h --help : Print this help message\n");
+}
+
+/*
+ * The dechunked lines of a file and their fingerprints.
+ */
+typedef struct _dechunkedFile {
+    char *text; // The lines
+    size_t text_length;
+    int64_t *line_ends; // The offset of the end of each line in text
+    PafFingerprint *fingerprints;
+    int64_t record_number, capacity;
+} DechunkedFile;
+
+static void dechunk_file(FILE *input, DechunkedFile *dechunked_file, stHash *headers_to_intervals, bool fix_query,
+                         bool fix_target, bool clip, int64_t chunk_size, int64_t overlap, bool check_inverse) {
+    FILE *text = open_memstream(&dechunked_file->text, &dechunked_file->text_length);
+    dechunked_file->capacity = 16;
+    dechunked_file->line_ends = st_malloc(dechunked_file->capacity * sizeof(int64_t));
+    dechunked_file->fingerprints = st_malloc(dechunked_file->capacity * sizeof(PafFingerprint));
+    Paf *paf;
+    int64_t paf_buffer_length = 100;
+    char *paf_buffer = st_malloc(sizeof(char) * paf_buffer_length);
+    while((paf = paf_read_with_buffer(input, clip, &paf_buffer, &paf_buffer_length)) != NULL) {
+        if(paf_dechunk(paf, headers_to_intervals, fix_query, fix_target, clip, chunk_size, overlap)) {
+            paf_check(paf);
+            if(dechunked_file->record_number == dechunked_file->capacity) {
+                dechunked_file->capacity *= 2;
+                dechunked_file->line_ends = realloc(dechunked_file->line_ends,
+                                                    dechunked_file->capacity * sizeof(int64_t));
+                dechunked_file->fingerprints = realloc(dechunked_file->fingerprints,
+                                                       dechunked_file->capacity * sizeof(PafFingerprint));
+            }
+            // The fingerprints hash the sequence names, so can be made by each thread independently
+            dechunked_file->fingerprints[dechunked_file->record_number] = paf_get_fingerprint(paf, check_inverse);
+            paf_write_with_buffer(paf, text, &paf_buffer, &paf_buffer_length);
+            dechunked_file->line_ends[dechunked_file->record_number++] = ftello(text);
+        }
+        paf_destruct(paf);
+    }
+    free(paf_buffer);
+    fclose(text);
+}
+
+/*
+ * Writes the lines of the file whose fingerprints are not already in the set, returning the number of duplicates.
+ */
+static int64_t write_dechunked_file(DechunkedFile *dechunked_file, FingerprintSet *fingerprints, FILE *output) {
+    int64_t duplicates = 0;
+    for(int64_t i=0; i<dechunked_file->record_number; i++) {
+        int64_t line_start = i > 0 ? dechunked_file->line_ends[i-1] : 0;
+        if(fingerprintSet_add(fingerprints, dechunked_file->fingerprints[i])) {
+            if(fwrite(dechunked_file->text + line_start, 1, dechunked_file->line_ends[i] - line_start, output) !=
+               dechunked_file->line_ends[i] - line_start) {
+                st_errAbort("Failed to write output\n");
+            }
+        }
+        else {
+            st_logDebug("Got duplicate paf: %.*s", (int)(dechunked_file->line_ends[i] - line_start),
+                        dechunked_file->text + line_start);
+            duplicates++;
+        }
+    }
+    return duplicates;
+}
+
+/*
+ * Dechunks and dedupes a single input, such as stdin, as it is read, returning the number of duplicates.
+ */
+static int64_t dechunk_stream(FILE *input, FILE *output, FingerprintSet *fingerprints, stHash *headers_to_intervals,
+                              bool fix_query, bool fix_target, bool clip, int64_t chunk_size, int64_t overlap,
+                              bool check_inverse) {
+    int64_t duplicates = 0;
+    Paf *paf;
+    int64_t paf_buffer_length = 100;
+    char *paf_buffer = st_malloc(sizeof(char) * paf_buffer_length);
+    while((paf = paf_read_with_buffer(input, clip, &paf_buffer, &paf_buffer_length)) != NULL) {
+        if(paf_dechunk(paf, headers_to_intervals, fix_query, fix_target, clip, chunk_size, overlap)) {
+            paf_check(paf);
+            if(fingerprintSet_add(fingerprints, paf_get_fingerprint(paf, check_inverse))) {
+                paf_write_with_buffer(paf, output, &paf_buffer, &paf_buffer_length);
+            }
+            else {
+                duplicates++;
+            }
+        }
+        paf_destruct(paf);
+    }
+    free(paf_buffer);
+    return duplicates;
+}
+
+static void dechunkedFile_clear(DechunkedFile *dechunked_file) {
+    free(dechunked_file->text);
+    free(dechunked_file->line_ends);
+    free(dechunked_file->fingerprints);
+    memset(dechunked_file, 0, sizeof(DechunkedFile));
+}
+
+int paffy_dechunk_dedupe_main(int argc, char *argv[]) {
+    time_t startTime = time(NULL);
+
+    /*
+     * Arguments/options
+     */
+    char *logLevelString = NULL;
+    char *inputFiles = NULL;
+    char *outputFile = NULL;
+    bool fix_query = 1;
+    bool fix_target = 1;
+    bool check_inverse = 0;
+    bool clip = 0;
+    int64_t chunk_size = DEFAULT_CHUNK_SIZE;
+    int64_t overlap = DEFAULT_CHUNK_OVERLAP;
+    int64_t threads = 0;
+
+    ///////////////////////////////////////////////////////////////////////////
+    // Parse the inputs
+    ///////////////////////////////////////////////////////////////////////////
+
+    while (1) {
+        static struct option long_options[] = { { "logLevel", required_argument, 0, 'l' },
+                                                { "inputFiles", required_argument, 0, 'f' },
+                                                { "outputFile", required_argument, 0, 'o' },
+                                                { "query", no_argument, 0, 'q' },
+                                                { "target", no_argument, 0, 't' },
+                                                { "checkInverse", no_argument, 0, 'a' },
+                                                { "clip", no_argument, 0, 'm' },
+                                                { "chunkSize", required_argument, 0, 'c' },
+                                                { "overlap", required_argument, 0, 'v' },
+                                                { "threads", required_argument, 0, 'T' },
+                                                { "help", no_argument, 0, 'h' },
+                                                { 0, 0, 0, 0 } };
+
+        int option_index = 0;
+        int64_t key = getopt_long(argc, argv, "l:f:o:qtamc:v:T:h", long_options, &option_index);
+        if (key == -1) {
+            break;
+        }
+
+        switch (key) {
+            case 'l':
+                logLevelString = optarg;
+                break;
+            case 'f':
+                inputFiles = optarg;
+                break;
+            case 'o':
+                outputFile = optarg;
+                break;
+            case 'q':
+                fix_target = 0;
+                break;
+            case 't':
+                fix_query = 0;
+                break;
+            case 'a':
+                check_inverse = 1;
+                break;
+            case 'm':
+                clip = 1;
+                break;
+            case 'c':
+                chunk_size = atol(optarg);
+                break;
+            case 'v':
+                overlap = atol(optarg);
+                break;
+            case 'T':
+                threads = atol(optarg);
+                break;
+            case 'h':
+                usage();
+                return 0;
+            default:
+                usage();
+                return 1;
+        }
+    }
+
+    //////////////////////////////////////////////
+    //Log the inputs
+    //////////////////////////////////////////////
+
+    st_setLogLevelFromString(logLevelString);
+    st_logInfo("Input files file : %s\n", inputFiles);
+    st_logInfo("Output file string : %s\n", outputFile);
+    st_logInfo("Check inverse : %s\n", check_inverse ? "True" : "False");
+    st_logInfo("Clip : %s, chunk size : %" PRIi64 ", overlap : %" PRIi64 "\n", clip ? "True" : "False", chunk_size,
+               overlap);
+    st_logInfo("Threads : %" PRIi64 "\n", threads);
+    if(clip && (chunk_size <= overlap || overlap < 0)) {
+        st_errAbort("The chunk size must be greater than the overlap, which must not be negative\n");
+    }
+    if(threads > 0) {
+        omp_set_num_threads(threads);
+    }
+
+    //////////////////////////////////////////////
+    // Get the input files
+    //////////////////////////////////////////////
+
+    stList *paf_files = stList_construct3(0, free);
+    while(optind < argc) {
+        stList_append(paf_files, stString_copy(argv[optind++]));
+    }
+    if(inputFiles != NULL) {
+        FILE *fh = fopen(inputFiles, "r");
+        if(fh == NULL) {
+            st_errAbort("Could not open input files file: %s\n", inputFiles);
+        }
+        char *line;
+        while((line = stFile_getLineFromFile(fh)) != NULL) {
+            if(line[0] != '\0') { // Skip blank lines
+                stList_append(paf_files, line);
+            }
+            else {
+                free(line);
+            }
+        }
+        fclose(fh);
+    }
+    st_logInfo("Got %" PRIi64 " paf files\n", stList_length(paf_files));
+
+    //////////////////////////////////////////////
+    // Dechunk and dedupe the pafs
+    //////////////////////////////////////////////
+
+    FILE *output = outputFile == NULL ? stdout : fopen(outputFile, "w");
+    FingerprintSet *fingerprints = fingerprintSet_construct();
+    int64_t thread_number = omp_get_max_threads(), duplicates = 0;
+    stHash **headers_to_intervals = st_malloc(thread_number * sizeof(stHash *)); // A cache for each thread
+    for(int64_t i=0; i<thread_number; i++) {
+        headers_to_intervals[i] = stHash_construct3(stHash_stringKey, stHash_stringEqualKey, free,
+                                                    (void (*)(void *))interval_destruct);
+    }
+    if(stList_length(paf_files) == 0) {
+        duplicates = dechunk_stream(stdin, output, fingerprints, headers_to_intervals[0], fix_query, fix_target, clip,
+                                    chunk_size, overlap, check_inverse);
+    }
+    // The files are dechunked in parallel, but written in order, so the output does not depend on the number of
+    // threads. A thread waits to write the file it has dechunked before starting another, so at most one file per
+    // thread is held in memory.
+    #pragma omp parallel for schedule(dynamic) ordered
+    for(int64_t i=0; i<stList_length(paf_files); i++) {
+        char *paf_file = stList_get(paf_files, i);
+        FILE *input = fopen(paf_file, "r");
+        if(input == NULL) {
+            st_errAbort("Could not open paf file: %s\n", paf_file);
+        }
+        DechunkedFile dechunked_file = { 0 };
+        dechunk_file(input, &dechunked_file, headers_to_intervals[omp_get_thread_num()], fix_query, fix_target, clip,
+                     chunk_size, overlap, check_inverse);
+        fclose(input);
+        #pragma omp ordered
+        {
+            st_logDebug("Writing paf file : %s\n", paf_file);
+            duplicates += write_dechunked_file(&dechunked_file, fingerprints, output);
+        }
+        dechunkedFile_clear(&dechunked_file);
+    }
+    st_logInfo("Wrote %" PRIi64 " pafs, removing %" PRIi64 " duplicates\n", fingerprints->size, duplicates);
+
+    //////////////////////////////////////////////
+    // Cleanup
+    //////////////////////////////////////////////
+
+    for(int64_t i=0; i<thread_number; i++) {
+        stHash_destruct(headers_to_intervals[i]);
+    }
+    free(headers_to_intervals);
+    fingerprintSet_destruct(fingerprints);
+    stList_destruct(paf_files);
+    if(outputFile != NULL) {
+        fclose(output);
+    }
+
+    st_logInfo("Paffy dechunk_dedupe is done!, %" PRIi64 " seconds have elapsed\n", time(NULL) - startTime);
+
+    return 0;
+}
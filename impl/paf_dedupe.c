@@ -5,44 +5,403 @@
  *
  * Overview:
  * (1) Load paf records
- * (2) For each paf in order of file add to a dictionary of sequence coordinates.
- * (3) If a record does not have the same coordinates as a previous entry omit print it, else omit it
+ * (2) For each paf in order of file add a fingerprint of its sequence coordinates to a set.
+ * (3) If a record does not have the same fingerprint as a previous entry print it, else omit it
+ * If the input is sorted by query name and start only the fingerprints of the records with the current query name and
+ * start need to be kept, as duplicates have the same query start. If the input is too large to deduplicate in memory the
+ * records can instead be hash partitioned into shard files that are deduplicated independently. Optionally alignments
+ * contained in better alignments on the same diagonal, not just exact duplicates, can be removed.
 */
 
 #include "paf.h"
 #include <getopt.h>
 #include <time.h>
+#include <ctype.h>
+#include <omp.h>
+#include <unistd.h>
 #include "bioioC.h"
 
 static void usage(void) {
     fprintf(stderr, "paffy dedupe [options], version 0.1\n");
-    fprintf(stderr, "Pretty print PAF alignments\n");
+    fprintf(stderr, "Remove duplicate PAF alignments\n");
     fprintf(stderr, "-i --inputFile : Input paf file to invert. If not specified reads from stdin\n");
     fprintf(stderr, "-o --outputFile : Output paf file. If not specified outputs to stdout\n");
     fprintf(stderr, "-a --checkInverse : Also deduplicate alignments that are the same, but with query and target reversed\n");
+    fprintf(stderr, "-s --sorted : The input is sorted by query name and query start (e.g. with sort -k1,1 -k3,3n), so only "
+                    "keep the records with the current query start in memory. Can not be used with --checkInverse\n");
+    fprintf(stderr, "-c --contained : Also remove alignments whose query and target intervals lie within those of a better "
+                    "alignment (by score, then matches, then query length, then input order) with the same query, target "
+                    "and strand, on the same diagonals, such as the repeated alignments of chunk overlaps. Holds the "
+                    "alignments in memory, so can not be used with --sorted or --partitions\n");
+    fprintf(stderr, "-g --diagonalSlack [INT] : With --contained, the number of diagonals either side of the diagonals "
+                    "of the containing alignment a contained alignment may stray. Default: 0\n");
+    fprintf(stderr, "-p --partitions [INT] : Spill the records to this many temporary shard files, partitioned by a hash "
+                    "of their coordinates, deduplicate the shards in parallel and merge the results back into input "
+                    "order, for input too large to deduplicate in memory\n");
+    fprintf(stderr, "-m --memoryBudget [INT] : With --partitions, the approximate memory in bytes, optionally with a K, M "
+                    "or G suffix, to use to deduplicate the shards. Shards too large to deduplicate in their thread's "
+                    "share of the budget are split. If given without --partitions, 64 partitions are used. Default: 1G\n");
+    fprintf(stderr, "-d --tempDir : With --partitions, the directory in which to write the shards. Default: /tmp\n");
+    fprintf(stderr, "-T --threads [INT] : With --partitions, the number of threads to deduplicate the shards\n");
     fprintf(stderr, "-l --logLevel : Set the log level\n");
     fprintf(stderr, "-h --help : Print this help message\n");
 }
 
-static uint64_t paf_hash_key(const void *k) {
-    Paf *p = (Paf *)k;
-    uint64_t key = p->query_start + p->query_end + p->target_start + p->target_end;
-    // Use the hash from <https://stackoverflow.com/a/12996028>
-    // We can't just -ull these until C++11, if we're in C++
-    key = (key ^ (key >> 30)) * UINT64_C(0xbf58476d1ce4e5b9);
-    key = (key ^ (key >> 27)) * UINT64_C(0x94d049bb133111eb);
-    return key ^ (key >> 31);
+static void log_duplicate(Paf *paf) {
+    if(st_getLogLevel() >= debug) { // If debug output report info on dupe
+        char *paf_string = paf_print(paf);
+        st_logDebug("Got duplicate paf: %s\n", paf_string);
+        free(paf_string);
+    }
+}
+
+/*
+ * Writes the records whose fingerprints have not been seen before.
+ */
+static void dedupe(FILE *input, FILE *output, bool check_inverse) {
+    FingerprintSet *fingerprints = fingerprintSet_construct();
+    Paf *paf;
+    int64_t paf_buffer_length = 100;
+    char *paf_buffer = st_malloc(sizeof(char) * paf_buffer_length);
+    while((paf = paf_read_with_buffer(input, 0, &paf_buffer, &paf_buffer_length)) != NULL) {
+        // If checking for inverses a paf and its inverse have the same canonical fingerprint
+        if(fingerprintSet_add(fingerprints, fingerprintSet_get_fingerprint(fingerprints, paf, check_inverse))) {
+            paf_write_with_buffer(paf, output, &paf_buffer, &paf_buffer_length); // Write the paf to the output
+        }
+        else {
+            log_duplicate(paf);
+        }
+        paf_destruct(paf);
+    }
+    free(paf_buffer);
+    fingerprintSet_destruct(fingerprints);
+}
+
+/*
+ * Removes exact duplicates as dedupe, then the alignments contained in better alignments on the same diagonals.
+ */
+static void dedupe_contained(FILE *input, FILE *output, bool check_inverse, int64_t diagonal_slack) {
+    FingerprintSet *fingerprints = fingerprintSet_construct();
+    stList *pafs = stList_construct3(0, (void (*)(void *))paf_destruct);
+    Paf *paf;
+    int64_t paf_buffer_length = 100;
+    char *paf_buffer = st_malloc(sizeof(char) * paf_buffer_length);
+    while((paf = paf_read_with_buffer(input, 1, &paf_buffer, &paf_buffer_length)) != NULL) {
+        if(fingerprintSet_add(fingerprints, fingerprintSet_get_fingerprint(fingerprints, paf, check_inverse))) {
+            stList_append(pafs, paf);
+        }
+        else {
+            log_duplicate(paf);
+            paf_destruct(paf);
+        }
+    }
+    fingerprintSet_destruct(fingerprints);
+    int64_t removed = remove_contained_pafs(pafs, diagonal_slack);
+    st_logInfo("Removed %" PRIi64 " contained alignments, leaving %" PRIi64 "\n", removed, stList_length(pafs));
+    for(int64_t i=0; i<stList_length(pafs); i++) {
+        paf_write_with_buffer(stList_get(pafs, i), output, &paf_buffer, &paf_buffer_length);
+    }
+    free(paf_buffer);
+    stList_destruct(pafs);
+}
+
+#define SORTED_WINDOW_SCAN_LENGTH 16 // Windows up to this size are searched linearly
+
+/*
+ * As dedupe, but for input sorted by query name and start, keeping only the fingerprints of the window of records
+ * with the current query name and start. Small windows, the usual case, are held in an array and searched linearly;
+ * larger windows also use a fingerprint set, which is rebuilt for each large window.
+ */
+static void dedupe_sorted(FILE *input, FILE *output) {
+    FingerprintSet *names = fingerprintSet_construct(); // Only used to number the sequence names
+    FingerprintSet *window_set = NULL; // The fingerprints of a large window
+    PafFingerprint window[SORTED_WINDOW_SCAN_LENGTH];
+    int64_t window_length = 0, window_start = -1;
+    char *window_name = NULL;
+    stHash *finished_names = stHash_construct3(stHash_stringKey, stHash_stringEqualKey, free, NULL); // To check the order
+    Paf *paf;
+    int64_t paf_buffer_length = 100;
+    char *paf_buffer = st_malloc(sizeof(char) * paf_buffer_length);
+    while((paf = paf_read_with_buffer(input, 0, &paf_buffer, &paf_buffer_length)) != NULL) {
+        if(window_name == NULL || strcmp(window_name, paf->query_name) != 0 || window_start != paf->query_start) {
+            // Start a new window, checking the input is sorted
+            if(window_name == NULL || strcmp(window_name, paf->query_name) != 0) {
+                if(stHash_search(finished_names, paf->query_name) != NULL) {
+                    st_errAbort("Input is not sorted by query name: %s\n", paf->query_name);
+                }
+                if(window_name != NULL) {
+                    stHash_insert(finished_names, window_name, window_name);
+                }
+                window_name = stString_copy(paf->query_name);
+            }
+            else if(paf->query_start < window_start) {
+                st_errAbort("Input is not sorted by query start: %s %" PRIi64 "\n", paf->query_name, paf->query_start);
+            }
+            window_start = paf->query_start;
+            window_length = 0;
+            if(window_set != NULL) {
+                fingerprintSet_destruct(window_set);
+                window_set = NULL;
+            }
+        }
+        PafFingerprint fingerprint = fingerprintSet_get_fingerprint(names, paf, 0);
+        bool is_new = 1;
+        for(int64_t i=0; i<window_length; i++) {
+            if(window[i].hi == fingerprint.hi && window[i].lo == fingerprint.lo) {
+                is_new = 0;
+                break;
+            }
+        }
+        if(is_new) {
+            if(window_length < SORTED_WINDOW_SCAN_LENGTH) {
+                window[window_length++] = fingerprint;
+            }
+            else {
+                if(window_set == NULL) {
+                    window_set = fingerprintSet_construct();
+                }
+                is_new = fingerprintSet_add(window_set, fingerprint);
+            }
+        }
+        if(is_new) {
+            paf_write_with_buffer(paf, output, &paf_buffer, &paf_buffer_length);
+        }
+        else {
+            log_duplicate(paf);
+        }
+        paf_destruct(paf);
+    }
+    free(paf_buffer);
+    free(window_name);
+    stHash_destruct(finished_names);
+    if(window_set != NULL) {
+        fingerprintSet_destruct(window_set);
+    }
+    fingerprintSet_destruct(names);
+}
+
+/*
+ * Partitioned dedupe, for input too large to deduplicate in memory. Records are spilled to shard files as their
+ * sequence number in the input and fingerprint followed by the record's line. Shards are hash partitioned by
+ * fingerprint, so all the duplicates of a record are in the same shard, and are deduplicated independently, in
+ * parallel. The records kept from each shard are then merged back into input order by their sequence numbers.
+ */
+
+#define SHARD_RECORD_BYTES_IN_MEMORY 48 // Upper bound on the memory per record to deduplicate a shard, the slots of a
+// fingerprint set kept at most three quarters and at least three eighths full
+#define SHARD_SPLIT_MAX_DEPTH 4 // Limits how many times an oversized shard is split
+#define SHARD_SPLIT_MAX_FAN_OUT 256 // Limits the parts a shard is split into at once, so the split files open together
+// stay well within the open file limit. Parts still over the memory budget are split again at the next depth
+
+typedef struct _shardRecord {
+    int64_t sequence_number;
+    PafFingerprint fingerprint;
+    char *line; // The paf line, including its newline
+    size_t line_capacity;
+    ssize_t line_length;
+} ShardRecord;
+
+static void write_shard_record_header(FILE *fh, int64_t sequence_number, PafFingerprint fingerprint) {
+    if(fwrite(&sequence_number, sizeof(int64_t), 1, fh) != 1 || fwrite(&fingerprint, sizeof(PafFingerprint), 1, fh) != 1) {
+        st_errAbort("Failed to write dedupe shard\n");
+    }
+}
+
+static void write_shard_record(FILE *fh, ShardRecord *record) {
+    write_shard_record_header(fh, record->sequence_number, record->fingerprint);
+    if(fwrite(record->line, 1, record->line_length, fh) != record->line_length) {
+        st_errAbort("Failed to write dedupe shard\n");
+    }
+}
+
+/*
+ * Reads the next record of a shard, returning zero at the end of the shard.
+ */
+static bool read_shard_record(FILE *fh, ShardRecord *record) {
+    if(fread(&record->sequence_number, sizeof(int64_t), 1, fh) != 1) {
+        return 0;
+    }
+    if(fread(&record->fingerprint, sizeof(PafFingerprint), 1, fh) != 1 ||
+       (record->line_length = getline(&record->line, &record->line_capacity, fh)) <= 0) {
+        st_errAbort("Dedupe shard is truncated\n");
+    }
+    return 1;
+}
+
+static char *get_shard_file(char *temp_dir, char *prefix, int64_t shard) {
+    return stString_print("%s/%s_%" PRIi64 "", temp_dir, prefix, shard);
+}
+
+static FILE *open_shard(char *shard_file, char *mode) {
+    FILE *fh = fopen(shard_file, mode);
+    if(fh == NULL) {
+        st_errAbort("Could not open dedupe shard: %s\n", shard_file);
+    }
+    return fh;
 }
 
-static int paf_equal_key(const void *k, const void *k2) {
-    Paf *p = (Paf *)k, *p2 = (Paf *)k2;
-    return strcmp(p->query_name, p2->query_name) == 0
-            && strcmp(p->target_name, p2->target_name) == 0
-            && p->same_strand == p2->same_strand
-            && p->target_start == p2->target_start
-            && p->target_end == p2->target_end
-            && p->query_start == p2->query_start
-            && p->query_end == p2->query_end; // Pafs are equal if they have the same query and target coordinates.
+/*
+ * Merges shards of kept records, each in input order, into input order, writing either the records' lines, or, if
+ * keep_headers is non-zero, the records with their headers, so the output is itself a shard. Removes the shards.
+ */
+static void merge_shards(char *temp_dir, char *prefix, int64_t shard_number, FILE *output, bool keep_headers) {
+    FILE **shards = st_malloc(shard_number * sizeof(FILE *));
+    ShardRecord *records = st_calloc(shard_number, sizeof(ShardRecord));
+    bool *has_record = st_calloc(shard_number, sizeof(bool));
+    for(int64_t i=0; i<shard_number; i++) {
+        char *shard_file = get_shard_file(temp_dir, prefix, i);
+        shards[i] = open_shard(shard_file, "r");
+        remove(shard_file); // The open file remains readable
+        free(shard_file);
+        has_record[i] = read_shard_record(shards[i], &records[i]);
+    }
+    while(1) { // Repeatedly write the record with the smallest sequence number. The number of shards is small, so
+        // they are scanned rather than kept in a heap
+        int64_t j = -1;
+        for(int64_t i=0; i<shard_number; i++) {
+            if(has_record[i] && (j == -1 || records[i].sequence_number < records[j].sequence_number)) {
+                j = i;
+            }
+        }
+        if(j == -1) {
+            break;
+        }
+        if(keep_headers) {
+            write_shard_record(output, &records[j]);
+        }
+        else if(fwrite(records[j].line, 1, records[j].line_length, output) != records[j].line_length) {
+            st_errAbort("Failed to write output\n");
+        }
+        has_record[j] = read_shard_record(shards[j], &records[j]);
+    }
+    for(int64_t i=0; i<shard_number; i++) {
+        fclose(shards[i]);
+        free(records[i].line);
+    }
+    free(shards);
+    free(records);
+    free(has_record);
+}
+
+/*
+ * Writes the first record of each fingerprint in a shard to the kept file, splitting the shard and deduplicating
+ * the parts in turn if it has too many records to deduplicate within the memory budget.
+ */
+static void dedupe_shard(char *temp_dir, char *shard_file, int64_t record_number, char *kept_file,
+                         int64_t memory_budget, int64_t depth) {
+    FILE *shard = open_shard(shard_file, "r");
+    FILE *kept = open_shard(kept_file, "w");
+    ShardRecord record = { 0 };
+    int64_t split_number = (record_number * SHARD_RECORD_BYTES_IN_MEMORY + memory_budget - 1) / memory_budget;
+    if(split_number <= 1 || depth >= SHARD_SPLIT_MAX_DEPTH) {
+        if(split_number > 1) {
+            st_logInfo("Dedupe shard %s with %" PRIi64 " records exceeds the memory budget\n", shard_file,
+                       record_number);
+        }
+        FingerprintSet *fingerprints = fingerprintSet_construct();
+        while(read_shard_record(shard, &record)) {
+            if(fingerprintSet_add(fingerprints, record.fingerprint)) {
+                write_shard_record(kept, &record);
+            }
+        }
+        fingerprintSet_destruct(fingerprints);
+    }
+    else { // Split the shard by a different part of the fingerprint than was used to make it
+        split_number++; // As the split is not perfectly even
+        if(split_number > SHARD_SPLIT_MAX_FAN_OUT) {
+            split_number = SHARD_SPLIT_MAX_FAN_OUT;
+        }
+        char *prefix = stString_print("%s_split", strrchr(shard_file, '/') + 1);
+        FILE **splits = st_malloc(split_number * sizeof(FILE *));
+        int64_t *split_record_numbers = st_calloc(split_number, sizeof(int64_t));
+        for(int64_t i=0; i<split_number; i++) {
+            char *split_file = get_shard_file(temp_dir, prefix, i);
+            splits[i] = open_shard(split_file, "w");
+            free(split_file);
+        }
+        while(read_shard_record(shard, &record)) {
+            int64_t i = (record.fingerprint.lo >> (16 * depth)) % split_number;
+            write_shard_record(splits[i], &record);
+            split_record_numbers[i]++;
+        }
+        for(int64_t i=0; i<split_number; i++) {
+            fclose(splits[i]);
+            char *split_file = get_shard_file(temp_dir, prefix, i);
+            char *split_kept_file = stString_print("%s_kept", split_file);
+            dedupe_shard(temp_dir, split_file, split_record_numbers[i], split_kept_file, memory_budget, depth + 1);
+            remove(split_file);
+            rename(split_kept_file, split_file); // So merge_shards finds the kept records by the split's name
+            free(split_file);
+            free(split_kept_file);
+        }
+        merge_shards(temp_dir, prefix, split_number, kept, 1);
+        free(prefix);
+        free(splits);
+        free(split_record_numbers);
+    }
+    free(record.line);
+    fclose(shard);
+    fclose(kept);
+}
+
+static void dedupe_partitioned(FILE *input, FILE *output, bool check_inverse, int64_t shard_number,
+                               int64_t memory_budget, char *temp_dir) {
+    char *dir_template = stString_print("%s/paffy_dedupe_XXXXXX", temp_dir);
+    char *dir = mkdtemp(dir_template);
+    if(dir == NULL) {
+        st_errAbort("Could not create a temporary directory in: %s\n", temp_dir);
+    }
+
+    // Spill the records to the shards
+    FingerprintSet *names = fingerprintSet_construct(); // Only used to number the sequence names
+    FILE **shards = st_malloc(shard_number * sizeof(FILE *));
+    int64_t *shard_record_numbers = st_calloc(shard_number, sizeof(int64_t));
+    for(int64_t i=0; i<shard_number; i++) {
+        char *shard_file = get_shard_file(dir, "shard", i);
+        shards[i] = open_shard(shard_file, "w");
+        free(shard_file);
+    }
+    Paf *paf;
+    int64_t paf_buffer_length = 100, sequence_number = 0;
+    char *paf_buffer = st_malloc(sizeof(char) * paf_buffer_length);
+    while((paf = paf_read_with_buffer(input, 0, &paf_buffer, &paf_buffer_length)) != NULL) {
+        PafFingerprint fingerprint = fingerprintSet_get_fingerprint(names, paf, check_inverse);
+        int64_t i = fingerprint.hi % shard_number;
+        write_shard_record_header(shards[i], sequence_number++, fingerprint);
+        paf_write_with_buffer(paf, shards[i], &paf_buffer, &paf_buffer_length);
+        shard_record_numbers[i]++;
+        paf_destruct(paf);
+    }
+    free(paf_buffer);
+    fingerprintSet_destruct(names);
+    for(int64_t i=0; i<shard_number; i++) {
+        fclose(shards[i]);
+    }
+    st_logInfo("Spilled %" PRIi64 " records to %" PRIi64 " shards\n", sequence_number, shard_number);
+
+    // Deduplicate the shards in parallel, each thread getting an equal part of the memory budget
+    int64_t thread_memory_budget = memory_budget / omp_get_max_threads();
+    if(thread_memory_budget < 1) {
+        thread_memory_budget = 1;
+    }
+    #pragma omp parallel for schedule(dynamic)
+    for(int64_t i=0; i<shard_number; i++) {
+        char *shard_file = get_shard_file(dir, "shard", i);
+        char *kept_file = get_shard_file(dir, "kept", i);
+        dedupe_shard(dir, shard_file, shard_record_numbers[i], kept_file, thread_memory_budget, 0);
+        remove(shard_file);
+        free(shard_file);
+        free(kept_file);
+    }
+
+    // Merge the kept records back into input order
+    merge_shards(dir, "kept", shard_number, output, 0);
+    if(rmdir(dir) != 0) {
+        st_logInfo("Could not remove temporary directory: %s\n", dir);
+    }
+    free(dir_template);
+    free(shards);
+    free(shard_record_numbers);
 }
 
 int paffy_dedupe_main(int argc, char *argv[]) {
@@ -55,6 +414,13 @@ int paffy_dedupe_main(int argc, char *argv[]) {
     char *inputFile = NULL;
     char *outputFile = NULL;
     bool check_inverse=0;
+    bool sorted=0;
+    bool contained=0;
+    int64_t diagonal_slack = 0;
+    int64_t shard_number = -1;
+    int64_t memory_budget = -1;
+    char *temp_dir = "/tmp";
+    int64_t threads = 0;
 
     ///////////////////////////////////////////////////////////////////////////
     // Parse the inputs
@@ -64,12 +430,19 @@ int paffy_dedupe_main(int argc, char *argv[]) {
         static struct option long_options[] = { { "logLevel", required_argument, 0, 'l' },
                                                 { "inputFile", required_argument, 0, 'i' },
                                                 { "outputFile", required_argument, 0, 'o' },
-                                                { "checkInverse", required_argument, 0, 'a' },
+                                                { "checkInverse", no_argument, 0, 'a' },
+                                                { "sorted", no_argument, 0, 's' },
+                                                { "contained", no_argument, 0, 'c' },
+                                                { "diagonalSlack", required_argument, 0, 'g' },
+                                                { "partitions", required_argument, 0, 'p' },
+                                                { "memoryBudget", required_argument, 0, 'm' },
+                                                { "tempDir", required_argument, 0, 'd' },
+                                                { "threads", required_argument, 0, 'T' },
                                                 { "help", no_argument, 0, 'h' },
                                                 { 0, 0, 0, 0 } };
 
         int option_index = 0;
-        int64_t key = getopt_long(argc, argv, "l:i:o:ha", long_options, &option_index);
+        int64_t key = getopt_long(argc, argv, "l:i:o:hascg:p:m:d:T:", long_options, &option_index);
         if (key == -1) {
             break;
         }
@@ -87,6 +460,36 @@ int paffy_dedupe_main(int argc, char *argv[]) {
             case 'a':
                 check_inverse = 1;
                 break;
+            case 's':
+                sorted = 1;
+                break;
+            case 'c':
+                contained = 1;
+                break;
+            case 'g':
+                diagonal_slack = atol(optarg);
+                break;
+            case 'p':
+                shard_number = atol(optarg);
+                break;
+            case 'm': {
+                char *suffix;
+                memory_budget = strtoll(optarg, &suffix, 10);
+                if(*suffix != '\0') {
+                    int64_t i = strchr("KMG", toupper(*suffix)) != NULL ? strchr("KMG", toupper(*suffix)) - "KMG" : -1;
+                    if(i == -1 || suffix[1] != '\0') {
+                        st_errAbort("Invalid memory budget: %s\n", optarg);
+                    }
+                    memory_budget <<= 10 * (i + 1);
+                }
+                break;
+            }
+            case 'd':
+                temp_dir = optarg;
+                break;
+            case 'T':
+                threads = atol(optarg);
+                break;
             case 'h':
                 usage();
                 return 0;
@@ -103,6 +506,31 @@ int paffy_dedupe_main(int argc, char *argv[]) {
     st_setLogLevelFromString(logLevelString);
     st_logInfo("Input file string : %s\n", inputFile);
     st_logInfo("Output file string : %s\n", outputFile);
+    st_logInfo("Check inverse : %s, sorted : %s\n", check_inverse ? "True" : "False", sorted ? "True" : "False");
+    st_logInfo("Contained : %s, diagonal slack : %" PRIi64 "\n", contained ? "True" : "False", diagonal_slack);
+    st_logInfo("Partitions : %" PRIi64 ", memory budget : %" PRIi64 ", temp dir : %s, threads : %" PRIi64 "\n",
+               shard_number, memory_budget, temp_dir, threads);
+
+    if(sorted && check_inverse) { // The inverse of a record is not near it in the sorted order
+        st_errAbort("--checkInverse can not be used with --sorted\n");
+    }
+    bool partitioned = shard_number != -1 || memory_budget != -1;
+    if(contained && (sorted || partitioned)) {
+        st_errAbort("--contained can not be used with --sorted or --partitions\n");
+    }
+    if(partitioned) {
+        if(sorted) {
+            st_errAbort("--partitions can not be used with --sorted\n");
+        }
+        shard_number = shard_number == -1 ? 64 : shard_number;
+        memory_budget = memory_budget == -1 ? ((int64_t)1) << 30 : memory_budget;
+        if(shard_number < 1 || memory_budget < 1) {
+            st_errAbort("The number of partitions and memory budget must be positive\n");
+        }
+    }
+    if(threads > 0) {
+        omp_set_num_threads(threads);
+    }
 
     //////////////////////////////////////////////
     // Remove duplicate paf records
@@ -110,52 +538,29 @@ int paffy_dedupe_main(int argc, char *argv[]) {
 
     FILE *input = inputFile == NULL ? stdin : fopen(inputFile, "r");
     FILE *output = outputFile == NULL ? stdout : fopen(outputFile, "w");
-    stHash *pafs = stHash_construct3(paf_hash_key, paf_equal_key, NULL, (void (*)(void *))paf_destruct);
-    Paf *paf;
-    int64_t paf_buffer_length = 100;
-    char *paf_buffer = st_malloc(sizeof(char) * paf_buffer_length);
-    while((paf = paf_read_with_buffer(input, 0, &paf_buffer, &paf_buffer_length)) != NULL) {
-        // Get the query sequence
-        Paf *pPaf = stHash_search(pafs, paf);
-        if(check_inverse && pPaf == NULL) { // In case we want to check if we already output the inverse
-            paf_invert(paf); // Invert
-            pPaf = stHash_search(pafs, paf); // See if inverse is in there
-            paf_invert(paf); // Invert back
-            paf_check(paf); // Check is okay
-        }
-        if(pPaf == NULL) {  // If duplicate is not already in there
-            stHash_insert(pafs, paf, paf);  // Add the paf
-            paf_write_with_buffer(paf, output, &paf_buffer, &paf_buffer_length); // Write the paf to the output
-        }
-        else {
-            // If debug output report info on dupe
-            // Print the alignment levels
-            if(st_getLogLevel() >= debug) {
-                st_logDebug("Got duplicate pafs:\n");
-                char *paf_string = paf_print(paf);
-                char *paf_string_2 = paf_print(pPaf);
-                st_logDebug("\t\tdupe (1) - : %s\n", paf_string);
-                st_logDebug("\t\tdupe (2) - : %s\n", paf_string_2);
-                free(paf_string); free(paf_string_2);
-            }
-            paf_destruct(paf); // Just clean it up and don't output it
-        }
+    if(contained) {
+        dedupe_contained(input, output, check_inverse, diagonal_slack);
+    }
+    else if(partitioned) {
+        dedupe_partitioned(input, output, check_inverse, shard_number, memory_budget, temp_dir);
+    }
+    else if(sorted) {
+        dedupe_sorted(input, output);
+    }
+    else {
+        dedupe(input, output, check_inverse);
     }
 
     //////////////////////////////////////////////
     // Cleanup
     //////////////////////////////////////////////
 
-    free(paf_buffer);
-
     if(inputFile != NULL) {
         fclose(input);
     }
     if(outputFile != NULL) {
         fclose(output);
     }
-    stHash_destruct(pafs);
-
     st_logInfo("Paffy dedupe is done!, %" PRIi64 " seconds have elapsed\n", time(NULL) - startTime);
 
     //while(1);
@@ -18,6 +18,11 @@ static void usage(void) {
      fprintf(stderr, "-u --minIdentity : Filter alignments with an identity less than this, exclude indels\n");
      fprintf(stderr, "-v --minIdentityWithGaps : Filter alignments with an identity less than this, including indels\n");
      fprintf(stderr, "-w --maxTileLevel : Filter alignments with a tile level greater than this\n");
+     fprintf(stderr, "-d --maxDepth [INT] : Filter alignments whose median query coverage, counting all the input "
+                     "alignments, is greater than this, e.g. to remove repeat-saturated alignments before chaining. "
+                     "Reads the input twice, so input from stdin is held in memory\n");
+     fprintf(stderr, "-r --downSample : With --maxDepth, rather than filtering all alignments with a median query "
+                     "coverage, m, greater than the max depth keep a deterministic max-depth/m fraction of them\n");
      fprintf(stderr, "-x --invert : Only output alignments that don't pass filters\n");
      fprintf(stderr, "-l --logLevel : Set the log level\n");
      fprintf(stderr, "-h --help : Print this help message\n");
@@ -30,6 +35,8 @@ static void usage(void) {
      double min_identity = -1.0;
      double min_identity_with_gaps = -1.0;
      int64_t max_tile_level = -1;
+     int64_t max_depth = -1;
+     bool down_sample = 0;
      bool invert = 0;
 
      /*
@@ -52,12 +59,14 @@ static void usage(void) {
                                                  { "minIdentity", required_argument, 0, 'u' },
                                                  { "minIdentityWithGaps", required_argument, 0, 'v' },
                                                  { "maxTileLevel", required_argument, 0, 'w' },
+                                                 { "maxDepth", required_argument, 0, 'd' },
+                                                 { "downSample", no_argument, 0, 'r' },
                                                  { "invert", no_argument, 0, 'x' },
                                                  { "help", no_argument, 0, 'h' },
                                                  { 0, 0, 0, 0 } };
 
          int option_index = 0;
-         int64_t key = getopt_long(argc, argv, "l:i:o:s:t:u:v:w:xh", long_options, &option_index);
+         int64_t key = getopt_long(argc, argv, "l:i:o:s:t:u:v:w:d:rxh", long_options, &option_index);
          if (key == -1) {
              break;
          }
@@ -87,6 +96,15 @@ static void usage(void) {
              case 'w':
                  max_tile_level = atoi(optarg);
                  break;
+             case 'd':
+                 max_depth = atol(optarg);
+                 if(max_depth < 0) {
+                     st_errAbort("--maxDepth must not be negative\n");
+                 }
+                 break;
+             case 'r':
+                 down_sample = 1;
+                 break;
              case 'x':
                  invert = 1;
                  break;
@@ -109,6 +127,7 @@ static void usage(void) {
      st_logInfo("Filtering paf with min chain score:%" PRIi64 " min alignment score:%" PRIi64
                 " min identity:%f min identity with gaps:%f max tile level:%" PRIi64 " invert:%s\n", min_chain_score,
                 min_alignment_score, min_identity, min_identity_with_gaps, max_tile_level, invert ? "True" : "False");
+     st_logInfo("Filtering paf with max depth:%" PRIi64 " down sample:%s\n", max_depth, down_sample ? "True" : "False");
 
      //////////////////////////////////////////////
      // Filter the paf
@@ -120,7 +139,33 @@ static void usage(void) {
      Paf *paf;
      int64_t paf_buffer_length = 100;
      char *paf_buffer = st_malloc(sizeof(char) * paf_buffer_length);
-     while((paf = paf_read_with_buffer(input, 1, &paf_buffer, &paf_buffer_length)) != NULL) {
+
+     // If filtering by depth, first build the query coverage of all the alignments
+     stHash *seq_names_to_alignment_count_arrays = NULL;
+     stList *pafs = NULL; // The alignments, if they can not be read twice
+     int64_t paf_index = 0;
+     if(max_depth >= 0) {
+         seq_names_to_alignment_count_arrays = stHash_construct3(stHash_stringKey, stHash_stringEqualKey, NULL,
+                                                                 (void (*)(void *))sequenceCountArray_destruct);
+         if(inputFile == NULL) {
+             pafs = read_pafs(input, 1);
+             stList_setDestructor(pafs, NULL); // Each paf is destructed after being filtered
+         }
+         while((paf = pafs != NULL ? (paf_index < stList_length(pafs) ? stList_get(pafs, paf_index++) : NULL) :
+                      paf_read_with_buffer(input, 1, &paf_buffer, &paf_buffer_length)) != NULL) {
+             increase_alignment_level_counts(get_alignment_count_array(seq_names_to_alignment_count_arrays, paf), paf);
+             if(pafs == NULL) {
+                 paf_destruct(paf);
+             }
+         }
+         paf_index = 0;
+         if(pafs == NULL) {
+             rewind(input);
+         }
+     }
+
+     while((paf = pafs != NULL ? (paf_index < stList_length(pafs) ? stList_get(pafs, paf_index++) : NULL) :
+                  paf_read_with_buffer(input, 1, &paf_buffer, &paf_buffer_length)) != NULL) {
          // Calculate identity stats
          int64_t matches=0, mismatches=0, query_inserts=0, query_deletes=0,
                  query_insert_bases=0, query_delete_bases=0;
@@ -130,7 +175,9 @@ static void usage(void) {
          double identity_with_gaps = (float)matches / (matches + mismatches + query_insert_bases + query_delete_bases);
          if(paf->score >= min_alignment_score && paf->chain_score >= min_chain_score &&
             (max_tile_level == -1 || paf->tile_level <= max_tile_level) && identity >= min_identity &&
-            identity_with_gaps >= min_identity_with_gaps) {
+            identity_with_gaps >= min_identity_with_gaps &&
+            (max_depth < 0 || paf_passes_depth_filter(get_alignment_count_array(seq_names_to_alignment_count_arrays,
+                                                                                 paf), paf, max_depth, down_sample))) {
              if(invert) {
                  if(st_getLogLevel() == debug) {
                      st_logDebug("Filtering alignment with matches:%" PRIi64 ", identity: %f (%f with gaps), score: %" PRIi64
@@ -155,6 +202,12 @@ static void usage(void) {
          paf_destruct(paf);
      }
      free(paf_buffer);
+     if(seq_names_to_alignment_count_arrays != NULL) {
+         stHash_destruct(seq_names_to_alignment_count_arrays);
+     }
+     if(pafs != NULL) {
+         stList_destruct(pafs);
+     }
 
      //////////////////////////////////////////////
      // Cleanup
@@ -10,17 +10,43 @@
  * (4) Iterate through alignments, from best-to-worst, find maximum?? count, q, of aligned bases to a base covered by the alignment,
  * set the "level" of the alignment to q+1, increase by one the aligned bases count of each base covered by the alignment.
  * (5) Output local alignments file, adding the alignment level tag to each alignment, sorted by score from best-to-worst
+ *
+ * With --keyOnly step (1) loads only the scores and file offset of each record, step (2) sorts these keys and steps
+ * (4) and (5) read each record in turn from its offset, tile it and write it out.
  */
 
 #include "paf.h"
 #include <getopt.h>
 #include <time.h>
+#include <omp.h>
 
 static void usage(void) {
     fprintf(stderr, "paffy tile [options], version 0.1\n");
     fprintf(stderr, "Tiles the records in the PAF file along the query sequence\n");
     fprintf(stderr, "-i --inputFile : Input paf file. If not specified reads from stdin\n");
     fprintf(stderr, "-o --outputFile : Output paf file. If not specified outputs to stdout\n");
+    fprintf(stderr, "-y --symmetric : Treat each input record as both itself and its inversion (see paffy invert), "
+                    "outputting the tiled inversions too, without materializing the inverted records in memory\n");
+    fprintf(stderr, "-s --sparse : Track the coverage of each sequence as runs of equal coverage rather than with a count "
+                    "per base, so memory scales with the number of coverage changes rather than the sequence lengths\n");
+    fprintf(stderr, "-m --maxLevel [INT] : Only distinguish levels up to the given level, giving every alignment with a "
+                    "higher level the given level plus one. Bases covered by more than the given number of alignments "
+                    "are then saturated and are skipped when tiling further alignments, so repeats are tiled cheaply. "
+                    "Levels up to the given level are unchanged. A negative value distinguishes all levels (default:-1)\n");
+    fprintf(stderr, "-c --saveCoverage [FILE] : Save the coverage of each query sequence after tiling to the given file, "
+                    "so that tiling of further, lower scoring alignments can be resumed with --resume\n");
+    fprintf(stderr, "-r --resume [FILE] : Start from the coverage saved to the given file by --saveCoverage, assigning "
+                    "levels to the input alignments as if they had been tiled after the alignments already tiled. The "
+                    "input alignments should score no higher than those already tiled. The file is memory mapped, so "
+                    "only the coverage of the query sequences of the input alignments is loaded. The file may also be "
+                    "the one the coverage is saved to\n");
+    fprintf(stderr, "-k --keyOnly : Load only the scores and file offset of each record, then read the records one at a "
+                    "time in score order from the input file to tile and output them, so memory does not scale with "
+                    "the size of the records. Requires a seekable --inputFile and tiles with one thread. Records with "
+                    "equal scores are tiled in input order, as they are without --keyOnly\n");
+    fprintf(stderr, "-T --threads [INT] : The number of threads to tile with. Alignments to different query sequences, "
+                    "or with non-overlapping query intervals, are tiled concurrently, with output identical to using one "
+                    "thread. A non-positive value uses the OpenMP default (default:0)\n");
     fprintf(stderr, "-l --logLevel : Set the log level\n");
     fprintf(stderr, "-h --help : Print this help message\n");
 }
@@ -33,41 +59,53 @@ static int paf_cmp_by_descending_score(const void *a, const void *b) {
                                                      (p1->score < p2->score ? 1 : 0)));
 }
 
-static int64_t get_median_alignment_level(uint16_t *counts, Paf *paf) {
-    // Pre-scan to find the actual max level so we allocate only what we need
-    uint16_t max_level = 0;
-    for(int64_t k = paf->query_start; k < paf->query_end; k++) {
-        if(counts[k] > max_level) max_level = counts[k];
+/*
+ * A paf and its position in the input, used to break ties in score, so the order the pafs are tiled in does not depend
+ * on the sort algorithm.
+ */
+typedef struct _indexedPaf {
+    Paf *paf;
+    int64_t index;
+} IndexedPaf;
+
+static int indexed_paf_cmp(const void *a, const void *b) {
+    IndexedPaf *p1 = (IndexedPaf *)a, *p2 = (IndexedPaf *)b;
+    int i = paf_cmp_by_descending_score(p1->paf, p2->paf);
+    return i != 0 ? i : (p1->index < p2->index ? -1 : (p1->index > p2->index ? 1 : 0));
+}
+
+/*
+ * Sorts the pafs by descending score, breaking ties by input order. If symmetric the second half of the list are the
+ * inversions of the first, each of which is ordered directly after the paf it inverts, as in tile_key_cmp.
+ */
+static void sort_pafs_by_descending_score(stList *pafs, bool symmetric) {
+    int64_t paf_number = stList_length(pafs), record_number = symmetric ? paf_number / 2 : paf_number;
+    IndexedPaf *indexed_pafs = st_malloc(paf_number * sizeof(IndexedPaf));
+    for(int64_t i=0; i<paf_number; i++) {
+        indexed_pafs[i].paf = stList_get(pafs, i);
+        indexed_pafs[i].index = !symmetric ? i : (i < record_number ? 2 * i : 2 * (i - record_number) + 1);
     }
-    int64_t *level_counts = st_calloc((int64_t)max_level + 2, sizeof(int64_t)); // An array of counts of the number of bases with the given alignment level
-    // such that level_counts[i] is the number of bases in the query with level_counts[i] number of alignments to it (at this point in the tiling)
-    int64_t i = paf->query_start, matches=0;
-    for(int64_t ci = 0; ci < cigar_count(paf->cigar); ci++) {
-        CigarRecord *c = cigar_get(paf->cigar, ci);
-        if(c->op != query_delete) {
-            if(c->op != query_insert) { // is a match or mismatch, but not an insert in the query
-                assert(c->op == match || c->op == sequence_match || c->op == sequence_mismatch);
-                for(int64_t j=0; j<c->length; j++) {
-                    assert(i + j < paf->query_end && i + j >= 0 && i + j < paf->query_length);
-                    assert(counts[i + j] < UINT16_MAX); // paranoid check
-                    level_counts[counts[i + j]]++;
-                    matches++;
-                }
-            }
-            i += c->length;
-        }
+    qsort(indexed_pafs, paf_number, sizeof(IndexedPaf), indexed_paf_cmp);
+    for(int64_t i=0; i<paf_number; i++) {
+        stList_set(pafs, i, indexed_pafs[i].paf);
     }
-    assert(i == paf->query_end);
+    free(indexed_pafs);
+}
 
+/*
+ * Gets the median alignment level of the matches of an alignment, given level_counts, an array of counts of the
+ * number of bases with the given alignment level, such that level_counts[i] is the number of matched bases in the
+ * query with i alignments to it (at this point in the tiling).
+ */
+static int64_t get_median_level(int64_t *level_counts, int64_t max_level, int64_t matches, Paf *paf) {
     if(matches == 0) { // avoid divide by zero
-        free(level_counts);
         return INT16_MAX;
     }
 
     // Print the alignment levels
     if(st_getLogLevel() >= debug) {
         st_logDebug("Got alignment levels: ");
-        for (i = 0; i <= max_level; i++) {
+        for (int64_t i = 0; i <= max_level; i++) {
             st_logDebug("%"
             PRIi64
             ":%f ", i, ((float)level_counts[i])/matches);
@@ -79,19 +117,370 @@ static int64_t get_median_alignment_level(uint16_t *counts, Paf *paf) {
 
     // Calc the median from the level_counts array
     int64_t j=0;
-    for(i=0; i<=max_level; i++) {
+    for(int64_t i=0; i<=max_level; i++) {
         j += level_counts[i];
         if(j >= matches/2.0) {
-            free(level_counts);
             assert(i > 0);
             return i;
         }
     }
     assert(0); // This should be unreachable.
-    free(level_counts);
     return INT16_MAX;
 }
 
+/*
+ * Increases the counts of the bases in [start, end) as increase_alignment_level_counts_in_range, saturating them at
+ * saturation_count. If the count array has a saturation bitmap then 64 base words of the bitmap that are entirely
+ * saturated are skipped, adding their bases straight to the histogram, and the bits of bases that become saturated
+ * are set. The bitmap may be shared with concurrent tiling of other bases of the sequence, so is accessed atomically.
+ */
+static void increase_counts_with_saturation(SequenceCountArray *seq_count_array, int64_t start, int64_t end,
+                                            int64_t saturation_count, int64_t *level_counts, int64_t *max_level,
+                                            int64_t *saturated_bases) {
+    if(seq_count_array->saturated == NULL) {
+        increase_alignment_level_counts_in_range(seq_count_array, start, end, saturation_count, level_counts, max_level);
+        return;
+    }
+    while(start < end) {
+        uint64_t *word = &seq_count_array->saturated[start / 64], bits;
+        int64_t word_end = (start / 64 + 1) * 64 < end ? (start / 64 + 1) * 64 : end;
+        #pragma omp atomic read
+        bits = *word;
+        if(bits == UINT64_MAX) { // All saturated, so their counts can not change
+            level_counts[saturation_count] += word_end - start;
+            *max_level = saturation_count;
+            *saturated_bases += word_end - start;
+        }
+        else {
+            int64_t word_max_level = 0;
+            increase_alignment_level_counts_in_range(seq_count_array, start, word_end, saturation_count, level_counts,
+                                                     &word_max_level);
+            if(word_max_level > *max_level) {
+                *max_level = word_max_level;
+            }
+            if(word_max_level == saturation_count) { // Some bases may have become saturated
+                uint64_t new_bits = 0;
+                for(int64_t j=start; j<word_end; j++) {
+                    if(seq_count_array->counts[j] == saturation_count) {
+                        new_bits |= ((uint64_t)1) << (j % 64);
+                    }
+                }
+                #pragma omp atomic
+                *word |= new_bits;
+            }
+        }
+        start = word_end;
+    }
+}
+
+/*
+ * Increases the counts of the matched query bases of the interval [start, end) of offsets along the cigar string of
+ * an alignment, see tile_alignment.
+ */
+static void increase_alignment_range(SequenceCountArray *seq_count_array, Paf *paf, bool reversed, int64_t start,
+                                     int64_t end, int64_t saturation_count, int64_t *level_counts, int64_t *max_level,
+                                     int64_t *saturated_bases) {
+    if(reversed) { // The cigar string runs from the query end
+        increase_counts_with_saturation(seq_count_array, paf->query_end - end, paf->query_end - start,
+                                        saturation_count, level_counts, max_level, saturated_bases);
+    }
+    else {
+        increase_counts_with_saturation(seq_count_array, paf->query_start + start, paf->query_start + end,
+                                        saturation_count, level_counts, max_level, saturated_bases);
+    }
+}
+
+/*
+ * Increases the counts of the matched query bases of an alignment and gets its median alignment level, in one pass
+ * over its cigar string, without parsing it into a Cigar. If inverted the alignment is the inversion of the paf the
+ * cigar string belongs to, so its matched query bases are the matched target bases of that paf. If the inversion is
+ * of an opposite strand paf, paf_invert would reverse the cigar, so the offsets along the cigar string are mapped from
+ * the query end, placing the bases as tiling the materialized inversion would. Counts saturate at saturation_count,
+ * which is therefore the highest level returned. level_counts must have INT16_MAX entries, all zero, and is left that
+ * way.
+ */
+static int64_t tile_alignment(SequenceCountArray *seq_count_array, Paf *paf, char *cigar_string, bool inverted,
+                              int64_t saturation_count, int64_t *level_counts, int64_t *saturated_bases) {
+    char skipped_op = inverted ? 'D' : 'I'; // The operation that moves along the query without matching it
+    bool reversed = inverted && !paf->same_strand;
+    int64_t i = 0, range_start = 0, matches = 0, max_level = 0; // [range_start, i) is the pending range of matched
+    // query bases, as offsets along the cigar string, as matches separated only by gaps in the other sequence are
+    // contiguous
+    for(char *s = cigar_string; s != NULL && *s != '\0'; s++) {
+        int64_t length = 0;
+        while(*s >= '0' && *s <= '9') {
+            length = length * 10 + (*s++ - '0');
+        }
+        if(*s == 'M' || *s == '=' || *s == 'X') {
+            i += length;
+            matches += length;
+        }
+        else if(*s == skipped_op) {
+            increase_alignment_range(seq_count_array, paf, reversed, range_start, i, saturation_count, level_counts,
+                                     &max_level, saturated_bases);
+            i += length;
+            range_start = i;
+        }
+        else if(*s != 'I' && *s != 'D') {
+            st_errAbort("Got an unexpected character paf cigar string: %c\n", *s);
+        }
+    }
+    increase_alignment_range(seq_count_array, paf, reversed, range_start, i, saturation_count, level_counts,
+                             &max_level, saturated_bases);
+    assert(cigar_string == NULL || i == paf->query_end - paf->query_start);
+
+    int64_t median_level = get_median_level(level_counts, max_level, matches, paf);
+    memset(level_counts, 0, (max_level + 1) * sizeof(int64_t));
+    return median_level;
+}
+
+/*
+ * As tile_alignment, but using a sparse coverage and the parsed cigar, working a run of equal coverage at a time.
+ */
+static int64_t get_median_alignment_level_sparse(SequenceCoverage *coverage, Paf *paf) {
+    int64_t max_level = sequenceCoverage_get_max(coverage, paf->query_start, paf->query_end);
+    int64_t *level_counts = st_calloc(max_level + 2, sizeof(int64_t));
+    int64_t i = paf->query_start, matches=0;
+    for(int64_t ci = 0; ci < cigar_count(paf->cigar); ci++) {
+        CigarRecord *c = cigar_get(paf->cigar, ci);
+        if(c->op != query_delete) {
+            if(c->op != query_insert) { // is a match or mismatch, but not an insert in the query
+                sequenceCoverage_histogram(coverage, i, i + c->length, level_counts);
+                matches += c->length;
+            }
+            i += c->length;
+        }
+    }
+    assert(i == paf->query_end);
+
+    int64_t median_level = get_median_level(level_counts, max_level, matches, paf);
+    free(level_counts);
+    return median_level;
+}
+
+/*
+ * Sets the tile level of a paf, updating the coverage of its query sequence. Levels above max_level, if it is not
+ * negative, are reported as max_level + 1.
+ */
+static void tile_paf(Paf *paf, stHash *seq_names_to_alignment_count_arrays, InvertedPafs *inverted_pafs, bool sparse,
+                     int64_t max_level, int64_t *level_counts, int64_t *saturated_bases) {
+    Paf *original_paf = inverted_pafs != NULL ? inverted_pafs_get_original(inverted_pafs, paf) : NULL;
+    if(sparse) {
+        assert(paf->cigar == NULL);
+        Paf p = *paf; // Work on a shallow copy, so the cigar is never set on the paf itself, which with threads may be
+        // concurrently read by the thread tiling its inversion
+        p.cigar = original_paf != NULL ? inverted_pafs_get_cigar(inverted_pafs, paf) :
+                  cigar_parse(paf->cigar_string); // Convert the cigar string to a list of operations just for the duration
+        // of this function
+        SequenceCoverage *coverage = stHash_search(seq_names_to_alignment_count_arrays, paf->query_name);
+        increase_alignment_coverage(coverage, &p);
+        paf->tile_level = get_median_alignment_level_sparse(coverage, &p); // Store the tile_level
+        if(max_level >= 0 && paf->tile_level > max_level + 1) {
+            paf->tile_level = max_level + 1;
+        }
+        cigar_destruct(p.cigar); // Clean up the memory hungry linked list
+    }
+    else { // Work straight from the cigar string, which for an inversion is that of the paf it inverts
+        SequenceCountArray *seq_count_array = stHash_search(seq_names_to_alignment_count_arrays, paf->query_name);
+        paf->tile_level = tile_alignment(seq_count_array, paf, original_paf != NULL ? original_paf->cigar_string :
+                                         paf->cigar_string, original_paf != NULL,
+                                         max_level >= 0 ? max_level + 1 : INT16_MAX - 1,
+                                         level_counts, saturated_bases); // Store the tile_level
+    }
+    assert(paf->tile_level > 0); // Tile levels should start at 1
+}
+
+/*
+ * Creates the coverage of the query sequence of a paf if it does not exist yet. If max_level is not negative a count
+ * array also gets a bitmap of its bases saturated at saturation_count, the bases of resumed counts that exceed it
+ * being saturated at it.
+ */
+static void create_coverage(stHash *seq_names_to_alignment_count_arrays, Paf *paf, bool sparse, int64_t max_level,
+                            int64_t saturation_count) {
+    if(sparse) {
+        get_alignment_coverage(seq_names_to_alignment_count_arrays, paf);
+        return;
+    }
+    SequenceCountArray *seq_count_array = get_alignment_count_array(seq_names_to_alignment_count_arrays, paf);
+    if(max_level >= 0 && seq_count_array->saturated == NULL) { // Track the saturated bases to skip them
+        seq_count_array->saturated = st_calloc((seq_count_array->length + 63) / 64, sizeof(uint64_t));
+        for(int64_t j=0; seq_count_array->mapped && j<seq_count_array->length; j++) { // Resumed counts may
+            // have been saturated at a higher count
+            if(seq_count_array->counts[j] >= saturation_count) {
+                if(seq_count_array->counts[j] > saturation_count) {
+                    seq_count_array->counts[j] = saturation_count;
+                }
+                seq_count_array->saturated[j / 64] |= ((uint64_t)1) << (j % 64);
+            }
+        }
+    }
+}
+
+/*
+ * The sort key of a record, used to tile without holding the records in memory.
+ */
+typedef struct _tileKey {
+    int64_t chain_score;
+    int64_t score;
+    int64_t record; // The byte offset of the record in the input times two, plus one if the key is of its inversion
+} TileKey;
+
+static int tile_key_cmp(const void *a, const void *b) {
+    TileKey *k1 = (TileKey *)a, *k2 = (TileKey *)b;
+    // As paf_cmp_by_descending_score, then by input order
+    return k1->chain_score > k2->chain_score ? -1 : (k1->chain_score < k2->chain_score ? 1 :
+           (k1->score > k2->score ? -1 : (k1->score < k2->score ? 1 :
+           (k1->record < k2->record ? -1 : (k1->record > k2->record ? 1 : 0)))));
+}
+
+/*
+ * Reads the keys of the records in the input file, two per record if symmetric, one for the record and one for its
+ * inversion, which has the same scores.
+ */
+static TileKey *read_tile_keys(FILE *input, bool symmetric, int64_t *key_number) {
+    int64_t capacity = 1024;
+    TileKey *keys = st_malloc(capacity * sizeof(TileKey));
+    *key_number = 0;
+    stHash *names = stHash_construct3(stHash_stringKey, stHash_stringEqualKey, free, NULL);
+    int64_t paf_buffer_length = 100;
+    char *paf_buffer = st_malloc(sizeof(char) * paf_buffer_length);
+    int64_t offset = ftello(input);
+    Paf *paf;
+    while((paf = paf_read_key_with_buffer(input, names, &paf_buffer, &paf_buffer_length)) != NULL) {
+        for(int64_t i=0; i<(symmetric ? 2 : 1); i++) {
+            if(*key_number >= capacity) {
+                capacity *= 2;
+                keys = realloc(keys, capacity * sizeof(TileKey));
+            }
+            TileKey *key = &keys[(*key_number)++];
+            key->chain_score = paf->chain_score;
+            key->score = paf->score;
+            key->record = offset * 2 + i;
+        }
+        free(paf);
+        offset = ftello(input);
+    }
+    free(paf_buffer);
+    stHash_destruct(names);
+    return keys;
+}
+
+/*
+ * Tiles the records of the input file in the order of the sorted keys, reading each from its offset and writing it
+ * with its tile level.
+ */
+static void tile_records_by_key(FILE *input, TileKey *keys, int64_t key_number,
+                                stHash *seq_names_to_alignment_count_arrays, bool sparse, int64_t max_level,
+                                int64_t saturation_count, FILE *output) {
+    int64_t *level_counts = sparse ? NULL : st_calloc(INT16_MAX, sizeof(int64_t));
+    int64_t saturated_bases = 0;
+    int64_t paf_buffer_length = 100;
+    char *paf_buffer = st_malloc(sizeof(char) * paf_buffer_length);
+    for(int64_t i=0; i<key_number; i++) {
+        if(fseeko(input, keys[i].record / 2, SEEK_SET) != 0) {
+            st_errAbort("Failed to seek in the input file\n");
+        }
+        Paf *paf = paf_read_with_buffer(input, 0, &paf_buffer, &paf_buffer_length);
+        if(paf == NULL) {
+            st_errAbort("The input file has changed since it was first read\n");
+        }
+        Paf inverted_paf = *paf; // The record's inversion, if tiling it, sharing the record's names and cigar
+        InvertedPafs inverted_pafs = { &paf, &inverted_paf, 1 };
+        Paf *tiled_paf = paf;
+        if(keys[i].record % 2 == 1) {
+            inverted_paf.cigar_string = NULL;
+            paf_invert(&inverted_paf);
+            tiled_paf = &inverted_paf;
+        }
+        create_coverage(seq_names_to_alignment_count_arrays, tiled_paf, sparse, max_level, saturation_count);
+        tile_paf(tiled_paf, seq_names_to_alignment_count_arrays, &inverted_pafs, sparse, max_level, level_counts,
+                 &saturated_bases);
+        inverted_pafs_write_with_buffer(&inverted_pafs, tiled_paf, output, &paf_buffer, &paf_buffer_length);
+        paf_destruct(paf);
+    }
+    if(max_level >= 0) {
+        st_logInfo("Skipped %" PRIi64 " saturated matched bases\n", saturated_bases);
+    }
+    free(paf_buffer);
+    free(level_counts);
+}
+
+/*
+ * The query interval of an alignment, used to find the connected components of overlapping alignments.
+ */
+typedef struct _queryInterval {
+    int64_t start;
+    int64_t end;
+    int64_t index; // Index of the alignment
+} QueryInterval;
+
+static int query_interval_cmp(const void *a, const void *b) {
+    int64_t i = ((QueryInterval *)a)->start, j = ((QueryInterval *)b)->start;
+    return i > j ? 1 : (i < j ? -1 : 0);
+}
+
+/*
+ * Splits the pafs, which are in tiling order, into units that can be tiled independently, each keeping the tiling
+ * order. Tiling a base only depends on the alignments covering it, so the alignments to each query sequence are a
+ * unit, which if split_components is true is further split into connected components of overlapping query intervals.
+ */
+static stList *get_tiling_units(stList *pafs, bool split_components) {
+    stList *units = stList_construct3(0, (void (*)(void *))stList_destruct);
+    stList *sequence_units = stList_construct(); // The pafs of each query sequence, in order of first appearance
+    stHash *seq_names_to_units = stHash_construct3(stHash_stringKey, stHash_stringEqualKey, NULL, NULL);
+    for(int64_t i=0; i<stList_length(pafs); i++) {
+        Paf *paf = stList_get(pafs, i);
+        stList *unit = stHash_search(seq_names_to_units, paf->query_name);
+        if(unit == NULL) {
+            unit = stList_construct();
+            stHash_insert(seq_names_to_units, paf->query_name, unit);
+            stList_append(sequence_units, unit);
+        }
+        stList_append(unit, paf);
+    }
+    stHash_destruct(seq_names_to_units);
+
+    for(int64_t i=0; i<stList_length(sequence_units); i++) {
+        stList *unit = stList_get(sequence_units, i);
+        if(!split_components) {
+            stList_append(units, unit);
+            continue;
+        }
+        // Sweep the query intervals in order of start, numbering the components of overlapping intervals
+        int64_t n = stList_length(unit);
+        QueryInterval *intervals = st_malloc(n * sizeof(QueryInterval));
+        for(int64_t j=0; j<n; j++) {
+            Paf *paf = stList_get(unit, j);
+            intervals[j].start = paf->query_start;
+            intervals[j].end = paf->query_end;
+            intervals[j].index = j;
+        }
+        qsort(intervals, n, sizeof(QueryInterval), query_interval_cmp);
+        int64_t *components = st_malloc(n * sizeof(int64_t));
+        int64_t component_number = 0, component_end = INT64_MIN;
+        for(int64_t j=0; j<n; j++) {
+            if(intervals[j].start >= component_end) { // Does not overlap the current component, so starts a new one
+                component_number++;
+            }
+            component_end = intervals[j].end > component_end ? intervals[j].end : component_end;
+            components[intervals[j].index] = component_number - 1;
+        }
+        // Split the unit, keeping the tiling order within each component
+        int64_t first_component = stList_length(units);
+        for(int64_t j=0; j<component_number; j++) {
+            stList_append(units, stList_construct());
+        }
+        for(int64_t j=0; j<n; j++) {
+            stList_append(stList_get(units, first_component + components[j]), stList_get(unit, j));
+        }
+        free(intervals);
+        free(components);
+        stList_destruct(unit);
+    }
+    stList_destruct(sequence_units);
+    return units;
+}
+
 int paffy_tile_main(int argc, char *argv[]) {
     time_t startTime = time(NULL);
 
@@ -101,6 +490,13 @@ int paffy_tile_main(int argc, char *argv[]) {
     char *logLevelString = NULL;
     char *inputFile = NULL;
     char *outputFile = NULL;
+    bool symmetric = 0;
+    bool sparse = 0;
+    int64_t threads = 0;
+    int64_t max_level = -1;
+    char *save_coverage_file = NULL;
+    char *resume_file = NULL;
+    bool key_only = 0;
 
     ///////////////////////////////////////////////////////////////////////////
     // Parse the inputs
@@ -110,11 +506,18 @@ int paffy_tile_main(int argc, char *argv[]) {
         static struct option long_options[] = { { "logLevel", required_argument, 0, 'l' },
                                                 { "inputFile", required_argument, 0, 'i' },
                                                 { "outputFile", required_argument, 0, 'o' },
+                                                { "symmetric", no_argument, 0, 'y' },
+                                                { "sparse", no_argument, 0, 's' },
+                                                { "maxLevel", required_argument, 0, 'm' },
+                                                { "saveCoverage", required_argument, 0, 'c' },
+                                                { "resume", required_argument, 0, 'r' },
+                                                { "keyOnly", no_argument, 0, 'k' },
+                                                { "threads", required_argument, 0, 'T' },
                                                 { "help", no_argument, 0, 'h' },
                                                 { 0, 0, 0, 0 } };
 
         int option_index = 0;
-        int64_t key = getopt_long(argc, argv, "l:i:o:h", long_options, &option_index);
+        int64_t key = getopt_long(argc, argv, "l:i:o:ysm:c:r:kT:h", long_options, &option_index);
         if (key == -1) {
             break;
         }
@@ -129,6 +532,27 @@ int paffy_tile_main(int argc, char *argv[]) {
             case 'o':
                 outputFile = optarg;
                 break;
+            case 'y':
+                symmetric = 1;
+                break;
+            case 's':
+                sparse = 1;
+                break;
+            case 'm':
+                max_level = atol(optarg);
+                break;
+            case 'c':
+                save_coverage_file = optarg;
+                break;
+            case 'r':
+                resume_file = optarg;
+                break;
+            case 'k':
+                key_only = 1;
+                break;
+            case 'T':
+                threads = atol(optarg);
+                break;
             case 'h':
                 usage();
                 return 0;
@@ -145,6 +569,23 @@ int paffy_tile_main(int argc, char *argv[]) {
     st_setLogLevelFromString(logLevelString);
     st_logInfo("Input file string : %s\n", inputFile);
     st_logInfo("Output file string : %s\n", outputFile);
+    st_logInfo("Symmetric : %s\n", symmetric ? "true" : "false");
+    st_logInfo("Sparse coverage : %s\n", sparse ? "true" : "false");
+    st_logInfo("Max level : %" PRIi64 "\n", max_level);
+    st_logInfo("Save coverage file : %s\n", save_coverage_file);
+    st_logInfo("Resume file : %s\n", resume_file);
+    st_logInfo("Tile keys only : %s\n", key_only ? "true" : "false");
+    st_logInfo("Threads : %" PRIi64 "\n", threads);
+    if(key_only && inputFile == NULL) {
+        st_errAbort("--keyOnly reads the input records in score order, so a seekable --inputFile must be given\n");
+    }
+    if(max_level >= INT16_MAX - 2) {
+        st_errAbort("The max level must be less than %i\n", INT16_MAX - 2);
+    }
+    if(sparse && (save_coverage_file != NULL || resume_file != NULL)) {
+        st_errAbort("Saving and resuming the coverage is not supported with sparse coverage\n");
+    }
+    int64_t saturation_count = max_level >= 0 ? max_level + 1 : INT16_MAX - 1; // The count the counts saturate at
 
     //////////////////////////////////////////////
     // Tile the paf records
@@ -153,36 +594,123 @@ int paffy_tile_main(int argc, char *argv[]) {
     FILE *input = inputFile == NULL ? stdin : fopen(inputFile, "r");
     FILE *output = outputFile == NULL ? stdout : fopen(outputFile, "w");
 
-    stList *pafs = read_pafs(input, 0); // Load local alignments files (PAF)
-    stList_sort(pafs, paf_cmp_by_descending_score); // Sort alignments by score, from best-to-worst
-
     // Create integer array representing counts of alignments to bases in the genome, setting values initially to 0.
     stHash *seq_names_to_alignment_count_arrays = stHash_construct3(stHash_stringKey, stHash_stringEqualKey,
-                                                                    NULL, (void (*)(void *))sequenceCountArray_destruct);
+                                                                    NULL, sparse ? (void (*)(void *))sequenceCoverage_destruct :
+                                                                                   (void (*)(void *))sequenceCountArray_destruct);
 
-    // For each alignment: set the "level" of the alignment to q+1, increase by one the aligned bases count of each base covered by the alignment.
-    for(int64_t i=0; i<stList_length(pafs); i++) {
-        Paf *paf = stList_get(pafs, i);
-        assert(paf->cigar == NULL);
-        paf->cigar = cigar_parse(paf->cigar_string); // Convert the cigar string to a list of operations just for the duration
-        // of this loop
-        SequenceCountArray *seq_count_array = get_alignment_count_array(seq_names_to_alignment_count_arrays, paf);
-        increase_alignment_level_counts(seq_count_array, paf);
-        paf->tile_level = get_median_alignment_level(seq_count_array->counts, paf); // Store the tile_level
-        assert(paf->tile_level > 0); // Tile levels should start at 1
-        cigar_destruct(paf->cigar); // Clean up the memory hungry linked list
-        paf->cigar = NULL;
+    // Load the coverage of the alignments already tiled
+    CountArraysFile *count_arrays_file = NULL;
+    if(resume_file != NULL) {
+        count_arrays_file = read_alignment_count_arrays(resume_file, seq_names_to_alignment_count_arrays);
+        st_logInfo("Resuming from the coverage of %" PRIi64 " sequences\n", stHash_size(seq_names_to_alignment_count_arrays));
+        if(saturation_count > count_arrays_file->saturation_count) {
+            st_errAbort("The resumed coverage only distinguishes levels up to %" PRIi64 ", so the max level must be "
+                        "at most that\n", count_arrays_file->saturation_count - 1);
+        }
+    }
+
+    if(key_only) { // Sort just the keys of the records, then tile the records one at a time
+        int64_t key_number;
+        TileKey *keys = read_tile_keys(input, symmetric, &key_number);
+        qsort(keys, key_number, sizeof(TileKey), tile_key_cmp);
+        st_logInfo("Tiling %" PRIi64 " alignments by key\n", key_number);
+        tile_records_by_key(input, keys, key_number, seq_names_to_alignment_count_arrays, sparse, max_level,
+                            saturation_count, output);
+        free(keys);
     }
+    else {
+        stList *pafs = read_pafs(input, 0); // Load local alignments files (PAF)
+        InvertedPafs *inverted_pafs = NULL;
+        if(symmetric) { // Tile the inversions of the input alignments too, without copying their cigars
+            inverted_pafs = inverted_pafs_construct(pafs);
+            stList_setDestructor(pafs, NULL); // The list will now hold inversions, so clean up the pafs separately
+            for(int64_t i=0; i<inverted_pafs->length; i++) {
+                stList_append(pafs, &inverted_pafs->inverted_pafs[i]);
+            }
+        }
+        sort_pafs_by_descending_score(pafs, symmetric); // Sort alignments by score, from best-to-worst
 
-    // Output local alignments file, sorted by score from best-to-worst
-    write_pafs(output, pafs);
+        // Create the coverage of each query sequence up front, as the hash is only read while tiling concurrently
+        for(int64_t i=0; i<stList_length(pafs); i++) {
+            create_coverage(seq_names_to_alignment_count_arrays, stList_get(pafs, i), sparse, max_level,
+                            saturation_count);
+        }
+
+        // Split the alignments into independent units. The units of a query sequence touch disjoint bases of its count
+        // array, but a sparse coverage is a single structure so its sequence must be one unit
+        stList *units = get_tiling_units(pafs, !sparse);
+        st_logInfo("Tiling %" PRIi64 " alignments in %" PRIi64 " independent units\n", stList_length(pafs),
+                   stList_length(units));
+        if(threads > 0) {
+            omp_set_num_threads(threads);
+        }
+
+        // For each alignment: set the "level" of the alignment to q+1, increase by one the aligned bases count of each base covered by the alignment.
+        int64_t saturated_bases = 0; // Matched bases skipped as already saturated
+        #pragma omp parallel
+        {
+            int64_t *level_counts = sparse ? NULL : st_calloc(INT16_MAX, sizeof(int64_t)); // Level histogram reused by the thread
+            #pragma omp for schedule(dynamic) reduction(+:saturated_bases)
+            for(int64_t i=0; i<stList_length(units); i++) {
+                stList *unit = stList_get(units, i);
+                for(int64_t j=0; j<stList_length(unit); j++) {
+                    tile_paf(stList_get(unit, j), seq_names_to_alignment_count_arrays, inverted_pafs, sparse,
+                             max_level, level_counts, &saturated_bases);
+                }
+            }
+            free(level_counts);
+        }
+        stList_destruct(units);
+        if(max_level >= 0) {
+            st_logInfo("Skipped %" PRIi64 " saturated matched bases\n", saturated_bases);
+        }
+
+        // Output local alignments file, sorted by score from best-to-worst
+        if(inverted_pafs != NULL) {
+            int64_t paf_buffer_length = 100;
+            char *paf_buffer = st_malloc(sizeof(char) * paf_buffer_length);
+            for(int64_t i=0; i<stList_length(pafs); i++) {
+                inverted_pafs_write_with_buffer(inverted_pafs, stList_get(pafs, i), output, &paf_buffer,
+                                                &paf_buffer_length);
+            }
+            free(paf_buffer);
+        }
+        else {
+            write_pafs(output, pafs);
+        }
+
+        stList_destruct(pafs);
+        if(inverted_pafs != NULL) {
+            for(int64_t i=0; i<inverted_pafs->length; i++) {
+                paf_destruct(inverted_pafs->pafs[i]);
+            }
+            inverted_pafs_destruct(inverted_pafs);
+        }
+    }
+
+    // Save the coverage, via a temporary file as the coverage may be mapped from the file being replaced
+    if(save_coverage_file != NULL) {
+        char *temp_file = stString_print("%s.tmp", save_coverage_file);
+        FILE *coverage_output = fopen(temp_file, "w");
+        if(coverage_output == NULL) {
+            st_errAbort("Could not open coverage file: %s\n", temp_file);
+        }
+        write_alignment_count_arrays(coverage_output, seq_names_to_alignment_count_arrays, saturation_count);
+        if(fclose(coverage_output) != 0 || rename(temp_file, save_coverage_file) != 0) {
+            st_errAbort("Could not write coverage file: %s\n", save_coverage_file);
+        }
+        free(temp_file);
+    }
 
     //////////////////////////////////////////////
     // Cleanup
     //////////////////////////////////////////////
 
     stHash_destruct(seq_names_to_alignment_count_arrays);
-    stList_destruct(pafs);
+    if(count_arrays_file != NULL) {
+        countArraysFile_destruct(count_arrays_file);
+    }
     if(inputFile != NULL) {
         fclose(input);
     }
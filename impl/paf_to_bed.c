@@ -8,11 +8,18 @@
  * (3) Create integer array representing counts of alignments to bases in the genome, setting values initially to 0.
  * (4) Iterate through alignments, increase by one the aligned bases count of each base covered by the alignment.
  * (5) Output bed file, representing the coverage of each base in the query sequences
+ *
+ * With --sweep steps (3) and (4) instead record the boundaries of the matched intervals of each alignment, and step (5)
+ * sorts and sweeps them. Threads then each read a range of the input file into their own coverage events, which are
+ * merged per sequence, and sweep different sequences.
+ *
+ * The sequences are output in order of name.
  */
 
 #include "paf.h"
 #include <getopt.h>
 #include <time.h>
+#include <omp.h>
 #include "bioioC.h"
 
 static void usage(void) {
@@ -26,15 +33,35 @@ static void usage(void) {
     fprintf(stderr, "-m --minSize : Exclude any interval shorter than this length from the output\n");
     fprintf(stderr, "-n --includeInverted : Flip the alignments to include the target sequences also.\n");
     fprintf(stderr, "-q --queryFastaFile: Query Fasta file (to include completely missing records with -f\n");
+    fprintf(stderr, "-s --sparse : Track the coverage of each sequence as runs of equal coverage rather than with a count "
+                    "per base, so memory scales with the number of coverage changes rather than the sequence lengths\n");
+    fprintf(stderr, "-w --sweep : Record just the start and end of each run of matches of each alignment, then sort and "
+                    "sweep them to get the coverage, so time and memory scale with the number of alignment blocks "
+                    "rather than the sequence lengths. Coverage counts do not saturate\n");
+    fprintf(stderr, "-t --trackFile [FILE] : Write the coverage to the given file as a binary coverage track, with "
+                    "runs of equal coverage and the mean and max coverage of 1kb, 10kb and 100kb bins, rather than as "
+                    "bed. See paffy coverage_query. The bed output options do not apply to the track\n");
+    fprintf(stderr, "-T --threads [INT] : With --sweep, the number of threads to read the input file and sweep the "
+                    "coverage with. Reading in parallel requires an --inputFile. A non-positive value uses the OpenMP "
+                    "default (default:0)\n");
     fprintf(stderr, "-l --logLevel : Set the log level\n");
     fprintf(stderr, "-h --help : Print this help message\n");
 }
 
+/*
+ * Gets the sequence names of a hash, sorted, so the output does not depend on the hash order.
+ */
+static stList *get_sorted_seq_names(stHash *seq_names_to_coverages) {
+    stList *seq_names = stHash_getKeys(seq_names_to_coverages);
+    stList_sort(seq_names, (int (*)(const void *, const void *))strcmp);
+    return seq_names;
+}
+
 static void write_bed(FILE *output, stHash *seq_names_to_alignment_count_arrays,
                bool binary, bool exclude_unaligned, bool exclude_aligned, int64_t min_size) {
-    stHashIterator *it = stHash_getIterator(seq_names_to_alignment_count_arrays);
-    char *seq_name;
-    while((seq_name = stHash_getNext(it)) != NULL) {
+    stList *seq_names = get_sorted_seq_names(seq_names_to_alignment_count_arrays);
+    for(int64_t k=0; k<stList_length(seq_names); k++) {
+        char *seq_name = stList_get(seq_names, k);
         SequenceCountArray *seq_count_array = stHash_search(seq_names_to_alignment_count_arrays, seq_name);
         for(int64_t i=0; i<seq_count_array->length;) {
             for(int64_t j=i+1; j<=seq_count_array->length; j++) {
@@ -51,7 +78,237 @@ static void write_bed(FILE *output, stHash *seq_names_to_alignment_count_arrays,
             }
         }
     }
-    stHash_destructIterator(it);
+    stList_destruct(seq_names);
+}
+
+/*
+ * As write_bed, but for sparse coverages, joining consecutive runs with the same output value.
+ */
+static void write_bed_sparse(FILE *output, stHash *seq_names_to_coverages,
+                             bool binary, bool exclude_unaligned, bool exclude_aligned, int64_t min_size) {
+    stList *seq_names = get_sorted_seq_names(seq_names_to_coverages);
+    for(int64_t k=0; k<stList_length(seq_names); k++) {
+        char *seq_name = stList_get(seq_names, k);
+        SequenceCoverage *coverage = stHash_search(seq_names_to_coverages, seq_name);
+        stSortedSetIterator *run_it = sequenceCoverage_get_run_iterator(coverage);
+        CoverageRun *run = stSortedSet_getNext(run_it);
+        while(run != NULL) {
+            int64_t start = run->start, end = run->end, count = binary ? run->count > 0 : run->count;
+            while((run = stSortedSet_getNext(run_it)) != NULL && (binary ? run->count > 0 : run->count) == count) {
+                end = run->end;
+            }
+            if(end - start >= min_size && (count == 0 ? !exclude_unaligned : !exclude_aligned)) {
+                fprintf(output, "%s %" PRIi64 " %" PRIi64 " %i\n", seq_name, start, end, (int)count);
+            }
+        }
+        stSortedSet_destructIterator(run_it);
+    }
+    stList_destruct(seq_names);
+}
+
+/*
+ * Writes bed intervals through a buffer, joining consecutive intervals with the same output value.
+ */
+typedef struct _bedWriter {
+    FILE *output;
+    char *seq_name;
+    bool binary, exclude_unaligned, exclude_aligned;
+    int64_t min_size;
+    int64_t start, end, value; // The pending interval, empty if start == end
+    char *buffer;
+    int64_t length;
+} BedWriter;
+
+#define BED_WRITER_BUFFER_SIZE 65536
+
+static void bed_writer_flush(BedWriter *writer) {
+    fwrite(writer->buffer, 1, writer->length, writer->output);
+    writer->length = 0;
+}
+
+static void bed_writer_append_int(BedWriter *writer, int64_t i) {
+    char digits[20];
+    int64_t j = 0;
+    do {
+        digits[j++] = '0' + i % 10;
+        i /= 10;
+    } while(i > 0);
+    while(j > 0) {
+        writer->buffer[writer->length++] = digits[--j];
+    }
+}
+
+/*
+ * Writes the pending interval, if not excluded.
+ */
+static void bed_writer_write_pending(BedWriter *writer) {
+    if(writer->end - writer->start < writer->min_size || writer->end == writer->start ||
+       (writer->value == 0 ? writer->exclude_unaligned : writer->exclude_aligned)) {
+        return;
+    }
+    int64_t name_length = strlen(writer->seq_name);
+    if(writer->length + name_length + 64 > BED_WRITER_BUFFER_SIZE) {
+        bed_writer_flush(writer);
+        if(name_length + 64 > BED_WRITER_BUFFER_SIZE) { // Too long to buffer
+            fprintf(writer->output, "%s %" PRIi64 " %" PRIi64 " %i\n", writer->seq_name, writer->start, writer->end,
+                    (int)writer->value);
+            return;
+        }
+    }
+    memcpy(writer->buffer + writer->length, writer->seq_name, name_length);
+    writer->length += name_length;
+    writer->buffer[writer->length++] = ' ';
+    bed_writer_append_int(writer, writer->start);
+    writer->buffer[writer->length++] = ' ';
+    bed_writer_append_int(writer, writer->end);
+    writer->buffer[writer->length++] = ' ';
+    bed_writer_append_int(writer, writer->value);
+    writer->buffer[writer->length++] = '\n';
+}
+
+/*
+ * Adds the interval [start, end) with the given coverage, called by coverageEvents_sweep.
+ */
+static void bed_writer_add(void *extra_arg, int64_t start, int64_t end, int64_t count) {
+    BedWriter *writer = extra_arg;
+    int64_t value = writer->binary ? count > 0 : count;
+    if(writer->end == start && writer->value == value) { // Extends the pending interval
+        writer->end = end;
+        return;
+    }
+    bed_writer_write_pending(writer);
+    writer->start = start;
+    writer->end = end;
+    writer->value = value;
+}
+
+/*
+ * As write_bed, but sweeping the coverage events of each sequence. Sequences are swept in parallel, each into its own
+ * buffer, and written in order.
+ */
+static void write_bed_sweep(FILE *output, stHash *seq_names_to_coverage_events,
+                            bool binary, bool exclude_unaligned, bool exclude_aligned, int64_t min_size) {
+    stList *seq_names = get_sorted_seq_names(seq_names_to_coverage_events);
+    #pragma omp parallel for ordered schedule(dynamic)
+    for(int64_t k=0; k<stList_length(seq_names); k++) {
+        char *seq_name = stList_get(seq_names, k), *seq_bed;
+        size_t seq_bed_length;
+        FILE *seq_output = open_memstream(&seq_bed, &seq_bed_length);
+        BedWriter writer = { seq_output, seq_name, binary, exclude_unaligned, exclude_aligned, min_size, 0, 0, 0,
+                             st_malloc(BED_WRITER_BUFFER_SIZE), 0 };
+        coverageEvents_sweep(stHash_search(seq_names_to_coverage_events, seq_name), bed_writer_add, &writer);
+        bed_writer_write_pending(&writer);
+        bed_writer_flush(&writer);
+        free(writer.buffer);
+        fclose(seq_output);
+        #pragma omp ordered
+        fwrite(seq_bed, 1, seq_bed_length, output);
+        free(seq_bed);
+    }
+    stList_destruct(seq_names);
+}
+
+/*
+ * Adds the coverage events of the records in the given byte range of the input file, those whose first byte is in
+ * [start, end), to a new hash of sequence names to coverage events.
+ */
+static stHash *read_coverage_events(char *input_file, int64_t start, int64_t end, bool include_inverted_alignments) {
+    stHash *seq_names_to_coverage_events = stHash_construct3(stHash_stringKey, stHash_stringEqualKey,
+                                                             NULL, (void (*)(void *))coverageEvents_destruct);
+    FILE *input = fopen(input_file, "r");
+    if(input == NULL) {
+        st_errAbort("Could not open input file: %s\n", input_file);
+    }
+    int64_t paf_buffer_length = 100;
+    char *paf_buffer = st_malloc(sizeof(char) * paf_buffer_length);
+    if(start > 0) { // Skip the rest of the record overlapping the start, unless it starts there
+        fseeko(input, start - 1, SEEK_SET);
+        int c;
+        while((c = getc_unlocked(input)) != EOF && c != '\n');
+    }
+    Paf *paf;
+    while(ftello(input) < end && (paf = paf_read_with_buffer(input, 0, &paf_buffer, &paf_buffer_length)) != NULL) {
+        add_alignment_coverage_events(get_alignment_coverage_events(seq_names_to_coverage_events, paf, 0), paf, 0);
+        if(include_inverted_alignments) {
+            add_alignment_coverage_events(get_alignment_coverage_events(seq_names_to_coverage_events, paf, 1), paf, 1);
+        }
+        paf_destruct(paf);
+    }
+    free(paf_buffer);
+    fclose(input);
+    return seq_names_to_coverage_events;
+}
+
+/*
+ * Moves the coverage events of one hash into another, concatenating the events of sequences in both.
+ */
+static void merge_coverage_events(stHash *seq_names_to_coverage_events, stHash *seq_names_to_coverage_events2) {
+    stList *seq_names = stHash_getKeys(seq_names_to_coverage_events2);
+    for(int64_t i=0; i<stList_length(seq_names); i++) {
+        CoverageEvents *coverage_events2 = stHash_remove(seq_names_to_coverage_events2, stList_get(seq_names, i));
+        CoverageEvents *coverage_events = stHash_search(seq_names_to_coverage_events, coverage_events2->name);
+        if(coverage_events == NULL) {
+            stHash_insert(seq_names_to_coverage_events, coverage_events2->name, coverage_events2);
+            continue;
+        }
+        if(coverage_events->length != coverage_events2->length) {
+            st_errAbort("Got sequence with inconsistent lengths: %s\n", coverage_events->name);
+        }
+        if(coverage_events->event_number + coverage_events2->event_number > coverage_events->capacity) {
+            coverage_events->capacity = coverage_events->event_number + coverage_events2->event_number;
+            coverage_events->events = realloc(coverage_events->events, coverage_events->capacity * sizeof(int64_t));
+        }
+        memcpy(coverage_events->events + coverage_events->event_number, coverage_events2->events,
+               coverage_events2->event_number * sizeof(int64_t));
+        coverage_events->event_number += coverage_events2->event_number;
+        coverageEvents_destruct(coverage_events2);
+    }
+    stList_destruct(seq_names);
+}
+
+/*
+ * Writes the coverage of each sequence to a binary coverage track, in order of name, from any of the coverages.
+ */
+static void write_track(char *track_file, stHash *seq_names_to_coverages, bool sparse, bool sweep) {
+    FILE *fh = fopen(track_file, "w");
+    if(fh == NULL) {
+        st_errAbort("Could not open coverage track: %s\n", track_file);
+    }
+    CoverageTrackWriter *writer = coverageTrackWriter_construct(fh);
+    stList *seq_names = get_sorted_seq_names(seq_names_to_coverages);
+    for(int64_t k=0; k<stList_length(seq_names); k++) {
+        char *seq_name = stList_get(seq_names, k);
+        if(sweep) {
+            CoverageEvents *coverage_events = stHash_search(seq_names_to_coverages, seq_name);
+            coverageTrackWriter_start_sequence(writer, seq_name, coverage_events->length);
+            coverageEvents_sweep(coverage_events, coverageTrackWriter_add_run, writer);
+        }
+        else if(sparse) {
+            SequenceCoverage *coverage = stHash_search(seq_names_to_coverages, seq_name);
+            coverageTrackWriter_start_sequence(writer, seq_name, coverage->length);
+            stSortedSetIterator *run_it = sequenceCoverage_get_run_iterator(coverage);
+            CoverageRun *run;
+            while((run = stSortedSet_getNext(run_it)) != NULL) {
+                coverageTrackWriter_add_run(writer, run->start, run->end, run->count);
+            }
+            stSortedSet_destructIterator(run_it);
+        }
+        else { // The writer merges the bases with equal counts into runs
+            SequenceCountArray *seq_count_array = stHash_search(seq_names_to_coverages, seq_name);
+            coverageTrackWriter_start_sequence(writer, seq_name, seq_count_array->length);
+            for(int64_t i=0; i<seq_count_array->length;) {
+                int64_t j = i + 1;
+                while(j < seq_count_array->length && seq_count_array->counts[j] == seq_count_array->counts[i]) {
+                    j++;
+                }
+                coverageTrackWriter_add_run(writer, i, j, seq_count_array->counts[i]);
+                i = j;
+            }
+        }
+    }
+    stList_destruct(seq_names);
+    coverageTrackWriter_destruct(writer);
+    fclose(fh);
 }
 
 typedef struct _map_file Map_File;
@@ -60,7 +317,7 @@ struct _map_file {
     FILE *file;
 };
 
-static void write_missing_fasta_seqs(void* map_file, const char *name, const char *seq, int64_t length) {
+static void write_missing_fasta_seqs(void* map_file, const char *name, int64_t length) {
     if (stHash_search(((Map_File*)map_file)->map, (char*)name) == NULL) {
         fprintf(((Map_File*)map_file)->file, "%s 0 %" PRIi64 "\t0\n", name, length);
     }
@@ -81,6 +338,10 @@ int paffy_to_bed_main(int argc, char *argv[]) {
     int64_t min_size = 1;
     bool include_inverted_alignments = 0;
     char *query_fasta_file = NULL;
+    bool sparse = 0;
+    bool sweep = 0;
+    int64_t threads = 0;
+    char *track_file = NULL;
 
     ///////////////////////////////////////////////////////////////////////////
     // Parse the inputs
@@ -96,11 +357,15 @@ int paffy_to_bed_main(int argc, char *argv[]) {
                                                 { "minSize", required_argument, 0, 'm' },
                                                 { "includeInverted", no_argument, 0, 'n' },
                                                 { "queryFastaFile", required_argument, 0, 'q' },
+                                                { "sparse", no_argument, 0, 's' },
+                                                { "sweep", no_argument, 0, 'w' },
+                                                { "trackFile", required_argument, 0, 't' },
+                                                { "threads", required_argument, 0, 'T' },
                                                 { "help", no_argument, 0, 'h' },
                                                 { 0, 0, 0, 0 } };
 
         int option_index = 0;
-        int64_t key = getopt_long(argc, argv, "l:i:o:hbefm:q:n", long_options, &option_index);
+        int64_t key = getopt_long(argc, argv, "l:i:o:hbefm:q:nswt:T:", long_options, &option_index);
         if (key == -1) {
             break;
         }
@@ -133,6 +398,18 @@ int paffy_to_bed_main(int argc, char *argv[]) {
             case 'q':
                 query_fasta_file = optarg;
                 break;
+            case 's':
+                sparse = 1;
+                break;
+            case 'w':
+                sweep = 1;
+                break;
+            case 't':
+                track_file = optarg;
+                break;
+            case 'T':
+                threads = atol(optarg);
+                break;
             case 'h':
                 usage();
                 return 0;
@@ -149,6 +426,13 @@ int paffy_to_bed_main(int argc, char *argv[]) {
     st_setLogLevelFromString(logLevelString);
     st_logInfo("Input file string : %s\n", inputFile);
     st_logInfo("Output file string : %s\n", outputFile);
+    st_logInfo("Sparse coverage : %s\n", sparse ? "true" : "false");
+    st_logInfo("Sweep coverage : %s\n", sweep ? "true" : "false");
+    st_logInfo("Track file : %s\n", track_file);
+    st_logInfo("Threads : %" PRIi64 "\n", threads);
+    if(sparse && sweep) {
+        st_errAbort("Only one of --sparse and --sweep can be given\n");
+    }
 
     //////////////////////////////////////////////
     // Calculate the paf coverages
@@ -156,24 +440,66 @@ int paffy_to_bed_main(int argc, char *argv[]) {
 
     FILE *input = inputFile == NULL ? stdin : fopen(inputFile, "r");
     FILE *output = outputFile == NULL ? stdout : fopen(outputFile, "w");
-    FILE *query_fasta = query_fasta_file == NULL ? NULL : fopen(query_fasta_file, "r");
 
     // Create integer array representing counts of alignments to bases in the genome, setting values initially to 0.
     stHash *seq_names_to_alignment_count_arrays = stHash_construct3(stHash_stringKey, stHash_stringEqualKey,
-                                                                    NULL, (void (*)(void *))sequenceCountArray_destruct);
+                                                                    NULL, sparse ? (void (*)(void *))sequenceCoverage_destruct :
+                                                                                   sweep ? (void (*)(void *))coverageEvents_destruct :
+                                                                                   (void (*)(void *))sequenceCountArray_destruct);
+
+    if(threads > 0) {
+        omp_set_num_threads(threads);
+    }
+
+    // Read the coverage events of ranges of the input file in parallel, then merge them, leaving the input at its end
+    if(sweep && inputFile != NULL && omp_get_max_threads() > 1) {
+        fseeko(input, 0, SEEK_END);
+        int64_t input_length = ftello(input), range_number = omp_get_max_threads();
+        stHash **range_coverage_events = st_malloc(range_number * sizeof(stHash *));
+        #pragma omp parallel for schedule(static, 1)
+        for(int64_t i=0; i<range_number; i++) {
+            range_coverage_events[i] = read_coverage_events(inputFile, input_length * i / range_number,
+                                                            input_length * (i + 1) / range_number,
+                                                            include_inverted_alignments);
+        }
+        for(int64_t i=0; i<range_number; i++) {
+            merge_coverage_events(seq_names_to_alignment_count_arrays, range_coverage_events[i]);
+            stHash_destruct(range_coverage_events[i]);
+        }
+        free(range_coverage_events);
+        st_logInfo("Read the input in %" PRIi64 " ranges\n", range_number);
+    }
 
     // For each alignment: increase by one the aligned bases count of each base covered by the alignment.
     Paf *paf;
     int64_t paf_buffer_length = 100;
     char *paf_buffer = st_malloc(sizeof(char) * paf_buffer_length);
-    while((paf = paf_read_with_buffer(input, 1, &paf_buffer, &paf_buffer_length)) != NULL) {
-        SequenceCountArray *seq_count_array = get_alignment_count_array(seq_names_to_alignment_count_arrays, paf);
-        increase_alignment_level_counts(seq_count_array, paf);
+    while((paf = paf_read_with_buffer(input, !sweep, &paf_buffer, &paf_buffer_length)) != NULL) {
+        if(sweep) { // Works from the cigar string, reading the target coordinates rather than inverting the paf
+            add_alignment_coverage_events(get_alignment_coverage_events(seq_names_to_alignment_count_arrays, paf, 0),
+                                          paf, 0);
+            if(include_inverted_alignments) {
+                add_alignment_coverage_events(get_alignment_coverage_events(seq_names_to_alignment_count_arrays, paf, 1),
+                                              paf, 1);
+            }
+            paf_destruct(paf);
+            continue;
+        }
+        if(sparse) {
+            increase_alignment_coverage(get_alignment_coverage(seq_names_to_alignment_count_arrays, paf), paf);
+        }
+        else {
+            increase_alignment_level_counts(get_alignment_count_array(seq_names_to_alignment_count_arrays, paf), paf);
+        }
 
         if(include_inverted_alignments) {
             paf_invert(paf); // Flip the alignment
-            seq_count_array = get_alignment_count_array(seq_names_to_alignment_count_arrays, paf);
-            increase_alignment_level_counts(seq_count_array, paf);
+            if(sparse) {
+                increase_alignment_coverage(get_alignment_coverage(seq_names_to_alignment_count_arrays, paf), paf);
+            }
+            else {
+                increase_alignment_level_counts(get_alignment_count_array(seq_names_to_alignment_count_arrays, paf), paf);
+            }
         }
 
         paf_destruct(paf); // Cleanup the old paf record
@@ -181,12 +507,24 @@ int paffy_to_bed_main(int argc, char *argv[]) {
     free(paf_buffer);
 
     // Output local alignments file, sorted by score from best-to-worst
-    write_bed(output, seq_names_to_alignment_count_arrays, binary, exclude_unaligned, exclude_aligned, min_size);
+    if(track_file != NULL) {
+        write_track(track_file, seq_names_to_alignment_count_arrays, sparse, sweep);
+    }
+    else if(sweep) {
+        write_bed_sweep(output, seq_names_to_alignment_count_arrays, binary, exclude_unaligned, exclude_aligned, min_size);
+    }
+    else if(sparse) {
+        write_bed_sparse(output, seq_names_to_alignment_count_arrays, binary, exclude_unaligned, exclude_aligned, min_size);
+    }
+    else {
+        write_bed(output, seq_names_to_alignment_count_arrays, binary, exclude_unaligned, exclude_aligned, min_size);
+    }
 
     // Output unaligned regions that are in the FASTA but not paf
-    if (exclude_aligned && query_fasta) {
+    if (exclude_aligned && query_fasta_file && track_file == NULL) {
         Map_File mf = {seq_names_to_alignment_count_arrays, output};
-        fastaReadToFunction(query_fasta, (void*)&mf, write_missing_fasta_seqs);
+        fasta_read_lengths(query_fasta_file, 0, (void*)&mf, write_missing_fasta_seqs); // Not using any index, which
+        // would cut the names at the first whitespace
     }
 
     //////////////////////////////////////////////
@@ -200,9 +538,6 @@ int paffy_to_bed_main(int argc, char *argv[]) {
     if(outputFile != NULL) {
         fclose(output);
     }
-    if(query_fasta_file != NULL) {
-        fclose(query_fasta);
-    }      
 
     st_logInfo("Paffy to_bed is done!, %" PRIi64 " seconds have elapsed\n", time(NULL) - startTime);
 
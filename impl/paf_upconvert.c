@@ -20,46 +20,156 @@ static void usage(void) {
     fprintf(stderr, "Converts the coordinates of paf alignments to refer to extracted subsequences.\n");
     fprintf(stderr, "-i --inFile : The input paf file. If omitted then reads pafs from stdin\n");
     fprintf(stderr, "-o --outFile : The output paf file. If omitted then pafs will be written to stdout\n");
+    fprintf(stderr, "-x --indexFile : An index of the extracted subsequences. If fasta files are given the index is "
+                    "written to this file, otherwise it is read from it instead of the fasta files, so repeated "
+                    "conversions for the same extraction need not read the sequences\n");
     fprintf(stderr, "-l --logLevel : Set the log level\n");
     fprintf(stderr, "-h --help : Print this help message\n");
 }
 
-static void fastaRead_readCoordinates(void *sequences, const char *fastaHeader, const char *sequence, int64_t length) {
-    Interval *i = decode_fasta_header((char *)fastaHeader);
-    i->end = i->start + strlen(sequence); // Get the length of the actual fragment
+/*
+ * The extracted subsequences of a sequence, sorted by start, with the names they are given in the output.
+ */
+typedef struct _sequenceIntervals {
+    char *name;
+    int64_t length;
+    int64_t interval_number;
+    int64_t capacity;
+    Interval *intervals; // The name of each is its output name, "name|length|start"
+} SequenceIntervals;
+
+static void sequenceIntervals_destruct(SequenceIntervals *sequence_intervals) {
+    for(int64_t i=0; i<sequence_intervals->interval_number; i++) {
+        free(sequence_intervals->intervals[i].name);
+    }
+    free(sequence_intervals->intervals);
+    free(sequence_intervals->name);
+    free(sequence_intervals);
+}
+
+static void add_interval(stHash *seq_names_to_intervals, char *name, int64_t length, int64_t start, int64_t end) {
+    SequenceIntervals *sequence_intervals = stHash_search(seq_names_to_intervals, name);
+    if(sequence_intervals == NULL) {
+        sequence_intervals = st_calloc(1, sizeof(SequenceIntervals));
+        sequence_intervals->name = stString_copy(name);
+        sequence_intervals->length = length;
+        sequence_intervals->capacity = 4;
+        sequence_intervals->intervals = st_malloc(sequence_intervals->capacity * sizeof(Interval));
+        stHash_insert(seq_names_to_intervals, sequence_intervals->name, sequence_intervals);
+    }
+    if(sequence_intervals->interval_number == sequence_intervals->capacity) {
+        sequence_intervals->capacity *= 2;
+        sequence_intervals->intervals = realloc(sequence_intervals->intervals,
+                                                sequence_intervals->capacity * sizeof(Interval));
+    }
+    Interval *i = &sequence_intervals->intervals[sequence_intervals->interval_number++];
+    i->name = stString_print("%s|%" PRIi64 "|%" PRIi64 "", name, length, start); // The output name
+    i->start = start;
+    i->end = end;
+    i->length = length;
     st_logDebug("Adding sequence interval name: %s start:%" PRIi64 " end:%" PRIi64 " length: %" PRIi64 "\n",
-            i->name, i->start, i->end, i->length);
-    stList_append((stList *)sequences, i);
+                name, start, end, length);
 }
 
-static int cmp_overlapping_intervals(const void *i, const void *j) {
-    Interval *x = (Interval *)i, *y = (Interval *)j;
-    int k = strcmp(x->name, y->name);
-    //st_uglyf("Hello %s %s %" PRIi64 " %" PRIi64 " %" PRIi64 " %" PRIi64"\n", x->name, y->name, x->start, y->start, x->end, y->end);
-    if(k != 0) { // If seqs have different names
-        return k;
+static void fastaRead_readCoordinates(void *seq_names_to_intervals, const char *fastaHeader, int64_t length) {
+    Interval *i = decode_fasta_header((char *)fastaHeader);
+    add_interval(seq_names_to_intervals, i->name, i->length, i->start, i->start + length); // The length of the
+    // actual fragment
+    interval_destruct(i);
+}
+
+static int cmp_interval_starts(const void *i, const void *j) {
+    int64_t x = ((Interval *)i)->start, y = ((Interval *)j)->start;
+    return x < y ? -1 : (x > y ? 1 : 0);
+}
+
+static void sort_intervals(stHash *seq_names_to_intervals) {
+    stList *sequences = stHash_getValues(seq_names_to_intervals);
+    for(int64_t i=0; i<stList_length(sequences); i++) {
+        SequenceIntervals *sequence_intervals = stList_get(sequences, i);
+        qsort(sequence_intervals->intervals, sequence_intervals->interval_number, sizeof(Interval),
+              cmp_interval_starts);
     }
-    if(x->start < y->start) { // If query interval starts before the interval
-        return -1;
+    stList_destruct(sequences);
+}
+
+/*
+ * Reads an index written by write_index: a line for each interval of the start, end, sequence length and sequence
+ * name, tab separated, the name last so it may contain tabs.
+ */
+static void read_index(char *index_file, stHash *seq_names_to_intervals) {
+    FILE *fh = fopen(index_file, "r");
+    if(fh == NULL) {
+        st_errAbort("Could not open index file: %s\n", index_file);
     }
-    if(x->start <= y->end) {
-        assert(x->end <= y->end); // Must be contained within
-        return 0;
+    char *line = NULL;
+    size_t line_capacity = 0;
+    ssize_t line_length;
+    while((line_length = getline(&line, &line_capacity, fh)) > 0) {
+        int64_t start, end, length;
+        int name_offset = 0;
+        if(line[line_length - 1] == '\n') {
+            line[line_length - 1] = '\0';
+        }
+        if(sscanf(line, "%" SCNd64 "\t%" SCNd64 "\t%" SCNd64 "\t%n", &start, &end, &length, &name_offset) != 3 ||
+           name_offset == 0) {
+            st_errAbort("Invalid line in index file %s: %s\n", index_file, line);
+        }
+        add_interval(seq_names_to_intervals, line + name_offset, length, start, end);
     }
-    return 1;
+    free(line);
+    fclose(fh);
 }
 
-static void fix_interval(stList *intervals, char **name, int64_t *start, int64_t *end, int64_t *length) {
-    Interval qi; qi.name = *name; qi.start = *start; qi.end = *end;
+static void write_index(char *index_file, stHash *seq_names_to_intervals) {
+    FILE *fh = fopen(index_file, "w");
+    if(fh == NULL) {
+        st_errAbort("Could not open index file: %s\n", index_file);
+    }
+    stList *sequences = stHash_getValues(seq_names_to_intervals);
+    for(int64_t i=0; i<stList_length(sequences); i++) {
+        SequenceIntervals *sequence_intervals = stList_get(sequences, i);
+        for(int64_t j=0; j<sequence_intervals->interval_number; j++) {
+            Interval *interval = &sequence_intervals->intervals[j];
+            fprintf(fh, "%" PRIi64 "\t%" PRIi64 "\t%" PRIi64 "\t%s\n", interval->start, interval->end,
+                    interval->length, sequence_intervals->name);
+        }
+    }
+    stList_destruct(sequences);
+    if(fclose(fh) != 0) {
+        st_errAbort("Failed to write index file: %s\n", index_file);
+    }
+}
 
-    Interval *i = stList_binarySearch(intervals, &qi, cmp_overlapping_intervals);
+static void fix_interval(stHash *seq_names_to_intervals, char **name, int64_t *start, int64_t *end, int64_t *length) {
+    SequenceIntervals *sequence_intervals = stHash_search(seq_names_to_intervals, *name);
+    Interval *i = NULL;
+    if(sequence_intervals != NULL) { // Binary search for the last interval starting at or before the start
+        int64_t j = 0, k = sequence_intervals->interval_number; // The interval is before k, and at or after j
+        while(j < k) {
+            int64_t m = (j + k) / 2;
+            if(sequence_intervals->intervals[m].start <= *start) {
+                j = m + 1;
+            }
+            else {
+                k = m;
+            }
+        }
+        if(j > 0 && *start <= sequence_intervals->intervals[j - 1].end) {
+            i = &sequence_intervals->intervals[j - 1];
+            if(*end > i->end) {
+                st_errAbort("Alignment of %s from %" PRIi64 " to %" PRIi64 " is not contained within the extracted "
+                            "sequence from %" PRIi64 " to %" PRIi64 "\n", *name, *start, *end, i->start, i->end);
+            }
+        }
+    }
     if(i != NULL) { // If this fails the coordinate range is not contained within a sequence interval
         st_logDebug("Found interval seq name: %s start:%" PRIi64 " end:%" PRIi64 "\n",
-                i->name, i->start, i->length+i->start);
+                i->name, i->start, i->end);
 
         // Fix query sequence name
         free(*name);
-        *name = stString_print("%s|%" PRIi64 "|%" PRIi64 "", i->name, i->length, i->start); // Fix name
+        *name = stString_copy(i->name); // Fix name
         *start -= i->start; *end -= i->start; *length = i->length; // Fix coordinates
     }
     else {
@@ -77,6 +187,7 @@ int paffy_upconvert_main(int argc, char *argv[]) {
     char *logLevelString = NULL;
     char *paf_file = NULL;
     char *output_file = NULL;
+    char *index_file = NULL;
 
     ///////////////////////////////////////////////////////////////////////////
     // Parse the inputs
@@ -86,11 +197,12 @@ int paffy_upconvert_main(int argc, char *argv[]) {
         static struct option long_options[] = { { "logLevel", required_argument, 0, 'l' },
                                                 { "inFile", required_argument, 0, 'i' },
                                                 { "outputFile", required_argument, 0, 'o' },
+                                                { "indexFile", required_argument, 0, 'x' },
                                                 { "help", no_argument, 0, 'h' },
                                                 { 0, 0, 0, 0 } };
 
         int option_index = 0;
-        int64_t key = getopt_long(argc, argv, "l:o:hi:", long_options, &option_index);
+        int64_t key = getopt_long(argc, argv, "l:o:hi:x:", long_options, &option_index);
         if (key == -1) {
             break;
         }
@@ -105,6 +217,9 @@ int paffy_upconvert_main(int argc, char *argv[]) {
             case 'o':
                 output_file = optarg;
                 break;
+            case 'x':
+                index_file = optarg;
+                break;
             case 'h':
                 usage();
                 return 0;
@@ -120,21 +235,31 @@ int paffy_upconvert_main(int argc, char *argv[]) {
 
     st_setLogLevelFromString(logLevelString);
     st_logInfo("Paf file : %s\n", paf_file);
+    st_logInfo("Index file : %s\n", index_file);
 
     //////////////////////////////////////////////
     // Parse the sequences
     //////////////////////////////////////////////
 
-    stList *intervals = stList_construct();
-    while(optind < argc) {
-        char *seq_file = argv[optind++];
-        st_logInfo("Parsing sequence file : %s\n", seq_file);
-        FILE *seq_file_handle = fopen(seq_file, "r");
-        fastaReadToFunction(seq_file_handle, intervals, fastaRead_readCoordinates);
-        fclose(seq_file_handle);
+    stHash *seq_names_to_intervals = stHash_construct3(stHash_stringKey, stHash_stringEqualKey, NULL,
+                                                       (void (*)(void *))sequenceIntervals_destruct);
+    if(optind == argc && index_file != NULL) {
+        st_logInfo("Reading index file : %s\n", index_file);
+        read_index(index_file, seq_names_to_intervals);
+    }
+    else {
+        while(optind < argc) {
+            char *seq_file = argv[optind++];
+            st_logInfo("Parsing sequence file : %s\n", seq_file);
+            fasta_read_lengths(seq_file, 0, seq_names_to_intervals, fastaRead_readCoordinates); // Only the lengths
+            // are needed, so the sequences are not read, but the full headers are decoded, so no index is used
+        }
+        if(index_file != NULL) {
+            write_index(index_file, seq_names_to_intervals);
+        }
     }
-    stList_sort(intervals, cmp_intervals);
-    st_logInfo("Read %i sequences from sequence files\n", (int)stList_length(intervals));
+    sort_intervals(seq_names_to_intervals);
+    st_logInfo("Read intervals of %i sequences\n", (int)stHash_size(seq_names_to_intervals));
 
     //////////////////////////////////////////////
     // Now parse the bed file and extract the sequences, ensuring they are non-overlapping
@@ -147,8 +272,10 @@ int paffy_upconvert_main(int argc, char *argv[]) {
     char *paf_buffer = st_malloc(sizeof(char) * paf_buffer_length);
     while((paf = paf_read_with_buffer(input, 0, &paf_buffer, &paf_buffer_length)) != NULL) {
         // fix query and target coordinates
-        fix_interval(intervals, &(paf->query_name), &(paf->query_start), &(paf->query_end), &(paf->query_length));
-        fix_interval(intervals, &(paf->target_name), &(paf->target_start), &(paf->target_end), &(paf->target_length));
+        fix_interval(seq_names_to_intervals, &(paf->query_name), &(paf->query_start), &(paf->query_end),
+                     &(paf->query_length));
+        fix_interval(seq_names_to_intervals, &(paf->target_name), &(paf->target_start), &(paf->target_end),
+                     &(paf->target_length));
 
         paf_check(paf); // Check all is okay
 
@@ -162,7 +289,7 @@ int paffy_upconvert_main(int argc, char *argv[]) {
     // Cleanup
     //////////////////////////////////////////////
 
-    stList_destruct(intervals);
+    stHash_destruct(seq_names_to_intervals);
     if(paf_file != NULL) {
         fclose(input);
     }
@@ -9,6 +9,15 @@
 
 #include "sonLib.h"
 
+/*
+ * Defined when the AVX2 intrinsics can be used. __AVX2__ alone is not enough, as include.mk also defines it for simde
+ * builds on other platforms.
+ */
+#if defined(__AVX2__) && (defined(__x86_64__) || defined(__i386__))
+#include <immintrin.h>
+#define PAF_USE_AVX2
+#endif
+
 /*
  * The structure of a paf alignment is as follows:
  *
@@ -134,6 +143,15 @@ Paf *paf_read2(FILE *fh);
  */
 Paf *paf_read_with_buffer(FILE *fh, bool parse_cigar_string, char **paf_buffer, int64_t *paf_length_buffer);
 
+/*
+ * Read just the key of a PAF alignment record from the given file: the cigar is skipped and the sequence
+ * names are shared through names, a hash of strings to themselves created with stHash_construct3(stHash_stringKey,
+ * stHash_stringEqualKey, free, NULL), which owns them. The key is a full Paf with no cigar, so it takes the size of
+ * the struct, not of the record. Free the record with free() rather than paf_destruct.
+ * Returns NULL if no record available.
+ */
+Paf *paf_read_key_with_buffer(FILE *fh, stHash *names, char **paf_buffer, int64_t *paf_length_buffer);
+
 /*
  * Prints a paf record
  */
@@ -171,6 +189,44 @@ void paf_check(Paf *paf);
  */
 void paf_invert(Paf *paf);
 
+/*
+ * The inversions of a set of pafs, made without copying their cigars, so that each alignment can be treated as both
+ * itself and its inversion without materializing the inverted records.
+ */
+typedef struct _invertedPafs {
+    Paf **pafs; // The original pafs
+    Paf *inverted_pafs; // inverted_pafs[i] is the inversion of pafs[i], sharing its names and without a cigar
+    int64_t length;
+} InvertedPafs;
+
+/*
+ * Creates the inversions of the given pafs, as paf_invert would. The pafs must outlive the inversions.
+ */
+InvertedPafs *inverted_pafs_construct(stList *pafs);
+
+/*
+ * Cleans up the inversions, but not the pafs they were made from.
+ */
+void inverted_pafs_destruct(InvertedPafs *inverted_pafs);
+
+/*
+ * Gets the paf that the given paf is the inversion of, or NULL if the paf is not one of the inversions.
+ */
+Paf *inverted_pafs_get_original(InvertedPafs *inverted_pafs, Paf *paf);
+
+/*
+ * Gets the cigar of one of the inversions, made by inverting the cigar (or cigar string) of the paf it inverts.
+ * The caller owns the returned cigar, which is NULL if the original paf has no cigar. Reads the cigar of the original
+ * paf, so it must not be set or freed concurrently.
+ */
+Cigar *inverted_pafs_get_cigar(InvertedPafs *inverted_pafs, Paf *inverted_paf);
+
+/*
+ * Writes a paf, as paf_write_with_buffer. If the paf is one of the inversions its cigar is generated for the write.
+ */
+void inverted_pafs_write_with_buffer(InvertedPafs *inverted_pafs, Paf *paf, FILE *fh, char **paf_buffer,
+                                     int64_t *paf_length_buffer);
+
 /*
  * Read all the pafs from a file in order.
  */
@@ -187,6 +243,43 @@ void write_pafs(FILE *paf_file, stList *pafs);
 stList *paf_chain(stList *pafs, int64_t (*gap_cost)(int64_t, int64_t, void *), void *gap_cost_params,
                   int64_t max_gap_length, float percentage_to_trim);
 
+/*
+ * Counters describing the work done by the predecessor search while chaining.
+ */
+typedef struct _chainStats {
+    int64_t candidates_visited; // Predecessor candidates examined
+    int64_t candidates_pruned; // Candidates removed from further consideration because the query gap was too long
+    int64_t candidates_accepted; // Times a candidate was accepted as the best predecessor seen so far
+    int64_t max_iter_terminations; // Predecessor scans cut short by max_iter
+    int64_t max_skip_terminations; // Predecessor scans cut short by max_skip
+} ChainStats;
+
+/*
+ * As paf_chain, but bounds the predecessor search for each alignment in the style of minimap2.
+ * At most max_iter candidates are examined per alignment, and the scan stops once more than max_skip
+ * candidates reached through an already scored successor fail to improve the chain. A negative value disables
+ * the corresponding bound. If stats is not NULL it is filled in with counters about the search.
+ *
+ * If window_size is positive each (query, target, strand) partition is split along the query into windows of
+ * window_size bases that are chained in parallel. Each window also holds the alignments up to max_gap_length
+ * plus the longest alignment before it, its context, so every legal predecessor of an alignment is considered,
+ * every link is a valid chaining link, and the chain scores are recomputed over the chosen links. A window scores
+ * each candidate predecessor only by the part of its chain within the window, so with max_iter and max_skip
+ * disabled the result is bounded as follows:
+ * - An alignment whose best chain in the serial run starts within the context of its window gets the same
+ *   predecessor as in the serial run. So the output is identical to the serial run if no chain of the serial
+ *   run spans more than max_gap_length plus the longest alignment between the query starts of its first and last
+ *   alignments.
+ * - Any other alignment gets a chain score, before the chains are split to be disjoint, between the score of the
+ *   best chain ending at it that starts within the context of its window and its score in the serial run.
+ * The max_iter and max_skip bounds apply to the candidates within the window, so with them no such bound holds.
+ * The counters in stats cover only the searches of the alignments each window owns, so alignments in the overlap
+ * of two windows are counted once.
+ */
+stList *paf_chain2(stList *pafs, int64_t (*gap_cost)(int64_t, int64_t, void *), void *gap_cost_params,
+                   int64_t max_gap_length, float percentage_to_trim, int64_t max_iter, int64_t max_skip,
+                   int64_t window_size, ChainStats *stats);
+
 /*
  * Gets the number of aligned bases in the alignment between the query
  * and the target according to the cigar alignment.
@@ -203,6 +296,14 @@ void paf_trim_ends(Paf *paf, int64_t end_bases_to_trim);
  */
 void paf_trim_end_fraction(Paf *paf, float percentage);
 
+/*
+ * Clips a paf to the part of the alignment whose query coordinates are within [query_start, query_end) and target
+ * coordinates are within [target_start, target_end), removing any gaps left at its ends. Returns zero if nothing of
+ * the alignment remains, in which case the paf should be discarded. A paf without a parsed cigar can not be clipped,
+ * so is only kept if it lies entirely within the intervals. As with paf_trim_ends, the other fields are not updated.
+ */
+bool paf_clip(Paf *paf, int64_t query_start, int64_t query_end, int64_t target_start, int64_t target_end);
+
 /*
  * Breaks up a paf into its set of constituent matches
  */
@@ -215,6 +316,8 @@ typedef struct _sequenceCountArray {
     char *name; // Sequence name
     int64_t length; // Sequence length
     uint16_t *counts; // Array of counts, one for each base
+    uint64_t *saturated; // Optional bitmap of the bases whose counts can no longer increase, NULL if not tracked
+    bool mapped; // If true the counts are in a memory mapped file (see read_alignment_count_arrays), so are not freed
 } SequenceCountArray;
 
 /*
@@ -232,6 +335,307 @@ SequenceCountArray *get_alignment_count_array(stHash *seq_names_to_alignment_cou
  */
 void increase_alignment_level_counts(SequenceCountArray *seq_count_array, Paf *paf);
 
+/*
+ * Gets the median alignment coverage of the query bases matched by a paf record, from a count array to which the
+ * alignments, including this one, have been added with increase_alignment_level_counts. The paf's cigar must be parsed.
+ */
+int64_t get_median_alignment_coverage(SequenceCountArray *seq_count_array, Paf *paf);
+
+/*
+ * Returns non-zero if the median alignment coverage of a paf record (see get_median_alignment_coverage) is at most
+ * max_depth. If down_sample is non-zero an alignment with a greater median coverage, m, instead passes with probability
+ * max_depth/m, decided by a hash of its coordinates so the result is deterministic.
+ */
+bool paf_passes_depth_filter(SequenceCountArray *seq_count_array, Paf *paf, int64_t max_depth, bool down_sample);
+
+/*
+ * Removes from the list, and destructs, the pafs that fail paf_passes_depth_filter, using the query coverage of all
+ * the pafs in the list. Keeps the order of the remaining pafs. Returns the number of pafs removed.
+ */
+int64_t filter_pafs_by_depth(stList *pafs, int64_t max_depth, bool down_sample);
+
+/*
+ * Removes from the list, and destructs, the pafs contained in a better paf with the same query, target and strand,
+ * such as the repeated alignments of the overlaps between chunks. A paf is contained if its query and target intervals
+ * lie within those of the other paf and the range of diagonals it passes through lies within that of the other paf,
+ * widened by diagonal_slack on each side. Better means a higher score, then more matches, then a longer query interval,
+ * then earlier in the list, so of identical pafs only the first is kept. Keeps the order of the remaining pafs. Uses the
+ * cigars if parsed, otherwise only the diagonals of the ends of the pafs. Returns the number of pafs removed.
+ */
+int64_t remove_contained_pafs(stList *pafs, int64_t diagonal_slack);
+
+/*
+ * Increase by one the counts of the bases in [start, end), saturating at max_count, which must be at most
+ * INT16_MAX - 1, the limit used by increase_alignment_level_counts, and which no count in the range may already
+ * exceed. If level_counts is not NULL then level_counts[c] is also increased for each base's new count, c, and
+ * *max_level is raised to the largest new count, so level_counts must have more than max_count entries. Uses AVX2
+ * where available.
+ */
+void increase_alignment_level_counts_in_range(SequenceCountArray *seq_count_array, int64_t start, int64_t end,
+                                              int64_t max_count, int64_t *level_counts, int64_t *max_level);
+
+/*
+ * A memory mapped file of count arrays, see read_alignment_count_arrays.
+ */
+typedef struct _countArraysFile {
+    void *data; // The mapping
+    int64_t length; // The length of the mapping in bytes
+    int64_t saturation_count; // The count the counts were saturated at when written
+} CountArraysFile;
+
+/*
+ * Writes the count arrays in a hash of sequence names to count arrays to a file, in order of sequence name, in a
+ * binary format that read_alignment_count_arrays can memory map. saturation_count is the count at which the counts
+ * were saturated. The format uses the native byte order, so is not portable between architectures.
+ */
+void write_alignment_count_arrays(FILE *fh, stHash *seq_names_to_alignment_count_arrays, int64_t saturation_count);
+
+/*
+ * Memory maps a file written by write_alignment_count_arrays, adding a count array for each of its sequences to the
+ * given hash, which must not already contain them. The counts point into a private, copy-on-write mapping, so only
+ * pages that are read are loaded and changes are not written back to the file. The returned mapping must outlive the
+ * count arrays.
+ */
+CountArraysFile *read_alignment_count_arrays(char *file, stHash *seq_names_to_alignment_count_arrays);
+
+/*
+ * Unmaps the file. Must only be called after the count arrays read from it have been destructed.
+ */
+void countArraysFile_destruct(CountArraysFile *count_arrays_file);
+
+/*
+ * A run of bases of a sequence, [start, end), that all have the same alignment coverage.
+ */
+typedef struct _coverageRun {
+    int64_t start;
+    int64_t end;
+    uint16_t count;
+} CoverageRun;
+
+/*
+ * A sparse alternative to SequenceCountArray: the alignment coverage of a sequence as runs of equal coverage, so
+ * memory scales with the number of coverage changes rather than the sequence length. Counts saturate like those of
+ * SequenceCountArray.
+ */
+typedef struct _sequenceCoverage {
+    char *name; // Sequence name
+    int64_t length; // Sequence length
+    stSortedSet *runs; // The runs, of type CoverageRun, ordered by start and together covering the sequence
+} SequenceCoverage;
+
+/*
+ * Creates the coverage of a sequence, initially zero everywhere.
+ */
+SequenceCoverage *sequenceCoverage_construct(char *name, int64_t length);
+
+/*
+ * Cleanup a sequence coverage
+ */
+void sequenceCoverage_destruct(SequenceCoverage *coverage);
+
+/*
+ * Increase by one the coverage of each base in [start, end).
+ */
+void sequenceCoverage_increment(SequenceCoverage *coverage, int64_t start, int64_t end);
+
+/*
+ * Get the maximum coverage of any base in [start, end).
+ */
+int64_t sequenceCoverage_get_max(SequenceCoverage *coverage, int64_t start, int64_t end);
+
+/*
+ * Adds the number of bases in [start, end) with each coverage, c, to level_counts[c], which must be longer than the
+ * maximum coverage in the range.
+ */
+void sequenceCoverage_histogram(SequenceCoverage *coverage, int64_t start, int64_t end, int64_t *level_counts);
+
+/*
+ * Get an iterator over the runs of the coverage, in sequence order. Each run is of type CoverageRun.
+ */
+stSortedSetIterator *sequenceCoverage_get_run_iterator(SequenceCoverage *coverage);
+
+/*
+ * Get the number of runs in the coverage.
+ */
+int64_t sequenceCoverage_run_number(SequenceCoverage *coverage);
+
+/*
+ * As get_alignment_count_array, but gets the sparse coverage for the query sequence of a paf record.
+ */
+SequenceCoverage *get_alignment_coverage(stHash *seq_names_to_coverages, Paf *paf);
+
+/*
+ * As increase_alignment_level_counts, but for a sparse coverage.
+ */
+void increase_alignment_coverage(SequenceCoverage *coverage, Paf *paf);
+
+/*
+ * Alignment coverage along a sequence recorded as the boundaries of the matched intervals of the alignments, which
+ * are swept in order of position to get the coverage, so memory scales with the number of alignment blocks.
+ */
+typedef struct _coverageEvents {
+    char *name; // Sequence name
+    int64_t length; // Sequence length
+    int64_t *events; // Each the position of a boundary times two, plus one if the start of an interval
+    int64_t event_number;
+    int64_t capacity;
+} CoverageEvents;
+
+CoverageEvents *coverageEvents_construct(char *name, int64_t length);
+
+void coverageEvents_destruct(CoverageEvents *coverage_events);
+
+/*
+ * Records that the bases in [start, end) are covered by one more alignment.
+ */
+void coverageEvents_add(CoverageEvents *coverage_events, int64_t start, int64_t end);
+
+/*
+ * Sorts the events, then calls fn for each maximal run of bases [start, end) with equal coverage, count, in order,
+ * such that the runs tile the sequence. Counts do not saturate.
+ */
+void coverageEvents_sweep(CoverageEvents *coverage_events,
+                          void (*fn)(void *extra_arg, int64_t start, int64_t end, int64_t count), void *extra_arg);
+
+/*
+ * Get the coverage events of the query sequence of a paf record, or of its target sequence if inverted, creating
+ * them if they don't exist.
+ */
+CoverageEvents *get_alignment_coverage_events(stHash *seq_names_to_coverage_events, Paf *paf, bool inverted);
+
+/*
+ * Adds the matched intervals of the query sequence of a paf to its coverage events or, if inverted, those of its
+ * target sequence, as if the paf had been inverted. Works from the cigar string, which need not be parsed, merging
+ * matches that are contiguous in the sequence.
+ */
+void add_alignment_coverage_events(CoverageEvents *coverage_events, Paf *paf, bool inverted);
+
+/*
+ * Binary coverage tracks: the coverage of each sequence as runs of equal coverage, sorted by position, together with
+ * the mean and max coverage of fixed size bins at several zoom levels, and an index of the sequences. Tracks are
+ * written sequence by sequence with a CoverageTrackWriter and memory mapped to be read, so reading a region only
+ * touches the pages of the runs or bins that overlap it. The format uses the native byte order.
+ */
+
+#define COVERAGE_TRACK_ZOOM_LEVELS 3
+
+/*
+ * The bin size of each zoom level: 1kb, 10kb and 100kb.
+ */
+extern const int64_t coverage_track_bin_sizes[COVERAGE_TRACK_ZOOM_LEVELS];
+
+typedef struct _coverageTrackRun {
+    int64_t end; // The run starts at the end of the previous run, or at zero
+    int64_t count;
+} CoverageTrackRun;
+
+typedef struct _coverageTrackBin {
+    float mean; // The mean coverage of the bases in the bin
+    uint32_t max; // The max coverage of the bases in the bin
+} CoverageTrackBin;
+
+typedef struct _coverageTrackSequence {
+    char *name;
+    int64_t length;
+    int64_t run_number;
+    CoverageTrackRun *runs;
+    CoverageTrackBin *zoom_levels[COVERAGE_TRACK_ZOOM_LEVELS]; // Each of (length + bin size - 1) / bin size bins
+} CoverageTrackSequence;
+
+typedef struct _coverageTrack {
+    void *data; // The mapped file
+    int64_t length; // Its length in bytes
+    stList *sequences; // The CoverageTrackSequences, in order of the file
+    stHash *seq_names_to_sequences;
+} CoverageTrack;
+
+typedef struct _coverageTrackWriter CoverageTrackWriter;
+
+/*
+ * Starts writing a track to the given file, which must be seekable.
+ */
+CoverageTrackWriter *coverageTrackWriter_construct(FILE *fh);
+
+/*
+ * Writes the index of the sequences, finishing the track. Does not close the file.
+ */
+void coverageTrackWriter_destruct(CoverageTrackWriter *writer);
+
+/*
+ * Starts writing the runs of a sequence, after ending any previous sequence.
+ */
+void coverageTrackWriter_start_sequence(CoverageTrackWriter *writer, char *name, int64_t length);
+
+/*
+ * Adds the next run of bases [start, end) of the current sequence with the given coverage. The runs must be added in
+ * order and tile the sequence. Consecutive runs with equal coverage are merged. Has the signature of the function
+ * passed to coverageEvents_sweep, taking the writer as the extra argument.
+ */
+void coverageTrackWriter_add_run(void *writer, int64_t start, int64_t end, int64_t count);
+
+/*
+ * Memory maps a track written by a CoverageTrackWriter.
+ */
+CoverageTrack *coverageTrack_open(char *file);
+
+void coverageTrack_destruct(CoverageTrack *track);
+
+/*
+ * Gets a sequence of the track by name, or NULL if it is not in the track.
+ */
+CoverageTrackSequence *coverageTrack_get_sequence(CoverageTrack *track, char *name);
+
+/*
+ * Gets the index of the run containing the given position, by binary search.
+ */
+int64_t coverageTrackSequence_get_run_index(CoverageTrackSequence *sequence, int64_t position);
+
+/*
+ * Alignment fingerprints: 128 bit hashes of the sequence name ids, strand and coordinates of pafs, used to find
+ * duplicate alignments without keeping the pafs. A FingerprintSet holds fingerprints in an open addressing table of
+ * 16 byte slots, which is kept between three eighths and three quarters full, so costs about 21 to 43 bytes per
+ * distinct alignment, plus a copy of each distinct sequence name.
+ */
+
+typedef struct _pafFingerprint {
+    uint64_t hi, lo; // Both zero only for an empty slot
+} PafFingerprint;
+
+typedef struct _fingerprintSet {
+    PafFingerprint *slots;
+    int64_t size; // The number of fingerprints
+    int64_t capacity; // The number of slots, a power of two
+    stHash *names_to_ids; // Sequence names to one plus their ids
+} FingerprintSet;
+
+FingerprintSet *fingerprintSet_construct(void);
+
+void fingerprintSet_destruct(FingerprintSet *fingerprint_set);
+
+/*
+ * Gets the fingerprint of a paf, numbering its sequence names in the order they are first seen. If canonical is
+ * non-zero the fingerprint is that of whichever of the paf and its inverse (see paf_invert) orders first, so a paf and
+ * its inverse have the same fingerprint.
+ */
+PafFingerprint fingerprintSet_get_fingerprint(FingerprintSet *fingerprint_set, Paf *paf, bool canonical);
+
+/*
+ * Gets a fingerprint of a paf as fingerprintSet_get_fingerprint, but representing the sequence names by hashes rather
+ * than numbering them, so it needs no shared state and can be called concurrently. The fingerprints differ from those
+ * of fingerprintSet_get_fingerprint, so the two must not be mixed in a set.
+ */
+PafFingerprint paf_get_fingerprint(Paf *paf, bool canonical);
+
+/*
+ * Adds a fingerprint to the set, returning non-zero if it was not already in the set.
+ */
+bool fingerprintSet_add(FingerprintSet *fingerprint_set, PafFingerprint fingerprint);
+
+/*
+ * Returns non-zero if the fingerprint is in the set.
+ */
+bool fingerprintSet_contains(FingerprintSet *fingerprint_set, PafFingerprint fingerprint);
+
 typedef struct _interval {
     char *name;
     int64_t start, end, length;
@@ -247,6 +651,42 @@ void interval_destruct(Interval *interval);
  */
 Interval *decode_fasta_header(char *fasta_header);
 
+/*
+ * Decodes a fasta header as decode_fasta_header, memoizing the result in a hash of headers to intervals, so each distinct
+ * header is only decoded once. The returned interval is owned by the hash and shared, so must not be modified. Construct
+ * the hash with stHash_construct3(stHash_stringKey, stHash_stringEqualKey, free, (void (*)(void *))interval_destruct).
+ */
+Interval *get_decoded_fasta_header(stHash *headers_to_intervals, char *fasta_header);
+
+/*
+ * Calls fn with the header and sequence length of each record of a fasta file, in order, without reading the
+ * sequences into memory. The file is memory mapped and its lines scanned. Files that can not be mapped, such as
+ * pipes, are read with fastaReadToFunction. Either way the headers are the full header lines, without the '>'.
+ *
+ * If use_index is true and the file has a samtools faidx index (the file name plus ".fai") at least as new as the
+ * file the lengths are read from the index instead. The headers are then the sequence names of the index, which are
+ * cut at the first whitespace, so only set use_index if fn ignores the headers, or they have no whitespace.
+ */
+void fasta_read_lengths(char *fasta_file, bool use_index, void *extra_arg,
+                        void (*fn)(void *extra_arg, const char *header, int64_t length));
+
+/*
+ * The chunk size and overlap faffy chunk uses by default.
+ */
+#define DEFAULT_CHUNK_SIZE INT64_C(10000000)
+#define DEFAULT_CHUNK_OVERLAP INT64_C(100000)
+
+/*
+ * Converts the coordinates of a paf aligning chunks made by faffy chunk to those of the original sequences, for the
+ * query if fix_query is non-zero and the target if fix_target is non-zero, decoding the chunk names with
+ * get_decoded_fasta_header. If clip is non-zero the paf is first clipped (see paf_clip) to the part of each chunk that
+ * faffy merge would keep, splitting the overlap between consecutive chunks of the given size and overlap at its
+ * midpoint, so the alignments of the overlaps are not reported twice. Returns zero if nothing of the alignment
+ * remains after clipping, in which case the paf should be discarded.
+ */
+bool paf_dechunk(Paf *paf, stHash *headers_to_intervals, bool fix_query, bool fix_target, bool clip,
+                 int64_t chunk_size, int64_t overlap);
+
 /*
  * Compare intervals;
  */
@@ -10,7 +10,9 @@
 
 extern int paffy_add_mismatches_main(int argc, char *argv[]);
 extern int paffy_chain_main(int argc, char *argv[]);
+extern int paffy_coverage_query_main(int argc, char *argv[]);
 extern int paffy_dechunk_main(int argc, char *argv[]);
+extern int paffy_dechunk_dedupe_main(int argc, char *argv[]);
 extern int paffy_dedupe_main(int argc, char *argv[]);
 extern int paffy_invert_main(int argc, char *argv[]);
 extern int paffy_shatter_main(int argc, char *argv[]);
@@ -28,7 +30,9 @@ void usage(void) {
     fprintf(stderr, "available commands:\n");
     fprintf(stderr, "    add_mismatches           Replace Ms with =/Xs in PAF cigar string\n");
     fprintf(stderr, "    chain                    Chain together PAF alignments\n");
+    fprintf(stderr, "    coverage_query           Read the coverage of regions from a binary coverage track made by to_bed\n");
     fprintf(stderr, "    dechunk                  Manipulate coordinates to allow aggregation of PAFs computed over subsequences\n");
+    fprintf(stderr, "    dechunk_dedupe           Dechunk and dedupe many PAFs computed over subsequences into one PAF, in parallel\n");
     fprintf(stderr, "    dedupe                   Remove duplicate alignments from a file based on exact query/target coordinates\n");
     fprintf(stderr, "    filter                   Filter alignments based upon alignment stats\n");
     fprintf(stderr, "    invert                   Switch query and target coordinates\n");
@@ -53,8 +57,12 @@ int main(int argc, char *argv[]) {
         return paffy_add_mismatches_main(argc - 1, argv + 1);
     } else if (strcmp(argv[1], "chain") == 0) {
         return paffy_chain_main(argc - 1, argv + 1);
+    } else if (strcmp(argv[1], "coverage_query") == 0) {
+        return paffy_coverage_query_main(argc - 1, argv + 1);
     } else if (strcmp(argv[1], "dechunk") == 0) {
         return paffy_dechunk_main(argc - 1, argv + 1);
+    } else if (strcmp(argv[1], "dechunk_dedupe") == 0) {
+        return paffy_dechunk_dedupe_main(argc - 1, argv + 1);
     } else if (strcmp(argv[1], "dedupe") == 0) {
         return paffy_dedupe_main(argc - 1, argv + 1);
     } else if (strcmp(argv[1], "invert") == 0) {
@@ -46,10 +46,23 @@ paffy dechunk -i ${working_dir}/lastz.paf > ${working_dir}/lastz_dechunked.paf
 echo "Deduping"
 paffy dedupe -i ${working_dir}/lastz_dechunked.paf > ${working_dir}/lastz_dechunked_dedupe.paf
 
+# Dechunk and dedupe in one step from separate files of alignments, which should match dechunking then deduping
+echo "Dechunking and deduping separate files"
+mkdir ${working_dir}/lastz_parts
+split -l 1000 ${working_dir}/lastz.paf ${working_dir}/lastz_parts/lastz_
+ls ${working_dir}/lastz_parts/* > ${working_dir}/lastz_parts.txt
+cmp <(paffy dechunk_dedupe -f ${working_dir}/lastz_parts.txt -T 4) ${working_dir}/lastz_dechunked_dedupe.paf
+
 # Report stats on the alignments
 echo "Reporting stats on dechunked, deduped alignments and check aligned bases and identity are as expected"
 paffy view -i ${working_dir}/lastz_dechunked_dedupe.paf ${working_dir}/*.fa -s -t -u 0.94 -v 22000000
 
+# Instead clip the alignments at the midpoints of the chunk overlaps while dechunking, so the overlaps are not aligned
+# twice. Clipping may split an alignment between chunks, so allow for slightly fewer aligned bases
+echo "Dechunking with clipping"
+paffy dechunk -m -c 1000000 -v 10000 -i ${working_dir}/lastz.paf > ${working_dir}/lastz_dechunked_clipped.paf
+paffy view -i ${working_dir}/lastz_dechunked_clipped.paf ${working_dir}/*.fa -s -t -u 0.94 -v 21000000
+
 # Report stats on the no chunk alignments
 echo "Reporting stats on no chunk alignments for comparison"
 paffy view -i ${working_dir}/lastz_no_chunks.paf ${working_dir}/*.fa -s -t -u 0.94 -v 22000000
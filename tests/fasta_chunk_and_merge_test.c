@@ -45,8 +45,71 @@ static void test_fasta_chunk_and_merge(CuTest *testCase) {
     CuAssertTrue(testCase, st_system("rm -rf %s %s %s %s", test_fa_file, test_fasta_chunks_dir, test_chunks_file, test_dechunked_fa_file) == 0);
 }
 
+static void test_fasta_chunk_streaming(CuTest *testCase) {
+    int64_t chunk_size = 100;
+    int64_t overlap = 10;
+
+    // Make sequences whose lengths are at and around the chunk boundaries, with lines of different lengths, including
+    // lines longer than a chunk, and lower case bases
+    FILE *fh = fopen(test_fa_file, "w");
+    int64_t lengths[] = { 0, 1, 99, 100, 101, 109, 110, 111, 200, 210, 555 };
+    for(int64_t i=0; i<sizeof(lengths)/sizeof(int64_t); i++) {
+        fprintf(fh, ">seq%" PRIi64 "\n", i);
+        for(int64_t j=0; j<lengths[i]; j++) {
+            fputc("acgtnACGTN"[(i + j * 7) % 10], fh);
+            if((j + 1) % (i * 13 + 1) == 0 || j + 1 == lengths[i]) {
+                fputc('\n', fh);
+            }
+        }
+    }
+    fclose(fh);
+
+    // Chunk the sequences, checking each chunk has the expected length, then merge them back
+    CuAssertTrue(testCase, st_system("faffy chunk %s -d %s -c %" PRIi64 " -o %" PRIi64 " > %s", test_fa_file,
+                                     test_fasta_chunks_dir, chunk_size, overlap, test_chunks_file) == 0);
+    fh = fopen(test_chunks_file, "r");
+    char *chunk_file;
+    int64_t chunk_number = 0;
+    while((chunk_file = stFile_getLineFromFile(fh)) != NULL) {
+        FILE *fh2 = fopen(chunk_file, "r"); stHash *chunks = fastaReadToMap(fh2); fclose(fh2);
+        stHashIterator *it = stHash_getIterator(chunks);
+        char *header;
+        while((header = stHash_getNext(it)) != NULL) {
+            int64_t length, start;
+            CuAssertTrue(testCase, sscanf(strchr(header, '|'), "|%" SCNi64 "|%" SCNi64, &length, &start) == 2);
+            int64_t end = start + chunk_size + overlap < length ? start + chunk_size + overlap : length;
+            CuAssertIntEquals(testCase, end - start, strlen(stHash_search(chunks, header)));
+            chunk_number++;
+        }
+        stHash_destructIterator(it);
+        stHash_destruct(chunks);
+        free(chunk_file);
+    }
+    fclose(fh);
+    CuAssertIntEquals(testCase, 22, chunk_number);
+    CuAssertTrue(testCase, st_system("faffy merge -i %s -o %s", test_chunks_file, test_dechunked_fa_file) == 0);
+
+    // Check the sequences are equal, the empty sequence having no chunks
+    fh = fopen(test_fa_file, "r"); stHash *seqs = fastaReadToMap(fh); fclose(fh);
+    fh = fopen(test_dechunked_fa_file, "r"); stHash *seqs2 = fastaReadToMap(fh); fclose(fh);
+    CuAssertIntEquals(testCase, stHash_size(seqs) - 1, stHash_size(seqs2));
+    stHashIterator *it = stHash_getIterator(seqs2);
+    char *header;
+    while((header = stHash_getNext(it)) != NULL) {
+        CuAssertTrue(testCase, stHash_search(seqs, header) != NULL);
+        CuAssertStrEquals(testCase, stHash_search(seqs, header), stHash_search(seqs2, header));
+    }
+    stHash_destructIterator(it);
+    stHash_destruct(seqs);
+    stHash_destruct(seqs2);
+
+    // Cleanup
+    CuAssertTrue(testCase, st_system("rm -rf %s %s %s %s", test_fa_file, test_fasta_chunks_dir, test_chunks_file, test_dechunked_fa_file) == 0);
+}
+
 CuSuite* addFastaChunkAndMergeTestSuite(void) {
     CuSuite* suite = CuSuiteNew();
     SUITE_ADD_TEST(suite, test_fasta_chunk_and_merge);
+    SUITE_ADD_TEST(suite, test_fasta_chunk_streaming);
     return suite;
 }
@@ -35,6 +35,31 @@ paffy invert -i ${working_dir}/output.paf | paffy view ${working_dir}/*.fa -s -t
 echo "paffy chain minimum local alignment identity"
 paffy chain -i ${working_dir}/output.paf | paffy view ${working_dir}/*.fa -s -t -u 0.74 -v 530000
 
+# Run paffy chain incrementally, adding the second half of the alignments to the chained first half
+echo "paffy chain incremental minimum local alignment identity"
+half=$(( $(wc -l < ${working_dir}/output.paf) / 2 ))
+head -n ${half} ${working_dir}/output.paf | paffy chain > ${working_dir}/output_half_chained.paf
+tail -n +$(( half + 1 )) ${working_dir}/output.paf | paffy chain -c ${working_dir}/output_half_chained.paf > ${working_dir}/output_incremental.paf
+[ "$(wc -l < ${working_dir}/output_incremental.paf)" -eq "$(wc -l < ${working_dir}/output.paf)" ]
+paffy view -i ${working_dir}/output_incremental.paf ${working_dir}/*.fa -s -t -u 0.74 -v 530000
+
+# Run paffy chain and tile symmetrically, which should match using the alignments concatenated with their inversions
+echo "paffy chain and tile symmetric"
+paffy invert -i ${working_dir}/output.paf | cat ${working_dir}/output.paf - | paffy chain | sed 's/\tcn:i:[0-9]*//' | sort > ${working_dir}/output_materialized.paf
+paffy chain -y -i ${working_dir}/output.paf | sed 's/\tcn:i:[0-9]*//' | sort > ${working_dir}/output_symmetric.paf
+cmp ${working_dir}/output_materialized.paf ${working_dir}/output_symmetric.paf
+paffy tile -y -i ${working_dir}/output.paf > ${working_dir}/output_symmetric_tiled.paf
+[ "$(wc -l < ${working_dir}/output_symmetric_tiled.paf)" -eq "$(( 2 * $(wc -l < ${working_dir}/output.paf) ))" ]
+# The levels of the inversions, including those of opposite strand alignments, should match tiling the alignments
+# concatenated with their materialized inversions, and tiling with sparse coverage, which parses the inverted cigars
+cmp <(paffy invert -i ${working_dir}/output.paf | cat - ${working_dir}/output.paf | paffy tile | sort) <(sort ${working_dir}/output_symmetric_tiled.paf)
+cmp <(paffy tile -y -s -i ${working_dir}/output.paf | sort) <(sort ${working_dir}/output_symmetric_tiled.paf)
+
+# Run paffy chain reading just the keys first, which should give the same chains
+echo "paffy chain key only"
+cmp <(paffy chain -i ${working_dir}/output.paf | sed 's/\tcn:i:[0-9]*//' | sort) <(paffy chain -i ${working_dir}/output.paf -k | sed 's/\tcn:i:[0-9]*//' | sort)
+cmp <(paffy chain -i ${working_dir}/output.paf -y | sed 's/\tcn:i:[0-9]*//' | sort) <(paffy chain -i ${working_dir}/output.paf -y -k | sed 's/\tcn:i:[0-9]*//' | sort)
+
 # Run paffy view with shatter
 echo "paffy shatter minimum local alignment identity (will be low as equal to worst run of matches)"
 paffy shatter -i ${working_dir}/output.paf | paffy view ${working_dir}/*.fa -s -t -u 0.74 -v 530000
@@ -95,6 +120,27 @@ lines_non_inv=$(paffy to_bed -i ${working_dir}/output.paf -e | wc -l)
 lines_inv=$(paffy to_bed -i ${working_dir}/output.paf -e -n | wc -l)
 [ "${lines_inv}" -ge "${lines_non_inv}" ]
 
+# Run paffy to_bed and paffy tile with sparse coverage, which should match the dense coverage
+echo "paffy to_bed and tile sparse coverage, and to_bed sweep"
+cmp <(paffy to_bed -i ${working_dir}/output.paf -n | sort) <(paffy to_bed -i ${working_dir}/output.paf -n -s | sort)
+cmp <(paffy tile -i ${working_dir}/output.paf | sort) <(paffy tile -i ${working_dir}/output.paf -s | sort)
+cmp <(paffy to_bed -i ${working_dir}/output.paf -n | sort) <(paffy to_bed -i ${working_dir}/output.paf -n -w | sort)
+
+# Run paffy to_bed sweeping with multiple threads, which should match the default exactly, as sequences are sorted
+echo "paffy to_bed threads"
+cmp <(paffy to_bed -i ${working_dir}/output.paf -n) <(paffy to_bed -i ${working_dir}/output.paf -n -w -T 4)
+
+# Run paffy to_bed writing a coverage track, which paffy coverage_query should read back as the bed
+echo "paffy to_bed coverage track and coverage_query"
+paffy to_bed -i ${working_dir}/output.paf -n -w -t ${working_dir}/output_track.bin
+cmp <(paffy coverage_query -i ${working_dir}/output_track.bin) <(paffy to_bed -i ${working_dir}/output.paf -n)
+paffy coverage_query -i ${working_dir}/output_track.bin -z 10000 > /dev/null
+
+# Run paffy tile with multiple threads, which should match a single thread exactly
+echo "paffy tile threads"
+cmp <(paffy tile -i ${working_dir}/output.paf -y -T 1) <(paffy tile -i ${working_dir}/output.paf -y -T 4)
+cmp <(paffy tile -i ${working_dir}/output.paf -y -s -T 1) <(paffy tile -i ${working_dir}/output.paf -y -s -T 4)
+
 # Run paffy filter -u (min identity after encoding mismatches)
 echo "paffy filter by min identity"
 paffy add_mismatches -i ${working_dir}/output.paf ${working_dir}/*.fa \
@@ -105,6 +151,30 @@ echo "paffy filter by min identity with gaps"
 paffy add_mismatches -i ${working_dir}/output.paf ${working_dir}/*.fa \
   | paffy filter -v 0.7 > /dev/null
 
+# Run paffy filter -d, the alignments passing and failing the depth filter should partition the input, and reading
+# from stdin should give the same result as reading from a file
+echo "paffy filter by max depth"
+cmp <(paffy filter -i ${working_dir}/output.paf -d 2) <(cat ${working_dir}/output.paf | paffy filter -d 2)
+[ $(( $(paffy filter -i ${working_dir}/output.paf -d 2 | wc -l) + $(paffy filter -i ${working_dir}/output.paf -d 2 -x | wc -l) )) -eq $(wc -l < ${working_dir}/output.paf) ]
+
+# Run paffy tile with a max level, which should not change the alignments at or below the max level
+echo "paffy tile max level"
+cmp <(paffy tile -i ${working_dir}/output.paf | paffy filter -w 2 | sort) <(paffy tile -i ${working_dir}/output.paf -m 2 | paffy filter -w 2 | sort)
+
+# Run paffy tile reading just the keys first, which should give the same levels
+# with the inversions compared to those of sparse tiling and the materialized inversions, which are tiled by other paths
+echo "paffy tile key only"
+cmp <(paffy tile -i ${working_dir}/output.paf | sort) <(paffy tile -i ${working_dir}/output.paf -k | sort)
+cmp <(paffy tile -i ${working_dir}/output.paf -y -s | sort) <(paffy tile -i ${working_dir}/output.paf -y -k | sort)
+cmp <(paffy invert -i ${working_dir}/output.paf | cat - ${working_dir}/output.paf | paffy tile | sort) <(paffy tile -i ${working_dir}/output.paf -y -k | sort)
+
+# Run paffy tile on the best alignments then resume tiling the rest, which should match tiling them all at once
+echo "paffy tile resume"
+paffy tile -i ${working_dir}/output.paf > ${working_dir}/output_tiled.paf
+head -n 100 ${working_dir}/output_tiled.paf | paffy tile -c ${working_dir}/coverage.bin > ${working_dir}/output_tiled_first.paf
+tail -n +101 ${working_dir}/output_tiled.paf | paffy tile -r ${working_dir}/coverage.bin > ${working_dir}/output_tiled_rest.paf
+cmp <(cat ${working_dir}/output_tiled_first.paf ${working_dir}/output_tiled_rest.paf | sort) <(sort ${working_dir}/output_tiled.paf)
+
 # Run paffy filter -w (max tile level after tile)
 echo "paffy filter by max tile level"
 paffy tile -i ${working_dir}/output.paf | paffy filter -w 1 > /dev/null
@@ -114,8 +184,31 @@ paffy tile -i ${working_dir}/output.paf | paffy filter -w 1 > /dev/null
 echo "paffy trim fixed trim"
 paffy trim -f -t 0.1 -i ${working_dir}/output.paf | paffy view ${working_dir}/*.fa -s -t -u 0.73 -v 450000
 
+# Run paffy upconvert, writing an index of the extracted sequences, then again reading the index instead of the fasta
+echo "paffy upconvert index"
+cow_name=$(head -n1 ${working_dir}/simCow.chr6.fa | cut -c2- | cut -d' ' -f1)
+cow_length=$(grep -v ">" ${working_dir}/simCow.chr6.fa | tr -d '\n' | wc -c)
+printf "%s\t0\t%s\n" ${cow_name} ${cow_length} > ${working_dir}/regions.bed
+faffy extract ${working_dir}/simCow.chr6.fa -i ${working_dir}/regions.bed -o ${working_dir}/extracted.fa
+cmp <(paffy upconvert ${working_dir}/extracted.fa -x ${working_dir}/extracted.idx -i ${working_dir}/output.paf) <(paffy upconvert -x ${working_dir}/extracted.idx -i ${working_dir}/output.paf)
+
 # Run paffy dedupe -a (check inverse: also deduplicate inverted alignments)
 echo "paffy dedupe check inverse"
 paffy invert -i ${working_dir}/output.paf > ${working_dir}/output_inv.paf
 cat ${working_dir}/output.paf ${working_dir}/output_inv.paf \
   | paffy dedupe -a | paffy view ${working_dir}/*.fa -s -t -u 0.74 -v 530000
+
+# Run paffy dedupe -s (sorted input), which should give the same result as deduplicating the sorted input in memory
+echo "paffy dedupe sorted"
+cat ${working_dir}/output.paf ${working_dir}/output.paf | sort -k1,1 -k3,3n > ${working_dir}/output_sorted.paf
+cmp <(paffy dedupe -i ${working_dir}/output_sorted.paf) <(paffy dedupe -s -i ${working_dir}/output_sorted.paf)
+
+# Run paffy dedupe -p (partitioned), with a memory budget small enough that shards are split, which should give the
+# same result as deduplicating in memory
+echo "paffy dedupe partitioned"
+cat ${working_dir}/output.paf ${working_dir}/output_inv.paf ${working_dir}/output.paf > ${working_dir}/output_dupes.paf
+cmp <(paffy dedupe -a -i ${working_dir}/output_dupes.paf) <(paffy dedupe -a -p 4 -m 1K -T 2 -d ${working_dir} -i ${working_dir}/output_dupes.paf)
+
+# Run paffy dedupe -c (contained), trimmed copies of the alignments are contained in the originals so should be removed
+echo "paffy dedupe contained"
+cmp <(paffy trim -f -t 0.1 -i ${working_dir}/output.paf | cat - ${working_dir}/output.paf | paffy dedupe -c) <(paffy dedupe -c -i ${working_dir}/output.paf)
@@ -290,6 +290,36 @@ static void test_read_write_pafs_list(CuTest *tc) {
     stList_destruct(in);
 }
 
+static void test_paf_read_key(CuTest *tc) {
+    FILE *fh = tmpfile();
+    CuAssertTrue(tc, fh != NULL);
+    fprintf(fh, "q1\t100\t0\t50\t+\tt1\t200\t0\t50\t50\t50\t60\tAS:i:42\tcg:Z:50M\n");
+    fprintf(fh, "q1\t100\t60\t70\t-\tt1\t200\t80\t90\t10\t10\t60\tcg:Z:10M\n");
+    rewind(fh);
+
+    stHash *names = stHash_construct3(stHash_stringKey, stHash_stringEqualKey, free, NULL);
+    int64_t buffer_length = 10;
+    char *buffer = st_malloc(buffer_length);
+    Paf *p1 = paf_read_key_with_buffer(fh, names, &buffer, &buffer_length);
+    Paf *p2 = paf_read_key_with_buffer(fh, names, &buffer, &buffer_length);
+    CuAssertTrue(tc, paf_read_key_with_buffer(fh, names, &buffer, &buffer_length) == NULL);
+
+    CuAssertStrEquals(tc, "q1", p1->query_name);
+    CuAssertTrue(tc, p1->score == 42);
+    CuAssertTrue(tc, p1->cigar == NULL && p1->cigar_string == NULL);
+    CuAssertTrue(tc, p2->query_start == 60 && p2->target_end == 90 && !p2->same_strand);
+    /* Names are shared between records */
+    CuAssertTrue(tc, p1->query_name == p2->query_name);
+    CuAssertTrue(tc, p1->target_name == p2->target_name);
+    CuAssertIntEquals(tc, 2, stHash_size(names));
+
+    free(p1);
+    free(p2);
+    free(buffer);
+    stHash_destruct(names);
+    fclose(fh);
+}
+
 /* ---- 6. PAF Stats ---- */
 
 static void test_paf_stats_calc_all_match(CuTest *tc) {
@@ -392,6 +422,32 @@ static void test_paf_invert_double(CuTest *tc) {
     paf_destruct(paf);
 }
 
+static void test_inverted_pafs(CuTest *tc) {
+    /* The inversions match paf_invert, and the cigar is only made on request */
+    stList *pafs = stList_construct3(0, (void(*)(void*))paf_destruct);
+    stList_append(pafs, make_paf("query", 100, 10, 18, true, "target", 200, 20, 27, 8, 10, 60, "5M3I2D"));
+    stList_append(pafs, make_paf("query", 100, 10, 18, false, "target", 200, 20, 25, 5, 8, 60, "5M3I"));
+    InvertedPafs *inverted_pafs = inverted_pafs_construct(pafs);
+    CuAssertTrue(tc, inverted_pafs->length == 2);
+    for (int64_t i = 0; i < 2; i++) {
+        Paf *paf = stList_get(pafs, i), *inverted_paf = &inverted_pafs->inverted_pafs[i];
+        CuAssertTrue(tc, inverted_pafs_get_original(inverted_pafs, inverted_paf) == paf);
+        CuAssertTrue(tc, inverted_pafs_get_original(inverted_pafs, paf) == NULL);
+        CuAssertTrue(tc, inverted_paf->cigar == NULL && inverted_paf->cigar_string == NULL);
+        inverted_paf->cigar = inverted_pafs_get_cigar(inverted_pafs, inverted_paf);
+        char *s = paf_print(inverted_paf);
+        cigar_destruct(inverted_paf->cigar);
+        inverted_paf->cigar = NULL;
+        paf_invert(paf);
+        char *expected = paf_print(paf);
+        CuAssertStrEquals(tc, expected, s);
+        free(s);
+        free(expected);
+    }
+    inverted_pafs_destruct(inverted_pafs);
+    stList_destruct(pafs);
+}
+
 /* ---- 8. Aligned base count ---- */
 
 static void test_aligned_bases(CuTest *tc) {
@@ -455,6 +511,38 @@ static void test_paf_trim_end_fraction(CuTest *tc) {
     paf_destruct(paf);
 }
 
+static void test_paf_clip(CuTest *tc) {
+    /* Same strand, clipping through a match and removing the gap left at the front */
+    Paf *paf = make_paf("q", 100, 10, 50, 1, "t", 100, 20, 58, 38, 38, 60, "10M2I18M10M");
+    CuAssertTrue(tc, paf_clip(paf, 0, 45, 31, 100));
+    CuAssertIntEquals(tc, 23, paf->query_start);
+    CuAssertIntEquals(tc, 45, paf->query_end);
+    CuAssertIntEquals(tc, 31, paf->target_start);
+    CuAssertIntEquals(tc, 53, paf->target_end);
+    CuAssertIntEquals(tc, 2, cigar_count(paf->cigar));
+    CuAssertIntEquals(tc, 17, cigar_get(paf->cigar, 0)->length);
+    CuAssertIntEquals(tc, 5, cigar_get(paf->cigar, 1)->length);
+    paf_check(paf);
+    paf_destruct(paf);
+
+    /* Opposite strand, where the query is traversed from its end */
+    paf = make_paf("q", 100, 10, 40, 0, "t", 100, 0, 32, 28, 28, 60, "10M2D20M");
+    CuAssertTrue(tc, paf_clip(paf, 20, 35, 0, 100)); // Clips 5 query bases from the front, 10 from the back
+    CuAssertIntEquals(tc, 20, paf->query_start);
+    CuAssertIntEquals(tc, 35, paf->query_end);
+    CuAssertIntEquals(tc, 5, paf->target_start);
+    CuAssertIntEquals(tc, 22, paf->target_end);
+    CuAssertIntEquals(tc, 3, cigar_count(paf->cigar));
+    CuAssertIntEquals(tc, 5, cigar_get(paf->cigar, 0)->length);
+    CuAssertIntEquals(tc, query_delete, cigar_get(paf->cigar, 1)->op);
+    CuAssertIntEquals(tc, 10, cigar_get(paf->cigar, 2)->length);
+    paf_check(paf);
+
+    /* Nothing remains */
+    CuAssertTrue(tc, !paf_clip(paf, 0, 100, 22, 100));
+    paf_destruct(paf);
+}
+
 /* ---- 10. Shatter ---- */
 
 static void test_paf_shatter_single_match(CuTest *tc) {
@@ -602,6 +690,271 @@ static void test_coverage_tracking(CuTest *tc) {
     stHash_destruct(h);
 }
 
+static void test_coverage_range_histogram(CuTest *tc) {
+    /* Long enough to use both the vectorized and scalar paths */
+    SequenceCountArray *arr = st_calloc(1, sizeof(SequenceCountArray));
+    arr->length = 100;
+    arr->counts = st_calloc(arr->length, sizeof(uint16_t));
+    int64_t *level_counts = st_calloc(INT16_MAX, sizeof(int64_t));
+    int64_t max_level = 0;
+    increase_alignment_level_counts_in_range(arr, 10, 60, INT16_MAX - 1, NULL, NULL);
+    increase_alignment_level_counts_in_range(arr, 3, 90, INT16_MAX - 1, level_counts, &max_level);
+    CuAssertTrue(tc, max_level == 2);
+    CuAssertTrue(tc, level_counts[0] == 0 && level_counts[1] == 37 && level_counts[2] == 50);
+    CuAssertTrue(tc, arr->counts[2] == 0 && arr->counts[3] == 1 && arr->counts[10] == 2 && arr->counts[59] == 2);
+    CuAssertTrue(tc, arr->counts[60] == 1 && arr->counts[89] == 1 && arr->counts[90] == 0);
+
+    /* Counts saturate */
+    arr->counts[20] = INT16_MAX - 1;
+    increase_alignment_level_counts_in_range(arr, 0, 100, INT16_MAX - 1, NULL, NULL);
+    CuAssertTrue(tc, arr->counts[20] == INT16_MAX - 1 && arr->counts[21] == 3);
+
+    /* Or at a lower given count */
+    arr->counts[20] = 3;
+    max_level = 0;
+    memset(level_counts, 0, INT16_MAX * sizeof(int64_t));
+    increase_alignment_level_counts_in_range(arr, 0, 100, 3, level_counts, &max_level);
+    CuAssertTrue(tc, arr->counts[0] == 2 && arr->counts[3] == 3 && arr->counts[20] == 3 && arr->counts[99] == 2);
+    CuAssertTrue(tc, max_level == 3 && level_counts[2] == 13 && level_counts[3] == 87);
+
+    free(level_counts);
+    free(arr->counts);
+    free(arr);
+}
+
+static stList *make_depth_test_pafs(void) {
+    stList *pafs = stList_construct3(0, (void (*)(void *))paf_destruct);
+    for(int64_t i=0; i<4; i++) { // A repeat, aligned four times
+        char *target_name = stString_print("t%" PRIi64 "", i);
+        stList_append(pafs, make_paf("q", 100, 0, 50, 1, target_name, 100, 0, 50, 50, 50, 60, "50M"));
+        free(target_name);
+    }
+    stList_append(pafs, make_paf("q", 100, 50, 100, 1, "t4", 100, 0, 50, 50, 50, 60, "50M")); // Unique
+    stList_append(pafs, make_paf("q", 100, 40, 60, 1, "t5", 100, 0, 15, 15, 15, 60, "10M5I5M")); // Spans both
+    return pafs;
+}
+
+static void test_depth_filter(CuTest *tc) {
+    stList *pafs = make_depth_test_pafs();
+    stHash *h = stHash_construct3(stHash_stringKey, stHash_stringEqualKey, NULL,
+                                  (void (*)(void *))sequenceCountArray_destruct);
+    for(int64_t i=0; i<stList_length(pafs); i++) {
+        Paf *paf = stList_get(pafs, i);
+        increase_alignment_level_counts(get_alignment_count_array(h, paf), paf);
+    }
+    SequenceCountArray *arr = stHash_search(h, "q");
+    CuAssertTrue(tc, arr->counts[0] == 4 && arr->counts[45] == 5 && arr->counts[52] == 1 && arr->counts[57] == 2);
+    CuAssertIntEquals(tc, 4, get_median_alignment_coverage(arr, stList_get(pafs, 0)));
+    CuAssertIntEquals(tc, 1, get_median_alignment_coverage(arr, stList_get(pafs, 4)));
+    CuAssertIntEquals(tc, 5, get_median_alignment_coverage(arr, stList_get(pafs, 5))); // 10 of its 15 bases are at 5
+    CuAssertTrue(tc, paf_passes_depth_filter(arr, stList_get(pafs, 0), 4, 0));
+    CuAssertTrue(tc, !paf_passes_depth_filter(arr, stList_get(pafs, 0), 3, 0));
+    CuAssertTrue(tc, !paf_passes_depth_filter(arr, stList_get(pafs, 0), 0, 1)); // Nothing is kept at depth 0
+    stHash_destruct(h);
+
+    /* Filtering a list removes the alignments over the max depth, keeping the order of the others */
+    CuAssertIntEquals(tc, 1, filter_pafs_by_depth(pafs, 4, 0));
+    CuAssertIntEquals(tc, 5, stList_length(pafs));
+    CuAssertStrEquals(tc, "t4", ((Paf *)stList_get(pafs, 4))->target_name);
+    CuAssertIntEquals(tc, 4, filter_pafs_by_depth(pafs, 1, 0));
+    CuAssertIntEquals(tc, 1, stList_length(pafs)); // The counts are recalculated, so only the unique alignment remains
+    stList_destruct(pafs);
+
+    /* Down-sampling keeps some of the alignments over the max depth, deterministically */
+    stList *pafs2 = make_depth_test_pafs(), *pafs3 = make_depth_test_pafs();
+    int64_t removed = filter_pafs_by_depth(pafs2, 3, 1);
+    CuAssertTrue(tc, removed <= 5);
+    CuAssertIntEquals(tc, removed, filter_pafs_by_depth(pafs3, 3, 1));
+    for(int64_t i=0; i<stList_length(pafs2); i++) {
+        CuAssertStrEquals(tc, ((Paf *)stList_get(pafs2, i))->target_name, ((Paf *)stList_get(pafs3, i))->target_name);
+    }
+    stList_destruct(pafs2);
+    stList_destruct(pafs3);
+}
+
+static void test_count_arrays_file(CuTest *tc) {
+    const char *file = "./tests/temp_counts.bin";
+    stHash *h = stHash_construct3(stHash_stringKey, stHash_stringEqualKey,
+                                  NULL, (void(*)(void*))sequenceCountArray_destruct);
+    Paf *paf = make_paf("seq1", 11, 2, 5, true, "t", 100, 0, 3, 3, 3, 60, "3M");
+    Paf *paf2 = make_paf("seq0", 3, 0, 3, true, "t", 100, 0, 3, 3, 3, 60, "3M");
+    increase_alignment_level_counts(get_alignment_count_array(h, paf), paf);
+    increase_alignment_level_counts(get_alignment_count_array(h, paf), paf);
+    increase_alignment_level_counts(get_alignment_count_array(h, paf2), paf2);
+    FILE *fh = fopen(file, "w");
+    write_alignment_count_arrays(fh, h, 7);
+    fclose(fh);
+    stHash_destruct(h);
+
+    /* The counts are mapped back */
+    h = stHash_construct3(stHash_stringKey, stHash_stringEqualKey,
+                          NULL, (void(*)(void*))sequenceCountArray_destruct);
+    CountArraysFile *count_arrays_file = read_alignment_count_arrays((char *)file, h);
+    CuAssertTrue(tc, count_arrays_file->saturation_count == 7 && stHash_size(h) == 2);
+    SequenceCountArray *arr = stHash_search(h, "seq1");
+    CuAssertTrue(tc, arr != NULL && arr->mapped && arr->length == 11);
+    CuAssertTrue(tc, arr->counts[1] == 0 && arr->counts[2] == 2 && arr->counts[4] == 2 && arr->counts[5] == 0);
+    arr = stHash_search(h, "seq0");
+    CuAssertTrue(tc, arr != NULL && arr->length == 3 && arr->counts[0] == 1 && arr->counts[2] == 1);
+
+    /* And can be increased further without changing the file */
+    CuAssertTrue(tc, get_alignment_count_array(h, paf2) == arr);
+    increase_alignment_level_counts(arr, paf2);
+    CuAssertTrue(tc, arr->counts[0] == 2);
+    stHash_destruct(h);
+    countArraysFile_destruct(count_arrays_file);
+    h = stHash_construct3(stHash_stringKey, stHash_stringEqualKey,
+                          NULL, (void(*)(void*))sequenceCountArray_destruct);
+    count_arrays_file = read_alignment_count_arrays((char *)file, h);
+    CuAssertTrue(tc, ((SequenceCountArray *)stHash_search(h, "seq0"))->counts[0] == 1);
+    stHash_destruct(h);
+    countArraysFile_destruct(count_arrays_file);
+
+    paf_destruct(paf);
+    paf_destruct(paf2);
+    remove(file);
+}
+
+static void add_coverage_run(void *extra_arg, int64_t start, int64_t end, int64_t count) {
+    stList_append(extra_arg, stIntTuple_construct3(start, end, count));
+}
+
+static void test_coverage_events(CuTest *tc) {
+    CoverageEvents *coverage_events = coverageEvents_construct("seq1", 20);
+    coverageEvents_add(coverage_events, 5, 10);
+    coverageEvents_add(coverage_events, 2, 5); // Meets the first interval, so coverage does not change at 5
+    coverageEvents_add(coverage_events, 8, 12);
+    coverageEvents_add(coverage_events, 3, 3); // Empty
+    stList *runs = stList_construct3(0, (void (*)(void *))stIntTuple_destruct);
+    coverageEvents_sweep(coverage_events, add_coverage_run, runs);
+    int64_t expected[5][3] = { { 0, 2, 0 }, { 2, 8, 1 }, { 8, 10, 2 }, { 10, 12, 1 }, { 12, 20, 0 } };
+    CuAssertIntEquals(tc, 5, stList_length(runs));
+    for(int64_t i=0; i<5; i++) {
+        stIntTuple *run = stList_get(runs, i);
+        CuAssertTrue(tc, stIntTuple_get(run, 0) == expected[i][0] && stIntTuple_get(run, 1) == expected[i][1] &&
+                         stIntTuple_get(run, 2) == expected[i][2]);
+    }
+    stList_destruct(runs);
+    coverageEvents_destruct(coverage_events);
+
+    /* Alignment events, for the query and inverted for the target, on the opposite strand */
+    stHash *h = stHash_construct3(stHash_stringKey, stHash_stringEqualKey,
+                                  NULL, (void(*)(void*))coverageEvents_destruct);
+    Paf *paf = make_paf("seq1", 10, 1, 9, false, "t", 100, 10, 18, 6, 8, 60, "2M2D2M2I2M");
+    free(paf->cigar_string); // Use the cigar string rather than the parsed cigar
+    paf->cigar_string = stString_copy("2M2D2M2I2M");
+    Cigar *cigar = paf->cigar;
+    paf->cigar = NULL;
+    coverage_events = get_alignment_coverage_events(h, paf, 0);
+    CuAssertTrue(tc, coverage_events == get_alignment_coverage_events(h, paf, 0));
+    add_alignment_coverage_events(coverage_events, paf, 0);
+    CuAssertTrue(tc, coverage_events->event_number == 4); // Query runs [1, 5) and [7, 9)
+    CuAssertTrue(tc, coverage_events->events[0] == 3 && coverage_events->events[1] == 10 &&
+                     coverage_events->events[2] == 15 && coverage_events->events[3] == 18);
+    coverage_events = get_alignment_coverage_events(h, paf, 1);
+    CuAssertTrue(tc, coverage_events->length == 100);
+    add_alignment_coverage_events(coverage_events, paf, 1); // Target offsets [0, 2) and [4, 8) from the end, 18
+    CuAssertTrue(tc, coverage_events->event_number == 4);
+    CuAssertTrue(tc, coverage_events->events[0] == 16 * 2 + 1 && coverage_events->events[1] == 18 * 2 &&
+                     coverage_events->events[2] == 10 * 2 + 1 && coverage_events->events[3] == 14 * 2);
+
+    /* The same from the parsed cigar */
+    paf->cigar = cigar;
+    add_alignment_coverage_events(coverage_events, paf, 1);
+    CuAssertTrue(tc, coverage_events->event_number == 8 && coverage_events->events[6] == 10 * 2 + 1 &&
+                     coverage_events->events[7] == 14 * 2);
+    paf_destruct(paf);
+    stHash_destruct(h);
+}
+
+static void test_coverage_track(CuTest *tc) {
+    const char *file = "./tests/temp_track.bin";
+    FILE *fh = fopen(file, "w");
+    CoverageTrackWriter *writer = coverageTrackWriter_construct(fh);
+    coverageTrackWriter_start_sequence(writer, "seq1", 2500);
+    coverageTrackWriter_add_run(writer, 0, 500, 0);
+    coverageTrackWriter_add_run(writer, 500, 1500, 2);
+    coverageTrackWriter_add_run(writer, 1500, 2000, 2); // Merged with the previous run
+    coverageTrackWriter_add_run(writer, 2000, 2500, 1);
+    coverageTrackWriter_start_sequence(writer, "seq0", 0);
+    coverageTrackWriter_start_sequence(writer, "seq2", 10);
+    coverageTrackWriter_add_run(writer, 0, 10, 3);
+    coverageTrackWriter_destruct(writer);
+    fclose(fh);
+
+    CoverageTrack *track = coverageTrack_open((char *)file);
+    CuAssertIntEquals(tc, 3, stList_length(track->sequences));
+    CuAssertTrue(tc, coverageTrack_get_sequence(track, "seq3") == NULL);
+    CoverageTrackSequence *sequence = coverageTrack_get_sequence(track, "seq1");
+    CuAssertTrue(tc, sequence == stList_get(track->sequences, 0) && sequence->length == 2500);
+    CuAssertIntEquals(tc, 3, sequence->run_number);
+    CuAssertTrue(tc, sequence->runs[0].end == 500 && sequence->runs[0].count == 0);
+    CuAssertTrue(tc, sequence->runs[1].end == 2000 && sequence->runs[1].count == 2);
+    CuAssertTrue(tc, sequence->runs[2].end == 2500 && sequence->runs[2].count == 1);
+    CuAssertIntEquals(tc, 0, coverageTrackSequence_get_run_index(sequence, 499));
+    CuAssertIntEquals(tc, 1, coverageTrackSequence_get_run_index(sequence, 500));
+    CuAssertIntEquals(tc, 2, coverageTrackSequence_get_run_index(sequence, 2499));
+
+    /* The zoom levels */
+    CuAssertTrue(tc, sequence->zoom_levels[0][0].mean == 1.0f && sequence->zoom_levels[0][0].max == 2);
+    CuAssertTrue(tc, sequence->zoom_levels[0][1].mean == 2.0f && sequence->zoom_levels[0][1].max == 2);
+    CuAssertTrue(tc, sequence->zoom_levels[0][2].mean == 1.0f && sequence->zoom_levels[0][2].max == 1); // Half a bin
+    CuAssertTrue(tc, sequence->zoom_levels[2][0].mean == 3500.0f / 2500 && sequence->zoom_levels[2][0].max == 2);
+
+    sequence = coverageTrack_get_sequence(track, "seq0");
+    CuAssertTrue(tc, sequence->length == 0 && sequence->run_number == 0);
+    sequence = coverageTrack_get_sequence(track, "seq2");
+    CuAssertTrue(tc, sequence->run_number == 1 && sequence->runs[0].count == 3 && sequence->zoom_levels[1][0].max == 3);
+    coverageTrack_destruct(track);
+    remove(file);
+}
+
+static void test_sparse_coverage(CuTest *tc) {
+    SequenceCoverage *coverage = sequenceCoverage_construct("seq1", 20);
+    CuAssertTrue(tc, sequenceCoverage_run_number(coverage) == 1);
+
+    sequenceCoverage_increment(coverage, 2, 10);
+    sequenceCoverage_increment(coverage, 5, 15);
+    /* Runs are now [0,2):0 [2,5):1 [5,10):2 [10,15):1 [15,20):0 */
+    CuAssertTrue(tc, sequenceCoverage_run_number(coverage) == 5);
+    CuAssertTrue(tc, sequenceCoverage_get_max(coverage, 0, 20) == 2);
+    CuAssertTrue(tc, sequenceCoverage_get_max(coverage, 10, 20) == 1);
+
+    int64_t level_counts[3] = { 0, 0, 0 };
+    sequenceCoverage_histogram(coverage, 1, 12, level_counts);
+    CuAssertTrue(tc, level_counts[0] == 1 && level_counts[1] == 5 && level_counts[2] == 5);
+
+    /* Filling the gaps merges runs back together */
+    sequenceCoverage_increment(coverage, 10, 15);
+    sequenceCoverage_increment(coverage, 2, 5);
+    CuAssertTrue(tc, sequenceCoverage_run_number(coverage) == 3);
+    int64_t expected[3][3] = { { 0, 2, 0 }, { 2, 15, 2 }, { 15, 20, 0 } };
+    stSortedSetIterator *it = sequenceCoverage_get_run_iterator(coverage);
+    CoverageRun *run;
+    int64_t i = 0;
+    while ((run = stSortedSet_getNext(it)) != NULL) {
+        CuAssertTrue(tc, run->start == expected[i][0] && run->end == expected[i][1] && run->count == expected[i][2]);
+        i++;
+    }
+    CuAssertTrue(tc, i == 3);
+    stSortedSet_destructIterator(it);
+    sequenceCoverage_destruct(coverage);
+
+    /* Alignment coverage matches the dense counts */
+    stHash *h = stHash_construct3(stHash_stringKey, stHash_stringEqualKey,
+                                  NULL, (void(*)(void*))sequenceCoverage_destruct);
+    Paf *paf = make_paf("seq1", 10, 1, 9, true, "t", 100, 0, 8, 6, 8, 60, "2M2D2M2I2M");
+    coverage = get_alignment_coverage(h, paf);
+    CuAssertTrue(tc, coverage == get_alignment_coverage(h, paf));
+    increase_alignment_coverage(coverage, paf);
+    int64_t level_counts2[2] = { 0, 0 };
+    sequenceCoverage_histogram(coverage, 0, 10, level_counts2);
+    CuAssertTrue(tc, level_counts2[0] == 4 && level_counts2[1] == 6);
+    CuAssertTrue(tc, sequenceCoverage_get_max(coverage, 5, 7) == 0);
+    paf_destruct(paf);
+    stHash_destruct(h);
+}
+
 /* ---- 13. Interval functions ---- */
 
 static void test_decode_fasta_header(CuTest *tc) {
@@ -612,6 +965,59 @@ static void test_decode_fasta_header(CuTest *tc) {
     CuAssertTrue(tc, iv->start  == 0);
     CuAssertTrue(tc, iv->length == 100);
     interval_destruct(iv);
+
+    /* Memoized decoding returns the same shared interval for the same header */
+    stHash *headers_to_intervals = stHash_construct3(stHash_stringKey, stHash_stringEqualKey, free,
+                                                     (void (*)(void *))interval_destruct);
+    iv = get_decoded_fasta_header(headers_to_intervals, "seq|name|200|50");
+    CuAssertStrEquals(tc, "seq|name", iv->name);
+    CuAssertTrue(tc, iv->start == 50 && iv->length == 200);
+    CuAssertTrue(tc, iv == get_decoded_fasta_header(headers_to_intervals, "seq|name|200|50"));
+    CuAssertTrue(tc, iv != get_decoded_fasta_header(headers_to_intervals, "seq|name|200|100"));
+    CuAssertIntEquals(tc, 2, stHash_size(headers_to_intervals));
+    stHash_destruct(headers_to_intervals);
+}
+
+static void add_fasta_length(void *lengths, const char *header, int64_t length) {
+    stList_append(lengths, stString_print("%s:%" PRIi64 "", header, length));
+}
+
+static void test_fasta_read_lengths(CuTest *tc) {
+    const char *file = "./tests/temp_lengths.fa";
+    FILE *fh = fopen(file, "w");
+    fprintf(fh, ">seq1|100|10\nACGT\nAC\n>empty\n>seq2 description\r\nAC GT\r\nA");
+    fclose(fh);
+
+    /* The lengths are scanned from the file, skipping whitespace */
+    stList *lengths = stList_construct3(0, free);
+    fasta_read_lengths((char *)file, 1, lengths, add_fasta_length);
+    CuAssertIntEquals(tc, 3, stList_length(lengths));
+    CuAssertStrEquals(tc, "seq1|100|10:6", stList_get(lengths, 0));
+    CuAssertStrEquals(tc, "empty:0", stList_get(lengths, 1));
+    CuAssertStrEquals(tc, "seq2 description:5", stList_get(lengths, 2));
+    stList_destruct(lengths);
+
+    /* Or read from an index, if asked, which cuts the names at the first whitespace */
+    char *fai_file = stString_print("%s.fai", file);
+    fh = fopen(fai_file, "w");
+    fprintf(fh, "seq1|100|10\t6\t13\t4\t5\nempty\t0\t27\t0\t0\nseq2\t5\t51\t4\t6\n");
+    fclose(fh);
+    lengths = stList_construct3(0, free);
+    fasta_read_lengths((char *)file, 1, lengths, add_fasta_length);
+    CuAssertIntEquals(tc, 3, stList_length(lengths));
+    CuAssertStrEquals(tc, "seq1|100|10:6", stList_get(lengths, 0));
+    CuAssertStrEquals(tc, "seq2:5", stList_get(lengths, 2));
+    stList_destruct(lengths);
+
+    /* Otherwise the index is ignored and the full headers given */
+    lengths = stList_construct3(0, free);
+    fasta_read_lengths((char *)file, 0, lengths, add_fasta_length);
+    CuAssertIntEquals(tc, 3, stList_length(lengths));
+    CuAssertStrEquals(tc, "seq2 description:5", stList_get(lengths, 2));
+    stList_destruct(lengths);
+    remove(fai_file);
+    free(fai_file);
+    remove(file);
 }
 
 static void test_cmp_intervals(CuTest *tc) {
@@ -730,6 +1136,243 @@ static void test_paf_check_valid(CuTest *tc) {
     CuAssertTrue(tc, 1);  /* reached here without aborting */
 }
 
+/* ---- 17. Chaining ---- */
+
+static int64_t test_gap_cost(int64_t query_gap_length, int64_t target_gap_length, void *params) {
+    return query_gap_length + target_gap_length;
+}
+
+/* Three colinear alignments, each scoring 1000, separated by 100 base gaps in both sequences */
+static stList *make_colinear_pafs(void) {
+    stList *pafs = stList_construct3(0, (void(*)(void*))paf_destruct);
+    for (int64_t i = 0; i < 3; i++) {
+        Paf *p = make_paf("q", 1000, i*200, i*200+100, true, "t", 1000, i*200, i*200+100, 100, 100, 60, NULL);
+        p->score = 1000;
+        stList_append(pafs, p);
+    }
+    return pafs;
+}
+
+static void test_paf_chain_colinear(CuTest *tc) {
+    stList *pafs = make_colinear_pafs();
+    ChainStats stats;
+    stList *chained = paf_chain2(pafs, test_gap_cost, NULL, 1000, 0.0, -1, -1, 0, &stats);
+    CuAssertIntEquals(tc, 3, stList_length(chained));
+    for (int64_t i = 0; i < 3; i++) {
+        Paf *p = stList_get(chained, i);
+        CuAssertTrue(tc, p->chain_id == ((Paf *)stList_get(chained, 0))->chain_id);
+        CuAssertTrue(tc, p->chain_score == 3000 - 200 - 200);
+    }
+    /* The last alignment scans both predecessors, the second just the first */
+    CuAssertTrue(tc, stats.candidates_visited == 3);
+    CuAssertTrue(tc, stats.candidates_accepted == 2);
+    CuAssertTrue(tc, stats.candidates_pruned == 0);
+    CuAssertTrue(tc, stats.max_iter_terminations == 0 && stats.max_skip_terminations == 0);
+    stList_setDestructor(pafs, NULL);
+    stList_destruct(pafs);
+    stList_destruct(chained);
+}
+
+static void test_paf_chain_bounds(CuTest *tc) {
+    /* max_iter=0 prevents any predecessor being examined, so every alignment is its own chain */
+    stList *pafs = make_colinear_pafs();
+    ChainStats stats;
+    stList *chained = paf_chain2(pafs, test_gap_cost, NULL, 1000, 0.0, 0, -1, 0, &stats);
+    CuAssertIntEquals(tc, 3, stList_length(chained));
+    CuAssertTrue(tc, ((Paf *)stList_get(chained, 0))->chain_id != ((Paf *)stList_get(chained, 1))->chain_id);
+    CuAssertTrue(tc, ((Paf *)stList_get(chained, 1))->chain_id != ((Paf *)stList_get(chained, 2))->chain_id);
+    CuAssertTrue(tc, stats.candidates_visited == 0);
+    CuAssertTrue(tc, stats.max_iter_terminations == 2);
+    stList_setDestructor(pafs, NULL);
+    stList_destruct(pafs);
+    stList_destruct(chained);
+
+    /* max_skip=0 stops the scan of the last alignment at the first alignment, which was reached through the second,
+     * but as the skipped candidate does not improve the chain the result is unchanged */
+    pafs = make_colinear_pafs();
+    chained = paf_chain2(pafs, test_gap_cost, NULL, 1000, 0.0, -1, 0, 0, &stats);
+    CuAssertIntEquals(tc, 3, stList_length(chained));
+    for (int64_t i = 0; i < 3; i++) {
+        CuAssertTrue(tc, ((Paf *)stList_get(chained, i))->chain_score == 2600);
+    }
+    CuAssertTrue(tc, stats.max_skip_terminations == 1);
+    stList_setDestructor(pafs, NULL);
+    stList_destruct(pafs);
+    stList_destruct(chained);
+}
+
+static void test_paf_chain_windows(CuTest *tc) {
+    /* A window size of 150 puts each alignment in its own window, but each window overlaps its predecessor,
+     * so the chain is rebuilt across the seams with the serial score */
+    stList *pafs = make_colinear_pafs();
+    ChainStats stats;
+    stList *chained = paf_chain2(pafs, test_gap_cost, NULL, 1000, 0.0, -1, -1, 150, &stats);
+    CuAssertIntEquals(tc, 3, stList_length(chained));
+    for (int64_t i = 0; i < 3; i++) {
+        Paf *p = stList_get(chained, i);
+        CuAssertTrue(tc, p->chain_id == ((Paf *)stList_get(chained, 0))->chain_id);
+        CuAssertTrue(tc, p->chain_score == 2600);
+    }
+    /* Only the searches of each window's own alignment are counted, so the counters match the serial run
+     * although the later windows rescan the earlier alignments as context */
+    CuAssertTrue(tc, stats.candidates_visited == 3);
+    CuAssertTrue(tc, stats.candidates_accepted == 2);
+    stList_setDestructor(pafs, NULL);
+    stList_destruct(pafs);
+    stList_destruct(chained);
+
+    /* With a max gap length of 50 no alignments can be chained, and the windows do not overlap */
+    pafs = make_colinear_pafs();
+    chained = paf_chain2(pafs, test_gap_cost, NULL, 50, 0.0, -1, -1, 150, &stats);
+    CuAssertIntEquals(tc, 3, stList_length(chained));
+    CuAssertTrue(tc, ((Paf *)stList_get(chained, 0))->chain_id != ((Paf *)stList_get(chained, 1))->chain_id);
+    CuAssertTrue(tc, ((Paf *)stList_get(chained, 1))->chain_id != ((Paf *)stList_get(chained, 2))->chain_id);
+    CuAssertTrue(tc, stats.candidates_accepted == 0);
+    stList_setDestructor(pafs, NULL);
+    stList_destruct(pafs);
+    stList_destruct(chained);
+}
+
+/* The alignments of a chain that spans more than the overlap of the windows: a -> c1 -> x scores 1900 serially,
+ * but the window of x holds only c1 and c2, so there c1 scores 300 and x takes c2, which a can not precede */
+static stList *make_window_spanning_pafs(void) {
+    stList *pafs = stList_construct3(0, (void(*)(void*))paf_destruct);
+    int64_t coordinates[4][5] = { { 0, 100, 0, 100, 1000 }, // a
+                                  { 200, 300, 200, 300, 300 }, // c1
+                                  { 200, 300, 50, 150, 600 }, // c2, overlapping a on the target
+                                  { 400, 500, 400, 500, 1000 } }; // x
+    for (int64_t i = 0; i < 4; i++) {
+        int64_t *c = coordinates[i];
+        Paf *p = make_paf("q", 1000, c[0], c[1], true, "t", 1000, c[2], c[3], 100, 100, 60, NULL);
+        p->score = c[4];
+        stList_append(pafs, p);
+    }
+    return pafs;
+}
+
+static Paf *get_chained_paf(stList *chained, int64_t query_start, int64_t target_start) {
+    for (int64_t i = 0; i < stList_length(chained); i++) {
+        Paf *p = stList_get(chained, i);
+        if (p->query_start == query_start && p->target_start == target_start) {
+            return p;
+        }
+    }
+    return NULL;
+}
+
+static void test_paf_chain_windows_bound(CuTest *tc) {
+    /* Serially x chains through c1 to a */
+    stList *pafs = make_window_spanning_pafs();
+    stList *chained = paf_chain2(pafs, test_gap_cost, NULL, 250, 0.0, -1, -1, 0, NULL);
+    CuAssertTrue(tc, get_chained_paf(chained, 400, 400)->chain_score == 1900);
+    CuAssertTrue(tc, get_chained_paf(chained, 400, 400)->chain_id == get_chained_paf(chained, 0, 0)->chain_id);
+    stList_setDestructor(pafs, NULL);
+    stList_destruct(pafs);
+    stList_destruct(chained);
+
+    /* With windows of 150 bases the context of the window of x starts at 400 - 250 - 100 = 50, after a, so x
+     * takes c2. Its score is between that of the best chain within its context, c2 -> x, and the serial score */
+    pafs = make_window_spanning_pafs();
+    chained = paf_chain2(pafs, test_gap_cost, NULL, 250, 0.0, -1, -1, 150, NULL);
+    Paf *x = get_chained_paf(chained, 400, 400);
+    CuAssertTrue(tc, x->chain_id == get_chained_paf(chained, 200, 50)->chain_id);
+    CuAssertTrue(tc, x->chain_score == 1000 + 600 - 350);
+    CuAssertTrue(tc, x->chain_score >= 1000 + 600 - 350 && x->chain_score <= 1900);
+    /* c1 starts within the context of its own window, so keeps its serial predecessor a */
+    CuAssertTrue(tc, get_chained_paf(chained, 200, 200)->chain_id == get_chained_paf(chained, 0, 0)->chain_id);
+    CuAssertTrue(tc, get_chained_paf(chained, 200, 200)->chain_score == 1000 + 300 - 200);
+    stList_setDestructor(pafs, NULL);
+    stList_destruct(pafs);
+    stList_destruct(chained);
+
+    /* With windows of 500 bases the chain is within one window, so the output is identical to the serial run */
+    pafs = make_window_spanning_pafs();
+    chained = paf_chain2(pafs, test_gap_cost, NULL, 250, 0.0, -1, -1, 500, NULL);
+    CuAssertTrue(tc, get_chained_paf(chained, 400, 400)->chain_score == 1900);
+    CuAssertTrue(tc, get_chained_paf(chained, 400, 400)->chain_id == get_chained_paf(chained, 0, 0)->chain_id);
+    CuAssertTrue(tc, get_chained_paf(chained, 200, 50)->chain_score == 600);
+    stList_setDestructor(pafs, NULL);
+    stList_destruct(pafs);
+    stList_destruct(chained);
+}
+
+/* ---- 18. Alignment fingerprints and containment ---- */
+
+static void test_fingerprint_set(CuTest *tc) {
+    FingerprintSet *fingerprint_set = fingerprintSet_construct();
+    Paf *paf = make_paf("q", 100, 10, 20, 0, "t", 200, 30, 40, 10, 10, 60, "10M");
+    PafFingerprint f = fingerprintSet_get_fingerprint(fingerprint_set, paf, 0);
+    PafFingerprint c = fingerprintSet_get_fingerprint(fingerprint_set, paf, 1);
+    CuAssertTrue(tc, fingerprintSet_add(fingerprint_set, f));
+    CuAssertTrue(tc, !fingerprintSet_add(fingerprint_set, f));
+    CuAssertTrue(tc, fingerprintSet_contains(fingerprint_set, f));
+
+    /* The canonical fingerprint of the inverse is the same, but the plain fingerprint is not */
+    paf_invert(paf);
+    PafFingerprint fi = fingerprintSet_get_fingerprint(fingerprint_set, paf, 0);
+    PafFingerprint ci = fingerprintSet_get_fingerprint(fingerprint_set, paf, 1);
+    CuAssertTrue(tc, fi.hi != f.hi || fi.lo != f.lo);
+    CuAssertTrue(tc, ci.hi == c.hi && ci.lo == c.lo);
+    CuAssertTrue(tc, !fingerprintSet_contains(fingerprint_set, fi));
+
+    /* Any change of the coordinates or strand gives a new fingerprint, including when the table grows */
+    for(int64_t i=0; i<10000; i++) {
+        paf->query_start = i;
+        paf->query_end = i + 10;
+        paf->same_strand = i % 2;
+        CuAssertTrue(tc, fingerprintSet_add(fingerprint_set, fingerprintSet_get_fingerprint(fingerprint_set, paf, 0)));
+    }
+    CuAssertIntEquals(tc, 10001, fingerprint_set->size);
+    for(int64_t i=0; i<10000; i++) {
+        paf->query_start = i;
+        paf->query_end = i + 10;
+        paf->same_strand = i % 2;
+        CuAssertTrue(tc, fingerprintSet_contains(fingerprint_set, fingerprintSet_get_fingerprint(fingerprint_set, paf, 0)));
+        paf->same_strand = !paf->same_strand;
+        CuAssertTrue(tc, !fingerprintSet_contains(fingerprint_set, fingerprintSet_get_fingerprint(fingerprint_set, paf, 0)));
+    }
+    paf_destruct(paf);
+    fingerprintSet_destruct(fingerprint_set);
+
+    /* The fingerprints made by hashing the names behave the same */
+    paf = make_paf("q", 100, 10, 20, 0, "t", 200, 30, 40, 10, 10, 60, "10M");
+    Paf *paf2 = make_paf("q", 100, 10, 20, 0, "t2", 200, 30, 40, 10, 10, 60, "10M");
+    f = paf_get_fingerprint(paf, 0);
+    c = paf_get_fingerprint(paf, 1);
+    PafFingerprint f2 = paf_get_fingerprint(paf2, 0);
+    CuAssertTrue(tc, f2.hi != f.hi || f2.lo != f.lo);
+    paf_invert(paf);
+    fi = paf_get_fingerprint(paf, 0);
+    ci = paf_get_fingerprint(paf, 1);
+    CuAssertTrue(tc, fi.hi != f.hi || fi.lo != f.lo);
+    CuAssertTrue(tc, ci.hi == c.hi && ci.lo == c.lo);
+    paf_destruct(paf);
+    paf_destruct(paf2);
+}
+
+static void test_remove_contained_pafs(CuTest *tc) {
+    stList *pafs = stList_construct3(0, (void (*)(void *))paf_destruct);
+    stList_append(pafs, make_paf("q", 200, 10, 50, 1, "t", 200, 110, 150, 40, 40, 60, "40M")); // Within the next
+    stList_append(pafs, make_paf("q", 200, 0, 100, 1, "t", 200, 100, 200, 100, 100, 60, "100M"));
+    stList_append(pafs, make_paf("q", 200, 10, 50, 1, "t", 200, 111, 151, 40, 40, 60, "40M")); // Off the diagonal
+    stList_append(pafs, make_paf("q", 200, 10, 50, 0, "t", 200, 110, 150, 40, 40, 60, "40M")); // Other strand
+    stList_append(pafs, make_paf("q", 200, 0, 100, 1, "t", 200, 100, 200, 100, 100, 60, "100M")); // Duplicate
+    // Opposite strand, the second is a sub-path of the first through a gap
+    stList_append(pafs, make_paf("q", 200, 100, 160, 0, "t", 200, 0, 52, 50, 50, 60, "20M2D10I30M"));
+    stList_append(pafs, make_paf("q", 200, 113, 145, 0, "t", 200, 15, 39, 22, 22, 60, "5M2D10I17M"));
+    CuAssertIntEquals(tc, 3, remove_contained_pafs(pafs, 0));
+    CuAssertIntEquals(tc, 4, stList_length(pafs));
+    CuAssertIntEquals(tc, 0, ((Paf *)stList_get(pafs, 0))->query_start);
+    CuAssertIntEquals(tc, 111, ((Paf *)stList_get(pafs, 1))->target_start);
+    CuAssertIntEquals(tc, 0, ((Paf *)stList_get(pafs, 2))->same_strand);
+    CuAssertIntEquals(tc, 100, ((Paf *)stList_get(pafs, 3))->query_start);
+
+    /* With slack the alignment off the diagonal is removed */
+    CuAssertIntEquals(tc, 1, remove_contained_pafs(pafs, 1));
+    CuAssertIntEquals(tc, 3, stList_length(pafs));
+    stList_destruct(pafs);
+}
+
 /* ---- Registration ---- */
 
 CuSuite *addPafUnitTestSuite(void) {
@@ -748,17 +1391,20 @@ CuSuite *addPafUnitTestSuite(void) {
     SUITE_ADD_TEST(suite, test_paf_roundtrip_with_cigar);
     SUITE_ADD_TEST(suite, test_paf_read_write);
     SUITE_ADD_TEST(suite, test_read_write_pafs_list);
+    SUITE_ADD_TEST(suite, test_paf_read_key);
     SUITE_ADD_TEST(suite, test_paf_stats_calc_all_match);
     SUITE_ADD_TEST(suite, test_paf_stats_calc_mixed);
     SUITE_ADD_TEST(suite, test_paf_stats_calc_zero_flag);
     SUITE_ADD_TEST(suite, test_paf_invert_same_strand);
     SUITE_ADD_TEST(suite, test_paf_invert_opposite_strand);
     SUITE_ADD_TEST(suite, test_paf_invert_double);
+    SUITE_ADD_TEST(suite, test_inverted_pafs);
     SUITE_ADD_TEST(suite, test_aligned_bases);
     SUITE_ADD_TEST(suite, test_paf_trim_ends_zero);
     SUITE_ADD_TEST(suite, test_paf_trim_ends_same_strand);
     SUITE_ADD_TEST(suite, test_paf_trim_ends_with_gaps);
     SUITE_ADD_TEST(suite, test_paf_trim_end_fraction);
+    SUITE_ADD_TEST(suite, test_paf_clip);
     SUITE_ADD_TEST(suite, test_paf_shatter_single_match);
     SUITE_ADD_TEST(suite, test_paf_shatter_multi_match);
     SUITE_ADD_TEST(suite, test_paf_shatter_opposite_strand);
@@ -767,12 +1413,25 @@ CuSuite *addPafUnitTestSuite(void) {
     SUITE_ADD_TEST(suite, test_paf_encode_mismatches_mixed);
     SUITE_ADD_TEST(suite, test_paf_remove_mismatches);
     SUITE_ADD_TEST(suite, test_coverage_tracking);
+    SUITE_ADD_TEST(suite, test_coverage_range_histogram);
+    SUITE_ADD_TEST(suite, test_depth_filter);
+    SUITE_ADD_TEST(suite, test_count_arrays_file);
+    SUITE_ADD_TEST(suite, test_sparse_coverage);
+    SUITE_ADD_TEST(suite, test_coverage_events);
+    SUITE_ADD_TEST(suite, test_coverage_track);
     SUITE_ADD_TEST(suite, test_decode_fasta_header);
+    SUITE_ADD_TEST(suite, test_fasta_read_lengths);
     SUITE_ADD_TEST(suite, test_cmp_intervals);
     SUITE_ADD_TEST(suite, test_paf_trim_unreliable_tails_trims_tails);
     SUITE_ADD_TEST(suite, test_paf_trim_unreliable_tails_no_trim);
     SUITE_ADD_TEST(suite, test_paf_trim_unreliable_tails_opposite_strand);
     SUITE_ADD_TEST(suite, test_paf_pretty_print_basic);
     SUITE_ADD_TEST(suite, test_paf_check_valid);
+    SUITE_ADD_TEST(suite, test_paf_chain_colinear);
+    SUITE_ADD_TEST(suite, test_paf_chain_bounds);
+    SUITE_ADD_TEST(suite, test_paf_chain_windows);
+    SUITE_ADD_TEST(suite, test_paf_chain_windows_bound);
+    SUITE_ADD_TEST(suite, test_fingerprint_set);
+    SUITE_ADD_TEST(suite, test_remove_contained_pafs);
     return suite;
 }